@@ -24,14 +24,14 @@
 #include <QDir>
 #include <QTimer>
 #include "ownclouddolphinpluginhelper.h"
+#include "ownclouddolphinstatuscache.h"
 
 class OwncloudDolphinPlugin : public KOverlayIconPlugin
 {
     Q_PLUGIN_METADATA(IID "com.owncloud.ovarlayiconplugin" FILE "ownclouddolphinoverlayplugin.json")
     Q_OBJECT
 
-    typedef QHash<QByteArray, QByteArray> StatusMap;
-    StatusMap m_status;
+    OwncloudDolphinStatusCache m_cache;
 
 public:
 
@@ -39,6 +39,8 @@ public:
         auto helper = OwncloudDolphinPluginHelper::instance();
         QObject::connect(helper, &OwncloudDolphinPluginHelper::commandRecieved,
                          this, &OwncloudDolphinPlugin::slotCommandRecieved);
+        QObject::connect(helper, &OwncloudDolphinPluginHelper::connected,
+                         this, [this] { m_cache.clear(); });
     }
 
     QStringList getOverlays(const QUrl& url) override {
@@ -50,16 +52,38 @@ public:
         QDir localPath(url.toLocalFile());
         const QByteArray localFile = localPath.canonicalPath().toUtf8();
 
-        helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        OwncloudDolphinStatusCache::Request request;
+        const QByteArray status = m_cache.lookup(localFile, &request);
+        const QByteArray directory = localFile.left(localFile.lastIndexOf('/'));
+        if (helper->supportsBatchedStatus() && isInSyncFolder(directory)) {
+            // One request for all the entries Dolphin is about to show,
+            // the pushes keep them up to date afterwards.
+            if (request == OwncloudDolphinStatusCache::RequestDirectory)
+                helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUSES:" + directory + "\n"));
+            else if (request == OwncloudDolphinStatusCache::RequestFile)
+                helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        } else if (status.isNull()) {
+            // Sync folders themselves are in directories the client doesn't know
+            helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        }
 
-        StatusMap::iterator it = m_status.find(localFile);
-        if (it != m_status.constEnd()) {
-            return  overlaysForString(*it);
+        if (!status.isNull()) {
+            return overlaysForString(status);
         }
         return QStringList();
     }
 
 private:
+    bool isInSyncFolder(const QByteArray &directory) const {
+        const QString path = QString::fromUtf8(directory);
+        const auto syncFolders = OwncloudDolphinPluginHelper::instance()->paths();
+        for (const QString &syncFolder : syncFolders) {
+            if (path == syncFolder || path.startsWith(syncFolder + QLatin1Char('/')))
+                return true;
+        }
+        return false;
+    }
+
     QStringList overlaysForString(const QByteArray &status) {
         QStringList r;
         if (status.startsWith("NOP"))
@@ -81,22 +105,11 @@ private:
     }
 
     void slotCommandRecieved(const QByteArray &line) {
-
-        QList<QByteArray> tokens = line.split(':');
-        if (tokens.count() != 3)
-            return;
-        if (tokens[0] != "STATUS" && tokens[0] != "BROADCAST")
-            return;
-        if (tokens[2].isEmpty())
-            return;
-
-        const QByteArray name = tokens[2];
-        QByteArray &status = m_status[name]; // reference to the item in the hash
-        if (status == tokens[1])
+        const QByteArray name = m_cache.processLine(line);
+        if (name.isEmpty())
             return;
-        status = tokens[1];
 
-        emit overlaysChanged(QUrl::fromLocalFile(QString::fromUtf8(name)), overlaysForString(status));
+        emit overlaysChanged(QUrl::fromLocalFile(QString::fromUtf8(name)), overlaysForString(m_cache.status(name)));
     }
 };
 
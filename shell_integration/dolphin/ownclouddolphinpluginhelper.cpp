@@ -57,9 +57,21 @@ void OwncloudDolphinPluginHelper::sendCommand(const char* data)
     _socket.flush();
 }
 
+bool OwncloudDolphinPluginHelper::supportsBatchedStatus() const
+{
+    const QList<QByteArray> version = _apiVersion.split('.');
+    const int major = version.value(0).toInt();
+    const int minor = version.value(1).toInt();
+    return major > 1 || (major == 1 && minor >= 1);
+}
+
 void OwncloudDolphinPluginHelper::slotConnected()
 {
-    sendCommand("GET_STRINGS:\n");
+    // The client sends REGISTER_PATH again for all its folders
+    _paths.clear();
+    _apiVersion.clear();
+    emit connected();
+    sendCommand("VERSION:\nGET_STRINGS:\n");
 }
 
 void OwncloudDolphinPluginHelper::tryConnect()
@@ -92,6 +104,10 @@ void OwncloudDolphinPluginHelper::slotReadyRead()
             QString file = QString::fromUtf8(line.constData() + col + 1, line.size() - col - 1);
             _paths.append(file);
             continue;
+        } else if (line.startsWith("VERSION:")) {
+            // VERSION:<client version>:<socket API version>
+            _apiVersion = line.mid(line.lastIndexOf(':') + 1);
+            continue;
         } else if (line.startsWith("STRING:")) {
             auto args = QString::fromUtf8(line).split(QLatin1Char(':'));
             if (args.size() >= 3) {
@@ -31,6 +31,8 @@ public:
     bool isConnected() const;
     void sendCommand(const char *data);
     QVector<QString> paths() const { return _paths; }
+    /** Whether the client understands RETRIEVE_FILE_STATUSES, since socket API 1.1 */
+    bool supportsBatchedStatus() const;
 
     QString contextMenuTitle() const
     {
@@ -46,6 +48,8 @@ public:
 
 signals:
     void commandRecieved(const QByteArray &cmd);
+    /** A (new) client connected, what was received from the old one is stale */
+    void connected();
 
 protected:
     void timerEvent(QTimerEvent*) override;
@@ -61,4 +65,5 @@ private:
     QBasicTimer _connectTimer;
 
     QMap<QString, QString> _strings;
+    QByteArray _apiVersion;
 };
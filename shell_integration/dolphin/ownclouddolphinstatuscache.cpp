@@ -0,0 +1,152 @@
+/******************************************************************************
+ *   Copyright (C) by ownCloud GmbH                                           *
+ *                                                                            *
+ *   This program is free software; you can redistribute it and/or modify     *
+ *   it under the terms of the GNU General Public License as published by     *
+ *   the Free Software Foundation; either version 2 of the License, or        *
+ *   (at your option) any later version.                                      *
+ *                                                                            *
+ *   This program is distributed in the hope that it will be useful,          *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *   GNU General Public License for more details.                             *
+ *                                                                            *
+ *   You should have received a copy of the GNU General Public License        *
+ *   along with this program; if not, write to the                            *
+ *   Free Software Foundation, Inc.,                                          *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA               *
+ ******************************************************************************/
+
+#include "ownclouddolphinstatuscache.h"
+
+// Dolphin rarely shows more than a few directories at once, the least
+// recently used ones are dropped beyond this and asked for again if needed.
+static const int maximumDirectories = 64;
+
+static inline int nameSeparator(const QByteArray &file)
+{
+    return file.lastIndexOf('/');
+}
+
+QByteArray OwncloudDolphinStatusCache::lookup(const QByteArray &file, Request *request)
+{
+    const int separator = nameSeparator(file);
+    Directory &dir = directory(file.left(separator));
+    // Only what Dolphin shows counts as use
+    dir._lastUse = ++_useCounter;
+
+    const QByteArray name = file.mid(separator + 1);
+    const QByteArray status = dir._statuses.value(name);
+    *request = NoRequest;
+    if (!dir._requested) {
+        *request = RequestDirectory;
+        dir._requested = true;
+        return status;
+    }
+    if (!status.isNull())
+        return status;
+
+    // Everything is unknown until the answer for the directory is in
+    if (dir._answered && !dir._requestedFiles.contains(name)) {
+        dir._requestedFiles.insert(name);
+        *request = RequestFile;
+    }
+    return status;
+}
+
+QByteArray OwncloudDolphinStatusCache::status(const QByteArray &file) const
+{
+    const int separator = nameSeparator(file);
+    auto it = _directories.constFind(file.left(separator));
+    if (it == _directories.constEnd())
+        return QByteArray();
+    return it->_statuses.value(file.mid(separator + 1));
+}
+
+QByteArray OwncloudDolphinStatusCache::processLine(const QByteArray &line)
+{
+    const int colon = line.indexOf(':');
+    if (colon < 0)
+        return QByteArray();
+    const QByteArray verb = line.left(colon);
+
+    if (verb == "STATUS" || verb == "BROADCAST") {
+        // STATUS:<status>:<path>, the path may contain colons itself
+        const int pathColon = line.indexOf(':', colon + 1);
+        if (pathColon < 0 || pathColon == line.size() - 1)
+            return QByteArray();
+        const QByteArray file = line.mid(pathColon + 1);
+        const int separator = nameSeparator(file);
+
+        Directory &dir = directory(file.left(separator));
+        QByteArray &status = dir._statuses[file.mid(separator + 1)];
+        const QByteArray newStatus = line.mid(colon + 1, pathColon - colon - 1);
+        if (status == newStatus)
+            return QByteArray();
+        status = newStatus;
+        return file;
+    }
+
+    if (verb == "STATUSES_END") {
+        // The answer may come in many chunks, and pushes for the directory
+        // may arrive before it, only this line tells that it is complete.
+        auto it = _directories.find(line.mid(colon + 1));
+        if (it != _directories.end() && it->_requested)
+            it->_answered = true;
+    } else if (verb == "UPDATE_VIEW") {
+        // The statuses are kept current by the pushes, but ask again the
+        // next time one of these directories is shown.
+        forgetBelow(line.mid(colon + 1), false);
+    } else if (verb == "UNREGISTER_PATH") {
+        forgetBelow(line.mid(colon + 1), true);
+    }
+    return QByteArray();
+}
+
+void OwncloudDolphinStatusCache::clear()
+{
+    _directories.clear();
+}
+
+OwncloudDolphinStatusCache::Directory &OwncloudDolphinStatusCache::directory(const QByteArray &path)
+{
+    auto it = _directories.find(path);
+    if (it == _directories.end()) {
+        if (_directories.size() >= maximumDirectories) {
+            auto oldest = _directories.begin();
+            for (auto dir = _directories.begin(); dir != _directories.end(); ++dir) {
+                if (dir->_lastUse < oldest->_lastUse)
+                    oldest = dir;
+            }
+            _directories.erase(oldest);
+        }
+        it = _directories.insert(path, Directory());
+    }
+    return *it;
+}
+
+void OwncloudDolphinStatusCache::forgetBelow(const QByteArray &path, bool dropStatuses)
+{
+    if (path.isEmpty())
+        return;
+    if (dropStatuses) {
+        // The folder itself is an entry of its parent directory
+        const int separator = nameSeparator(path);
+        auto parent = _directories.find(path.left(separator));
+        if (parent != _directories.end())
+            parent->_statuses.remove(path.mid(separator + 1));
+    }
+    const QByteArray prefix = path.endsWith('/') ? path : path + '/';
+    for (auto it = _directories.begin(); it != _directories.end();) {
+        if (it.key() == path || it.key().startsWith(prefix)) {
+            if (dropStatuses) {
+                it = _directories.erase(it);
+                continue;
+            }
+            it->_requested = false;
+            it->_answered = false;
+            it->_requestedFiles.clear();
+        }
+        ++it;
+    }
+}
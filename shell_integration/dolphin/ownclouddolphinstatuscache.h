@@ -0,0 +1,84 @@
+/******************************************************************************
+ *   Copyright (C) by ownCloud GmbH                                           *
+ *                                                                            *
+ *   This program is free software; you can redistribute it and/or modify     *
+ *   it under the terms of the GNU General Public License as published by     *
+ *   the Free Software Foundation; either version 2 of the License, or        *
+ *   (at your option) any later version.                                      *
+ *                                                                            *
+ *   This program is distributed in the hope that it will be useful,          *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *   GNU General Public License for more details.                             *
+ *                                                                            *
+ *   You should have received a copy of the GNU General Public License        *
+ *   along with this program; if not, write to the                            *
+ *   Free Software Foundation, Inc.,                                          *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA               *
+ ******************************************************************************/
+
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+
+/**
+ * The statuses of the files in the directories Dolphin shows, as the client
+ * last reported them.
+ *
+ * The client pushes STATUS messages for the directories it knows we look at,
+ * so once a directory was asked for its overlays can be resolved without
+ * going through the socket again.
+ */
+class OwncloudDolphinStatusCache
+{
+public:
+    /** What should be asked from the client after a lookup */
+    enum Request {
+        NoRequest,
+        /// The statuses of all the entries of the file's directory
+        RequestDirectory,
+        /// The status of this file, which the directory's answer didn't have
+        RequestFile
+    };
+
+    /**
+     * Returns the status of the file, or a null array if it isn't known yet.
+     *
+     * The first lookup in a directory asks for all its entries at once. Files
+     * still unknown after the STATUSES_END line of that answer, e.g. new
+     * excluded files that never get pushed, are asked for one by one.
+     */
+    QByteArray lookup(const QByteArray &file, Request *request);
+
+    /** The status of the file, or a null array, without touching the cache */
+    QByteArray status(const QByteArray &file) const;
+
+    /**
+     * Updates the cache from a line received from the client.
+     *
+     * Returns the file whose status changed, or an empty array if none did.
+     */
+    QByteArray processLine(const QByteArray &line);
+
+    /** Forgets everything, e.g. when the client was restarted */
+    void clear();
+
+    int directoryCount() const { return _directories.size(); }
+
+private:
+    struct Directory
+    {
+        QHash<QByteArray, QByteArray> _statuses; // file name -> status
+        bool _requested = false;
+        bool _answered = false;
+        QSet<QByteArray> _requestedFiles;
+        quint64 _lastUse = 0; // of the last lookup, pushes don't count
+    };
+
+    Directory &directory(const QByteArray &path);
+    void forgetBelow(const QByteArray &path, bool dropStatuses);
+
+    QHash<QByteArray, Directory> _directories;
+    quint64 _useCounter = 0;
+};
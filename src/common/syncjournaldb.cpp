@@ -23,6 +23,8 @@
 #include <QElapsedTimer>
 #include <QUrl>
 #include <QDir>
+#include <QThread>
+#include <QAbstractEventDispatcher>
 
 #include "common/syncjournaldb.h"
 #include "version.h"
@@ -36,6 +38,9 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcDb, "sync.database", QtInfoMsg)
 
+// With group commits, commit at least after that many commit() calls
+static const int maxGroupCommitSize = 1000;
+
 static QString defaultJournalMode(const QString &dbPath)
 {
 #ifdef Q_OS_WIN
@@ -57,7 +62,13 @@ SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     : QObject(parent)
     , _dbFile(dbFilePath)
     , _transaction(0)
+    , _syncGeneration(0)
+    , _groupCommitInterval(0)
+    , _pendingCommits(0)
 {
+    _groupCommitTimer.setSingleShot(true);
+    connect(&_groupCommitTimer, &QTimer::timeout, this, &SyncJournalDb::slotGroupCommit);
+
     // Allow forcing the journal mode for debugging
     static QString envJournalMode = QString::fromLocal8Bit(qgetenv("OWNCLOUD_SQLITE_JOURNAL_MODE"));
     _journalMode = envJournalMode;
@@ -225,6 +236,8 @@ void SyncJournalDb::commitTransaction()
             return;
         }
         _transaction = 0;
+        _pendingCommits = 0;
+        _lastCommit.start();
     } else {
         qCDebug(lcDb) << "No database Transaction to commit";
     }
@@ -320,6 +333,7 @@ bool SyncJournalDb::checkConnect()
                         // ignoredChildrenRemote
                         // contentChecksum
                         // contentChecksumTypeId
+                        // generation
                         "PRIMARY KEY(phash)"
                         ");");
 
@@ -368,6 +382,18 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table uploadinfo", createQuery);
     }
 
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS blockchecksums("
+                        "path VARCHAR(4096),"
+                        "etag VARCHAR(32),"
+                        "blocksize INTEGER(8),"
+                        "checksums TEXT,"
+                        "PRIMARY KEY(path)"
+                        ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail("Create table blockchecksums", createQuery);
+    }
+
     // create the blacklist table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS blacklist ("
                         "path VARCHAR(4096),"
@@ -508,10 +534,19 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _getFileRecordQuery", *_getFileRecordQuery);
     }
 
+    _getFileRecordByChecksumQuery.reset(new SqlQuery(_db));
+    if (_getFileRecordByChecksumQuery->prepare(
+            "SELECT path FROM metadata"
+            "  JOIN checksumtype as contentchecksumtype ON metadata.contentChecksumTypeId == contentchecksumtype.id"
+            " WHERE contentChecksum=?1 AND contentchecksumtype.name=?2 AND filesize=?3"
+            " LIMIT 1")) {
+        return sqlFail("prepare _getFileRecordByChecksumQuery", *_getFileRecordByChecksumQuery);
+    }
+
     _setFileRecordQuery.reset(new SqlQuery(_db));
     if (_setFileRecordQuery->prepare("INSERT OR REPLACE INTO metadata "
-                                     "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId) "
-                                     "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16);")) {
+                                     "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, generation) "
+                                     "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17);")) {
         return sqlFail("prepare _setFileRecordQuery", *_setFileRecordQuery);
     }
 
@@ -567,6 +602,28 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _deleteUploadInfoQuery", *_deleteUploadInfoQuery);
     }
 
+    _getBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_getBlockChecksumsQuery->prepare("SELECT etag, blocksize, checksums FROM "
+                                         "blockchecksums WHERE path=?1")) {
+        return sqlFail("prepare _getBlockChecksumsQuery", *_getBlockChecksumsQuery);
+    }
+
+    _setBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_setBlockChecksumsQuery->prepare("INSERT OR REPLACE INTO blockchecksums "
+                                         "(path, etag, blocksize, checksums) "
+                                         "VALUES ( ?1 , ?2, ?3 , ?4 )")) {
+        return sqlFail("prepare _setBlockChecksumsQuery", *_setBlockChecksumsQuery);
+    }
+
+    _deleteBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_deleteBlockChecksumsQuery->prepare("DELETE FROM blockchecksums WHERE path=?1")) {
+        return sqlFail("prepare _deleteBlockChecksumsQuery", *_deleteBlockChecksumsQuery);
+    }
+
+    _deleteBlockChecksumsRecursively.reset(new SqlQuery(_db));
+    if (_deleteBlockChecksumsRecursively->prepare("DELETE FROM blockchecksums WHERE path LIKE(?||'/%')")) {
+        return sqlFail("prepare _deleteBlockChecksumsRecursively", *_deleteBlockChecksumsRecursively);
+    }
 
     _deleteFileRecordPhash.reset(new SqlQuery(_db));
     if (_deleteFileRecordPhash->prepare("DELETE FROM metadata WHERE phash=?1")) {
@@ -651,6 +708,7 @@ void SyncJournalDb::close()
     commitTransaction();
 
     _getFileRecordQuery.reset(0);
+    _getFileRecordByChecksumQuery.reset(0);
     _setFileRecordQuery.reset(0);
     _setFileRecordChecksumQuery.reset(0);
     _setFileRecordLocalMetadataQuery.reset(0);
@@ -660,6 +718,10 @@ void SyncJournalDb::close()
     _getUploadInfoQuery.reset(0);
     _setUploadInfoQuery.reset(0);
     _deleteUploadInfoQuery.reset(0);
+    _getBlockChecksumsQuery.reset(0);
+    _setBlockChecksumsQuery.reset(0);
+    _deleteBlockChecksumsQuery.reset(0);
+    _deleteBlockChecksumsRecursively.reset(0);
     _deleteFileRecordPhash.reset(0);
     _deleteFileRecordRecursively.reset(0);
     _getErrorBlacklistQuery.reset(0);
@@ -779,6 +841,36 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add contentChecksumTypeId col");
     }
 
+    if (1) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_checksum ON metadata(contentChecksum);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index contentChecksum", query);
+            re = false;
+        }
+        commitInternal("update database structure: add contentChecksum index");
+    }
+
+    if (columns.indexOf(QLatin1String("generation")) == -1) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE metadata ADD COLUMN generation INTEGER(8) NOT NULL DEFAULT 0;");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: add generation column", query);
+            re = false;
+        }
+        commitInternal("update database structure: add generation col");
+    }
+
+    if (1) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_generation ON metadata(generation);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index generation", query);
+            re = false;
+        }
+        commitInternal("update database structure: add generation index");
+    }
+
 
     return re;
 }
@@ -929,6 +1021,7 @@ bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
         _setFileRecordQuery->bindValue(14, record._serverHasIgnoredFiles ? 1 : 0);
         _setFileRecordQuery->bindValue(15, checksum);
         _setFileRecordQuery->bindValue(16, contentChecksumTypeId);
+        _setFileRecordQuery->bindValue(17, _syncGeneration);
 
         if (!_setFileRecordQuery->exec()) {
             return false;
@@ -957,12 +1050,24 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
             return false;
         }
 
+        _deleteBlockChecksumsQuery->reset_and_clear_bindings();
+        _deleteBlockChecksumsQuery->bindValue(1, filename);
+        if (!_deleteBlockChecksumsQuery->exec()) {
+            return false;
+        }
+
         if (recursively) {
             _deleteFileRecordRecursively->reset_and_clear_bindings();
             _deleteFileRecordRecursively->bindValue(1, filename);
             if (!_deleteFileRecordRecursively->exec()) {
                 return false;
             }
+
+            _deleteBlockChecksumsRecursively->reset_and_clear_bindings();
+            _deleteBlockChecksumsRecursively->bindValue(1, filename);
+            if (!_deleteBlockChecksumsRecursively->exec()) {
+                return false;
+            }
         }
         return true;
     } else {
@@ -972,6 +1077,26 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 }
 
 
+// Reads a file record from a query selecting the columns of _getFileRecordQuery
+static SyncJournalFileRecord fileRecordFromQuery(SqlQuery &query)
+{
+    SyncJournalFileRecord rec;
+    rec._path = query.stringValue(0);
+    rec._inode = query.intValue(1);
+    //rec._uid     = query.value(2).toInt(&ok); Not Used
+    //rec._gid     = query.value(3).toInt(&ok); Not Used
+    //rec._mode    = query.intValue(4);
+    rec._modtime = Utility::qDateTimeFromTime_t(query.int64Value(5));
+    rec._type = query.intValue(6);
+    rec._etag = query.baValue(7);
+    rec._fileId = query.baValue(8);
+    rec._remotePerm = RemotePermissions(query.baValue(9).constData());
+    rec._fileSize = query.int64Value(10);
+    rec._serverHasIgnoredFiles = (query.intValue(11) > 0);
+    rec._checksumHeader = query.baValue(12);
+    return rec;
+}
+
 SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString &filename)
 {
     QMutexLocker locker(&_mutex);
@@ -990,19 +1115,7 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString &filename)
         }
 
         if (_getFileRecordQuery->next()) {
-            rec._path = _getFileRecordQuery->stringValue(0);
-            rec._inode = _getFileRecordQuery->intValue(1);
-            //rec._uid     = _getFileRecordQuery->value(2).toInt(&ok); Not Used
-            //rec._gid     = _getFileRecordQuery->value(3).toInt(&ok); Not Used
-            //rec._mode    = _getFileRecordQuery->intValue(4);
-            rec._modtime = Utility::qDateTimeFromTime_t(_getFileRecordQuery->int64Value(5));
-            rec._type = _getFileRecordQuery->intValue(6);
-            rec._etag = _getFileRecordQuery->baValue(7);
-            rec._fileId = _getFileRecordQuery->baValue(8);
-            rec._remotePerm = RemotePermissions(_getFileRecordQuery->baValue(9).constData());
-            rec._fileSize = _getFileRecordQuery->int64Value(10);
-            rec._serverHasIgnoredFiles = (_getFileRecordQuery->intValue(11) > 0);
-            rec._checksumHeader = _getFileRecordQuery->baValue(12);
+            rec = fileRecordFromQuery(*_getFileRecordQuery);
         } else {
             int errId = _getFileRecordQuery->errorId();
             if (errId != SQLITE_DONE) { // only do this if the problem is different from SQLITE_DONE
@@ -1017,49 +1130,160 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString &filename)
     return rec;
 }
 
-bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
-    const QSet<QString> &prefixesToKeep)
+QVector<SyncJournalFileRecord> SyncJournalDb::getFileRecords(const QStringList &filenames)
+{
+    // Short enough that single lookups from the GUI thread don't wait long
+    static const int chunkSize = 256;
+
+    QVector<SyncJournalFileRecord> records(filenames.size());
+
+    for (int start = 0; start < filenames.size(); start += chunkSize) {
+        QMutexLocker locker(&_mutex);
+        if (!checkConnect()) {
+            return records;
+        }
+
+        const int end = qMin(start + chunkSize, filenames.size());
+        for (int i = start; i < end; ++i) {
+            const QString &filename = filenames.at(i);
+            if (filename.isEmpty()) {
+                continue;
+            }
+            _getFileRecordQuery->reset_and_clear_bindings();
+            _getFileRecordQuery->bindValue(1, QString::number(getPHash(filename)));
+            if (!_getFileRecordQuery->exec()) {
+                locker.unlock();
+                close();
+                return records;
+            }
+            if (_getFileRecordQuery->next()) {
+                records[i] = fileRecordFromQuery(*_getFileRecordQuery);
+            } else {
+                int errId = _getFileRecordQuery->errorId();
+                if (errId != SQLITE_DONE) { // only do this if the problem is different from SQLITE_DONE
+                    QString err = _getFileRecordQuery->error();
+                    qCWarning(lcDb) << "No journal entry found for " << filename << "Error: " << err;
+                    locker.unlock();
+                    close();
+                    return records;
+                }
+            }
+        }
+    }
+    return records;
+}
+
+SyncJournalFileRecord SyncJournalDb::getFileRecordByChecksum(const QByteArray &checksumHeader, qint64 size)
+{
+    QByteArray checksumType, checksum;
+    if (!parseChecksumHeader(checksumHeader, &checksumType, &checksum) || checksum.isEmpty()) {
+        return SyncJournalFileRecord();
+    }
+
+    QString path;
+    {
+        QMutexLocker locker(&_mutex);
+        if (!checkConnect()) {
+            return SyncJournalFileRecord();
+        }
+
+        _getFileRecordByChecksumQuery->reset_and_clear_bindings();
+        _getFileRecordByChecksumQuery->bindValue(1, checksum);
+        _getFileRecordByChecksumQuery->bindValue(2, checksumType);
+        _getFileRecordByChecksumQuery->bindValue(3, size);
+        if (!_getFileRecordByChecksumQuery->exec()) {
+            return SyncJournalFileRecord();
+        }
+        if (!_getFileRecordByChecksumQuery->next()) {
+            return SyncJournalFileRecord();
+        }
+        path = _getFileRecordByChecksumQuery->stringValue(0);
+    }
+    return getFileRecord(path);
+}
+
+void SyncJournalDb::startSyncGeneration()
 {
     QMutexLocker locker(&_mutex);
 
     if (!checkConnect()) {
-        return false;
+        return;
     }
 
     SqlQuery query(_db);
-    query.prepare("SELECT phash, path FROM metadata order by path");
-
+    query.prepare("SELECT max(generation) FROM metadata;");
     if (!query.exec()) {
-        return false;
+        sqlFail("startSyncGeneration", query);
+        return;
     }
+    qint64 generation = query.next() ? query.int64Value(0) : 0;
+    _syncGeneration = qMax(generation, _syncGeneration) + 1;
+    qCInfo(lcDb) << "Starting sync generation" << _syncGeneration;
+}
 
-    QStringList superfluousItems;
+bool SyncJournalDb::markFileRecordsSeen(const QVector<qint64> &phashes)
+{
+    // Well below SQLITE_MAX_VARIABLE_NUMBER
+    static const int chunkSize = 500;
 
-    while (query.next()) {
-        const QString file = query.stringValue(1);
-        bool keep = filepathsToKeep.contains(file);
-        if (!keep) {
-            foreach (const QString &prefix, prefixesToKeep) {
-                if (file.startsWith(prefix)) {
-                    keep = true;
-                    break;
-                }
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return false;
+    }
+
+    SqlQuery query(_db);
+    int preparedSize = 0;
+    for (int start = 0; start < phashes.size(); start += chunkSize) {
+        const int size = qMin(chunkSize, phashes.size() - start);
+        if (size != preparedSize) {
+            QString sql = "UPDATE metadata SET generation=?1 WHERE generation<?1 AND phash IN (?2";
+            for (int i = 1; i < size; ++i) {
+                sql += QString(",?%1").arg(i + 2);
+            }
+            sql += ");";
+            if (query.prepare(sql) != 0) {
+                return sqlFail("markFileRecordsSeen: prepare", query);
             }
+            preparedSize = size;
+        }
+
+        query.reset_and_clear_bindings();
+        query.bindValue(1, _syncGeneration);
+        for (int i = 0; i < size; ++i) {
+            query.bindValue(i + 2, phashes.at(start + i));
         }
-        if (!keep) {
-            superfluousItems.append(query.stringValue(0));
+        if (!query.exec()) {
+            return sqlFail("markFileRecordsSeen", query);
         }
     }
+    return true;
+}
 
-    if (superfluousItems.count()) {
-        QString sql = "DELETE FROM metadata WHERE phash in (" + superfluousItems.join(",") + ")";
-        qCInfo(lcDb) << "Sync Journal cleanup for" << superfluousItems;
-        SqlQuery delQuery(_db);
-        delQuery.prepare(sql);
-        if (!delQuery.exec()) {
-            return false;
-        }
+bool SyncJournalDb::postSyncCleanup(const QSet<QString> &prefixesToKeep)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return false;
+    }
+
+    QString sql = "DELETE FROM metadata WHERE generation < ?1";
+    for (int i = 0; i < prefixesToKeep.size(); ++i) {
+        sql += QString(" AND substr(path, 1, length(?%1)) != ?%1").arg(i + 2);
+    }
+
+    SqlQuery delQuery(_db);
+    delQuery.prepare(sql);
+    delQuery.bindValue(1, _syncGeneration);
+    int pos = 2;
+    foreach (const QString &prefix, prefixesToKeep) {
+        delQuery.bindValue(pos++, prefix);
+    }
+    if (!delQuery.exec()) {
+        return false;
     }
+    qCInfo(lcDb) << "Sync Journal cleanup removed" << delQuery.numRowsAffected() << "entries older than generation" << _syncGeneration;
 
     // Incorporate results back into main DB
     walCheckpoint();
@@ -1388,6 +1612,74 @@ QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
     return ids;
 }
 
+SyncJournalDb::BlockChecksums SyncJournalDb::getBlockChecksums(const QString &file)
+{
+    QMutexLocker locker(&_mutex);
+
+    BlockChecksums res;
+
+    if (checkConnect()) {
+        _getBlockChecksumsQuery->reset_and_clear_bindings();
+        _getBlockChecksumsQuery->bindValue(1, file);
+
+        if (!_getBlockChecksumsQuery->exec()) {
+            return res;
+        }
+
+        if (_getBlockChecksumsQuery->next()) {
+            res._etag = _getBlockChecksumsQuery->baValue(0);
+            res._blockSize = _getBlockChecksumsQuery->int64Value(1);
+            res._checksums = QByteArray::fromHex(_getBlockChecksumsQuery->baValue(2));
+            res._valid = res._blockSize > 0;
+        }
+    }
+    return res;
+}
+
+void SyncJournalDb::setBlockChecksums(const QString &file, const SyncJournalDb::BlockChecksums &i)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    if (i._valid) {
+        _setBlockChecksumsQuery->reset_and_clear_bindings();
+        _setBlockChecksumsQuery->bindValue(1, file);
+        _setBlockChecksumsQuery->bindValue(2, i._etag);
+        _setBlockChecksumsQuery->bindValue(3, qint64(i._blockSize));
+        _setBlockChecksumsQuery->bindValue(4, i._checksums.toHex());
+
+        if (!_setBlockChecksumsQuery->exec()) {
+            return;
+        }
+    } else {
+        _deleteBlockChecksumsQuery->reset_and_clear_bindings();
+        _deleteBlockChecksumsQuery->bindValue(1, file);
+
+        if (!_deleteBlockChecksumsQuery->exec()) {
+            return;
+        }
+    }
+}
+
+// Reads a blacklist entry from a query selecting the columns of _getErrorBlacklistQuery
+static SyncJournalErrorBlacklistRecord errorBlacklistRecordFromQuery(SqlQuery &query)
+{
+    SyncJournalErrorBlacklistRecord entry;
+    entry._lastTryEtag = query.baValue(0);
+    entry._lastTryModtime = query.int64Value(1);
+    entry._retryCount = query.intValue(2);
+    entry._errorString = query.stringValue(3);
+    entry._lastTryTime = query.int64Value(4);
+    entry._ignoreDuration = query.int64Value(5);
+    entry._renameTarget = query.stringValue(6);
+    entry._errorCategory = static_cast<SyncJournalErrorBlacklistRecord::Category>(
+        query.intValue(7));
+    return entry;
+}
+
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString &file)
 {
     QMutexLocker locker(&_mutex);
@@ -1403,15 +1695,7 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString
         _getErrorBlacklistQuery->bindValue(1, file);
         if (_getErrorBlacklistQuery->exec()) {
             if (_getErrorBlacklistQuery->next()) {
-                entry._lastTryEtag = _getErrorBlacklistQuery->baValue(0);
-                entry._lastTryModtime = _getErrorBlacklistQuery->int64Value(1);
-                entry._retryCount = _getErrorBlacklistQuery->intValue(2);
-                entry._errorString = _getErrorBlacklistQuery->stringValue(3);
-                entry._lastTryTime = _getErrorBlacklistQuery->int64Value(4);
-                entry._ignoreDuration = _getErrorBlacklistQuery->int64Value(5);
-                entry._renameTarget = _getErrorBlacklistQuery->stringValue(6);
-                entry._errorCategory = static_cast<SyncJournalErrorBlacklistRecord::Category>(
-                    _getErrorBlacklistQuery->intValue(7));
+                entry = errorBlacklistRecordFromQuery(*_getErrorBlacklistQuery);
                 entry._file = file;
             }
         }
@@ -1420,33 +1704,47 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString
     return entry;
 }
 
-bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
+QHash<QString, SyncJournalErrorBlacklistRecord> SyncJournalDb::errorBlacklistEntries()
 {
     QMutexLocker locker(&_mutex);
+    QHash<QString, SyncJournalErrorBlacklistRecord> entries;
 
     if (!checkConnect()) {
-        return false;
+        return entries;
     }
 
     SqlQuery query(_db);
-    query.prepare("SELECT path FROM blacklist");
-
+    query.prepare("SELECT lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, errorCategory, path "
+                  "FROM blacklist");
     if (!query.exec()) {
-        return false;
+        sqlFail("errorBlacklistEntries", query);
+        return entries;
     }
 
-    QStringList superfluousPaths;
-
     while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
-        }
+        SyncJournalErrorBlacklistRecord entry = errorBlacklistRecordFromQuery(query);
+        entry._file = query.stringValue(8);
+        entries.insert(errorBlacklistKey(entry._file), entry);
+    }
+    return entries;
+}
+
+QString SyncJournalDb::errorBlacklistKey(const QString &file)
+{
+    return Utility::fsCasePreserving() ? file.toLower() : file;
+}
+
+bool SyncJournalDb::deleteErrorBlacklistEntries(const QStringList &files)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return false;
     }
 
     SqlQuery delQuery(_db);
     delQuery.prepare("DELETE FROM blacklist WHERE path = ?");
-    return deleteBatch(delQuery, superfluousPaths, "blacklist");
+    return deleteBatch(delQuery, files, "blacklist");
 }
 
 int SyncJournalDb::errorBlackListEntryCount()
@@ -1799,9 +2097,49 @@ void SyncJournalDb::clearFileTable()
 void SyncJournalDb::commit(const QString &context, bool startTrans)
 {
     QMutexLocker lock(&_mutex);
+    if (startTrans && deferCommit()) {
+        qCDebug(lcDb) << "Transaction commit deferred" << context;
+        return;
+    }
     commitInternal(context, startTrans);
 }
 
+bool SyncJournalDb::deferCommit()
+{
+    if (_groupCommitInterval <= 0 || _transaction != 1) {
+        return false;
+    }
+    if (++_pendingCommits >= maxGroupCommitSize
+        || !_lastCommit.isValid() || _lastCommit.hasExpired(_groupCommitInterval)) {
+        return false;
+    }
+
+    // Make sure the pending changes get committed even if nothing else happens.
+    // The timer can only be used from the thread of this object.
+    if (!_groupCommitTimer.isActive() && QThread::currentThread() == thread()
+        && thread()->eventDispatcher()) {
+        _groupCommitTimer.start(qMax(qint64(0), _groupCommitInterval - _lastCommit.elapsed()));
+    }
+    return true;
+}
+
+void SyncJournalDb::slotGroupCommit()
+{
+    QMutexLocker lock(&_mutex);
+    if (_pendingCommits > 0 && _transaction == 1) {
+        commitInternal("group commit", true);
+    }
+}
+
+void SyncJournalDb::setGroupCommitInterval(int msec)
+{
+    QMutexLocker lock(&_mutex);
+    _groupCommitInterval = msec;
+    if (msec <= 0 && _pendingCommits > 0 && _transaction == 1) {
+        commitInternal("group commit disabled", true);
+    }
+}
+
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
     QMutexLocker lock(&_mutex);
@@ -23,6 +23,8 @@
 #include <qmutex.h>
 #include <QDateTime>
 #include <QHash>
+#include <QElapsedTimer>
+#include <QTimer>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
@@ -56,6 +58,21 @@ public:
     // to verify that the record could be queried successfully check
     // with SyncJournalFileRecord::isValid()
     SyncJournalFileRecord getFileRecord(const QString &filename);
+
+    /** Looks up the records of many files at once.
+     *
+     * Takes the lock once per chunk of a few hundred files instead of once
+     * per file, and lets other threads in between. The result has one entry
+     * per filename, invalid ones for unknown files.
+     */
+    QVector<SyncJournalFileRecord> getFileRecords(const QStringList &filenames);
+
+    /** Returns the record of some file with the given content checksum and size.
+     *
+     * Used to find files that already exist on the server with the same
+     * content. The record is invalid if there is no such file.
+     */
+    SyncJournalFileRecord getFileRecordByChecksum(const QByteArray &checksumHeader, qint64 size);
     bool setFileRecord(const SyncJournalFileRecord &record);
 
     /// Like setFileRecord, but preserves checksums
@@ -111,6 +128,27 @@ public:
         bool _valid;
     };
 
+    /** Checksums of the blocks of a file as it was last uploaded
+     *
+     * Used for delta uploads, see PropagateUploadFileNG. The checksums are the
+     * concatenated raw SHA1 digests of consecutive blocks of _blockSize bytes
+     * (stored hex encoded).
+     * They are only meaningful as long as the server still has the version
+     * with _etag.
+     */
+    struct BlockChecksums
+    {
+        BlockChecksums()
+            : _blockSize(0)
+            , _valid(false)
+        {
+        }
+        QByteArray _etag;
+        quint64 _blockSize;
+        QByteArray _checksums;
+        bool _valid;
+    };
+
     struct PollInfo
     {
         QString _file;
@@ -128,8 +166,20 @@ public:
     // Return the list of transfer ids that were removed.
     QVector<uint> deleteStaleUploadInfos(const QSet<QString> &keep);
 
+    BlockChecksums getBlockChecksums(const QString &file);
+    /// Setting an invalid BlockChecksums removes the entry
+    void setBlockChecksums(const QString &file, const BlockChecksums &i);
+
     SyncJournalErrorBlacklistRecord errorBlacklistEntry(const QString &);
-    bool deleteStaleErrorBlacklistEntries(const QSet<QString> &keep);
+
+    /**
+     * All error blacklist entries at once, keyed by errorBlacklistKey()
+     * of their path.
+     */
+    QHash<QString, SyncJournalErrorBlacklistRecord> errorBlacklistEntries();
+    /// Paths are matched case insensitively on case preserving file systems
+    static QString errorBlacklistKey(const QString &file);
+    bool deleteErrorBlacklistEntries(const QStringList &files);
 
     void avoidRenamesOnNextSync(const QString &path);
     void setPollInfo(const PollInfo &);
@@ -174,15 +224,50 @@ public:
      */
     void forceRemoteDiscoveryNextSync();
 
-    bool postSyncCleanup(const QSet<QString> &filepathsToKeep,
-        const QSet<QString> &prefixesToKeep);
+    /**
+     * Starts a new sync generation.
+     *
+     * Records written with setFileRecord() or confirmed with markFileRecordsSeen()
+     * from now on are stamped with the new generation; postSyncCleanup() removes
+     * the records of older generations.
+     */
+    void startSyncGeneration();
+
+    /**
+     * Marks the records with the given path hashes (see getPHash()) as still
+     * existing in the current generation.
+     *
+     * Runs one UPDATE per few hundred records, all in the current transaction.
+     */
+    bool markFileRecordsSeen(const QVector<qint64> &phashes);
+
+    /**
+     * Deletes all records that were neither written nor marked seen since the
+     * last startSyncGeneration(), except the ones below \a prefixesToKeep.
+     */
+    bool postSyncCleanup(const QSet<QString> &prefixesToKeep);
 
     /* Because sqlite transactions are really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
+     *
+     * With group commits enabled, a commit that starts a new transaction may
+     * be deferred, see setGroupCommitInterval().
      */
     void commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /**
+     * Enables group commits: commit() then only really commits once every
+     * \a msec milliseconds (or after many commit() calls); the commits in
+     * between are merged into the running transaction.
+     *
+     * Users of this object always see their own writes, only other connections
+     * to the database (and a crash) see the state of the last real commit.
+     *
+     * 0 disables group commits and commits what is pending.
+     */
+    void setGroupCommitInterval(int msec);
+
     void close();
 
     /**
@@ -216,6 +301,12 @@ private:
     void commitInternal(const QString &context, bool startTrans = true);
     void startTransaction();
     void commitTransaction();
+    bool deferCommit();
+
+private slots:
+    void slotGroupCommit();
+
+private:
     QStringList tableColumns(const QString &table);
     bool checkConnect();
 
@@ -232,8 +323,18 @@ private:
     QMutex _mutex; // Public functions are protected with the mutex.
     int _transaction;
 
+    // The generation records are stamped with, see startSyncGeneration()
+    qint64 _syncGeneration;
+
+    // Group commits, see setGroupCommitInterval()
+    int _groupCommitInterval;
+    int _pendingCommits;
+    QElapsedTimer _lastCommit;
+    QTimer _groupCommitTimer;
+
     // NOTE! when adding a query, don't forget to reset it in SyncJournalDb::close
     QScopedPointer<SqlQuery> _getFileRecordQuery;
+    QScopedPointer<SqlQuery> _getFileRecordByChecksumQuery;
     QScopedPointer<SqlQuery> _setFileRecordQuery;
     QScopedPointer<SqlQuery> _setFileRecordChecksumQuery;
     QScopedPointer<SqlQuery> _setFileRecordLocalMetadataQuery;
@@ -243,6 +344,10 @@ private:
     QScopedPointer<SqlQuery> _getUploadInfoQuery;
     QScopedPointer<SqlQuery> _setUploadInfoQuery;
     QScopedPointer<SqlQuery> _deleteUploadInfoQuery;
+    QScopedPointer<SqlQuery> _getBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _setBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _deleteBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _deleteBlockChecksumsRecursively;
     QScopedPointer<SqlQuery> _deleteFileRecordPhash;
     QScopedPointer<SqlQuery> _deleteFileRecordRecursively;
     QScopedPointer<SqlQuery> _getErrorBlacklistQuery;
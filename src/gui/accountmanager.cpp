@@ -358,6 +358,8 @@ QString AccountManager::generateFreeAccountId() const
 
 void AccountManager::addAccountState(AccountState *accountState)
 {
+    accountState->account()->setMaxHttpConnections(ConfigFile().maxHttpConnections());
+
     QObject::connect(accountState->account().data(),
         &Account::wantsAccountSaved,
         this, &AccountManager::saveAccount);
@@ -304,7 +304,7 @@ void AccountSettings::slotCustomContextMenuRequested(const QPoint &pos)
 
     if (!folderPaused) {
         ac = menu->addAction(tr("Force sync now"));
-        if (folderMan->currentSyncFolder() == folderMan->folder(alias)) {
+        if (folderMan->currentSyncFolders().contains(folderMan->folder(alias))) {
             ac->setText(tr("Restart sync"));
         }
         ac->setEnabled(folderConnected);
@@ -573,10 +573,14 @@ void AccountSettings::slotForceSyncCurrentFolder()
 {
     FolderMan *folderMan = FolderMan::instance();
     if (auto selectedFolder = folderMan->folder(selectedFolderAlias())) {
-        // Terminate and reschedule any running sync
-        if (Folder *current = folderMan->currentSyncFolder()) {
-            folderMan->terminateSyncProcess();
-            folderMan->scheduleFolder(current);
+        // Restart the folder's sync if it is running. Otherwise, when all sync
+        // slots are taken, terminate and reschedule the latest started sync.
+        auto running = folderMan->currentSyncFolders();
+        if (running.contains(selectedFolder)) {
+            folderMan->terminateSyncProcess(selectedFolder);
+        } else if (!running.isEmpty() && running.size() >= folderMan->maxConcurrentSyncs()) {
+            folderMan->terminateSyncProcess(running.last());
+            folderMan->scheduleFolder(running.last());
         }
 
         // Insert the selected folder at the front of the queue
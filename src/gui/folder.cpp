@@ -26,6 +26,7 @@
 #include "syncresult.h"
 #include "clientproxy.h"
 #include "syncengine.h"
+#include "concurrencycontroller.h"
 #include "syncrunfilelog.h"
 #include "socketapi.h"
 #include "theme.h"
@@ -36,6 +37,7 @@
 
 #include <QTimer>
 #include <QUrl>
+#include <qtconcurrentrun.h>
 #include <QDir>
 #include <QSettings>
 
@@ -46,6 +48,13 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolder, "gui.folder", QtInfoMsg)
 
+// Changes reported by the folder watcher are collected this long and
+// then checked against the journal in one go.
+static const int watchedPathsCoalesceMsec = 200;
+
+// Prioritizing more files than this in the next sync doesn't help anyone
+static const int maxPriorityPathsPerBatch = 100;
+
 Folder::Folder(const FolderDefinition &definition,
     AccountState *accountState,
     QObject *parent)
@@ -108,10 +117,20 @@ Folder::Folder(const FolderDefinition &definition,
     _scheduleSelfTimer.setInterval(SyncEngine::minimumFileAgeForUpload);
     connect(&_scheduleSelfTimer, &QTimer::timeout,
         this, &Folder::slotScheduleThisFolder);
+
+    _watchedPathsTimer.setSingleShot(true);
+    _watchedPathsTimer.setInterval(watchedPathsCoalesceMsec);
+    connect(&_watchedPathsTimer, &QTimer::timeout,
+        this, &Folder::slotFilterWatchedPaths);
+    connect(&_watchedPathsFilter, &QFutureWatcherBase::finished,
+        this, &Folder::slotWatchedPathsFiltered);
 }
 
 Folder::~Folder()
 {
+    // The filter uses the journal
+    _watchedPathsFilter.waitForFinished();
+
     // Reset then engine first as it will abort and try to access members of the Folder
     _engine.reset();
 }
@@ -453,7 +472,6 @@ void Folder::slotWatchedPathChanged(const QString &path)
 // and log. Therefore we check notifications against operations
 // the sync is doing to filter out our own changes.
 #ifdef Q_OS_MAC
-    Q_UNUSED(path)
 // On OSX the folder watcher does not report changes done by our
 // own process. Therefore nothing needs to be done here!
 #else
@@ -464,21 +482,76 @@ void Folder::slotWatchedPathChanged(const QString &path)
     }
 #endif
 
-    // Check that the mtime actually changed.
-    if (path.startsWith(this->path())) {
-        auto relativePath = path.mid(this->path().size());
-        auto record = _journal.getFileRecord(relativePath);
-        if (record.isValid() && !FileSystem::fileChanged(path, record._fileSize, Utility::qDateTimeToTime_t(record._modtime))) {
-            qCInfo(lcFolder) << "Ignoring spurious notification for file" << relativePath;
-            return; // probably a spurious notification
+    // Everything else is checked in batches, see slotFilterWatchedPaths().
+    // The timer is not restarted so a steady stream of changes is
+    // still handled every watchedPathsCoalesceMsec.
+    _pendingWatchedPaths.insert(path);
+    if (!_watchedPathsTimer.isActive()) {
+        _watchedPathsTimer.start();
+    }
+}
+
+// Returns the paths whose size or mtime differs from the journal. Runs in a worker thread.
+static QStringList filterUnchangedPaths(SyncJournalDb *journal, const QString &folderPath, const QStringList &paths)
+{
+    QStringList relativePaths;
+    relativePaths.reserve(paths.size());
+    foreach (const QString &path, paths) {
+        relativePaths.append(path.startsWith(folderPath) ? path.mid(folderPath.size()) : QString());
+    }
+    const QVector<SyncJournalFileRecord> records = journal->getFileRecords(relativePaths);
+
+    QStringList changed;
+    for (int i = 0; i < paths.size(); ++i) {
+        const SyncJournalFileRecord &record = records.at(i);
+        if (record.isValid() && !FileSystem::fileChanged(paths.at(i), record._fileSize, Utility::qDateTimeToTime_t(record._modtime))) {
+            qCDebug(lcFolder) << "Ignoring spurious notification for file" << relativePaths.at(i);
+            continue; // probably a spurious notification
         }
+        changed.append(paths.at(i));
     }
+    return changed;
+}
+
+void Folder::slotFilterWatchedPaths()
+{
+    // The paths that came in meanwhile are picked up when it's done
+    if (_watchedPathsFilter.isRunning() || _pendingWatchedPaths.isEmpty()) {
+        return;
+    }
+    const QStringList paths = _pendingWatchedPaths.toList();
+    _pendingWatchedPaths.clear();
+    _watchedPathsFilter.setFuture(QtConcurrent::run(filterUnchangedPaths, &_journal, path(), paths));
+}
 
-    emit watchedFileChangedExternally(path);
+void Folder::slotWatchedPathsFiltered()
+{
+    const QStringList changed = _watchedPathsFilter.result();
+    if (!changed.isEmpty()) {
+        qCInfo(lcFolder) << changed.size() << "files changed in" << path();
+
+        // The user just changed these files and is likely waiting for them,
+        // unless it was a bulk operation
+        if (changed.size() <= maxPriorityPathsPerBatch) {
+            foreach (const QString &changedPath, changed) {
+                if (changedPath.startsWith(path())) {
+                    _engine->addPriorityPath(changedPath.mid(path().size()));
+                }
+            }
+        }
+
+        foreach (const QString &changedPath, changed) {
+            emit watchedFileChangedExternally(changedPath);
+        }
+
+        // Also schedule this folder for a sync, but only after some delay:
+        // The sync will not upload files that were changed too recently.
+        scheduleThisFolderSoon();
+    }
 
-    // Also schedule this folder for a sync, but only after some delay:
-    // The sync will not upload files that were changed too recently.
-    scheduleThisFolderSoon();
+    if (!_pendingWatchedPaths.isEmpty() && !_watchedPathsTimer.isActive()) {
+        _watchedPathsTimer.start();
+    }
 }
 
 void Folder::saveToSettings() const
@@ -692,6 +765,20 @@ void Folder::setSyncOptions()
         opt._targetChunkUploadDuration = cfgFile.targetChunkUploadDuration();
     }
 
+    QByteArray adaptiveParallelismEnv = qgetenv("OWNCLOUD_ADAPTIVE_PARALLEL");
+    bool adaptiveParallelism = adaptiveParallelismEnv.isEmpty()
+        ? cfgFile.adaptiveParallelism()
+        : adaptiveParallelismEnv != "0";
+    if (adaptiveParallelism) {
+        // Kept across syncs of this folder, so the learned window isn't lost
+        if (!_concurrencyController) {
+            _concurrencyController.reset(new AdaptiveConcurrencyController);
+        }
+        opt._concurrencyController = _concurrencyController;
+    } else {
+        _concurrencyController.clear();
+    }
+
     _engine->setSyncOptions(opt);
 }
 
@@ -714,6 +801,15 @@ void Folder::setDirtyNetworkLimits()
         uploadLimit = 0;
     }
 
+    // The absolute limits are for all folders that are syncing together
+    const int runningSyncs = FolderMan::instance() ? FolderMan::instance()->currentSyncFolders().size() : 1;
+    if (runningSyncs > 1) {
+        if (downloadLimit > 0)
+            downloadLimit = qMax(1, downloadLimit / runningSyncs);
+        if (uploadLimit > 0)
+            uploadLimit = qMax(1, uploadLimit / runningSyncs);
+    }
+
     _engine->setNetworkLimits(uploadLimit, downloadLimit);
 }
 
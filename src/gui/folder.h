@@ -27,6 +27,8 @@
 
 #include <QObject>
 #include <QStringList>
+#include <QSet>
+#include <QFutureWatcher>
 
 class QThread;
 class QSettings;
@@ -36,6 +38,7 @@ namespace OCC {
 class SyncEngine;
 class AccountState;
 class SyncRunFileLog;
+class ConcurrencyController;
 
 /**
  * @brief The FolderDefinition class
@@ -276,6 +279,12 @@ public slots:
        */
     void slotWatchedPathChanged(const QString &path);
 
+    /**
+     * The etag of the folder root was checked, by our own etag job or
+     * by a batched check of the FolderMan. Schedules a sync if it changed.
+     */
+    void etagRetreived(const QString &);
+
 private slots:
     void slotSyncStarted();
     void slotSyncFinished(bool);
@@ -290,7 +299,6 @@ private slots:
     void slotItemCompleted(const SyncFileItemPtr &);
 
     void slotRunEtagJob();
-    void etagRetreived(const QString &);
     void etagRetreivedFromSyncEngine(const QString &);
 
     void slotEmitFinishedDelayed();
@@ -304,6 +312,10 @@ private slots:
      */
     void slotScheduleThisFolder();
 
+    /// Hands the changes collected by slotWatchedPathChanged() to a worker thread
+    void slotFilterWatchedPaths();
+    void slotWatchedPathsFiltered();
+
 private:
     bool setIgnoredFiles();
 
@@ -356,6 +368,15 @@ private:
 
     QTimer _scheduleSelfTimer;
 
+    /// Changes reported by the folder watcher, collected for a short while
+    QSet<QString> _pendingWatchedPaths;
+    QTimer _watchedPathsTimer;
+    /// Drops the spurious changes in a worker thread
+    QFutureWatcher<QStringList> _watchedPathsFilter;
+
+    /// Shared with the sync engine's propagator when adaptive parallelism is enabled
+    QSharedPointer<ConcurrencyController> _concurrencyController;
+
     /**
      * When the same local path is synced to multiple accounts, only one
      * of them can be stored in the settings in a way that's compatible
@@ -23,6 +23,7 @@
 #include "accountmanager.h"
 #include "filesystem.h"
 #include "lockwatcher.h"
+#include "pushnotifications.h"
 #include "common/asserts.h"
 #include <syncengine.h>
 
@@ -42,11 +43,14 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolderMan, "gui.folder.manager", QtInfoMsg)
 
+// How much less often the etags are polled while change notifications work
+static const int pushFallbackPollFactor = 10;
+
 FolderMan *FolderMan::_instance = 0;
 
 FolderMan::FolderMan(QObject *parent)
     : QObject(parent)
-    , _currentSyncFolder(0)
+    , _maxConcurrentSyncs(1)
     , _syncEnabled(true)
     , _lockWatcher(new LockWatcher)
     , _appRestartRequired(false)
@@ -57,6 +61,9 @@ FolderMan::FolderMan(QObject *parent)
     _socketApi.reset(new SocketApi);
 
     ConfigFile cfg;
+    _maxConcurrentSyncs = qMax(1, cfg.maxConcurrentSyncs());
+    qCInfo(lcFolderMan) << "Syncing up to" << _maxConcurrentSyncs << "folders at the same time";
+
     int polltime = cfg.remotePollInterval();
     qCInfo(lcFolderMan) << "setting remote poll timer interval to" << polltime << "msec";
     _etagPollTimer.setInterval(polltime);
@@ -108,6 +115,7 @@ void FolderMan::unloadFolder(Folder *f)
         _folderWatchers.remove(f->alias());
     }
     _folderMap.remove(f->alias());
+    _foldersInEtagBatch.remove(f);
 
     disconnect(f, &Folder::syncStarted,
         this, &FolderMan::slotFolderSyncStarted);
@@ -139,8 +147,9 @@ int FolderMan::unloadAndDeleteAllFolders()
     ASSERT(_folderMap.isEmpty());
 
     _lastSyncFolder = 0;
-    _currentSyncFolder = 0;
+    _currentSyncFolders.clear();
     _scheduledFolders.clear();
+    _prioritizedFolders.clear();
     emit folderListChanged(_folderMap);
     emit scheduleQueueChanged();
 
@@ -491,13 +500,14 @@ void FolderMan::slotFolderCanSyncChanged()
 // this really terminates the current sync process
 // ie. no questions, no prisoners
 // csync still remains in a stable state, regardless of that.
-void FolderMan::terminateSyncProcess()
+void FolderMan::terminateSyncProcess(Folder *folder)
 {
-    Folder *f = _currentSyncFolder;
-    if (f) {
-        // This will, indirectly and eventually, call slotFolderSyncFinished
-        // and thereby clear _currentSyncFolder.
-        f->slotTerminateSync();
+    // This will, indirectly and eventually, call slotFolderSyncFinished
+    // and thereby remove the folder from _currentSyncFolders.
+    foreach (Folder *f, _currentSyncFolders) {
+        if (!folder || f == folder) {
+            f->slotTerminateSync();
+        }
     }
 }
 
@@ -577,6 +587,7 @@ void FolderMan::scheduleFolderNext(Folder *f)
     f->prepareToSync();
     emit folderSyncStateChange(f);
     _scheduledFolders.prepend(f);
+    _prioritizedFolders.insert(f);
     emit scheduleQueueChanged();
 
     startScheduledSyncSoon();
@@ -612,7 +623,7 @@ void FolderMan::slotRunOneEtagJob()
             //qCDebug(lcFolderMan) << "No more remote ETag check jobs to schedule.";
 
             /* now it might be a good time to check for restarting... */
-            if (_currentSyncFolder == NULL && _appRestartRequired) {
+            if (_currentSyncFolders.isEmpty() && _appRestartRequired) {
                 restartApplication();
             }
         } else {
@@ -630,6 +641,8 @@ void FolderMan::slotAccountStateChanged()
     }
     QString accountName = accountState->account()->displayName();
 
+    updatePushNotifications(accountState);
+
     if (accountState->isConnected()) {
         qCInfo(lcFolderMan) << "Account" << accountName << "connected, scheduling its folders";
 
@@ -644,9 +657,10 @@ void FolderMan::slotAccountStateChanged()
         qCInfo(lcFolderMan) << "Account" << accountName << "disconnected or paused, "
                                                            "terminating or descheduling sync folders";
 
-        if (_currentSyncFolder
-            && _currentSyncFolder->accountState() == accountState) {
-            _currentSyncFolder->slotTerminateSync();
+        foreach (Folder *f, _currentSyncFolders) {
+            if (f->accountState() == accountState) {
+                f->slotTerminateSync();
+            }
         }
 
         QMutableListIterator<Folder *> it(_scheduledFolders);
@@ -654,6 +668,7 @@ void FolderMan::slotAccountStateChanged()
             Folder *f = it.next();
             if (f->accountState() == accountState) {
                 it.remove();
+                _prioritizedFolders.remove(f);
             }
         }
         emit scheduleQueueChanged();
@@ -681,7 +696,7 @@ void FolderMan::startScheduledSyncSoon()
     if (_scheduledFolders.empty()) {
         return;
     }
-    if (_currentSyncFolder) {
+    if (_currentSyncFolders.size() >= _maxConcurrentSyncs) {
         return;
     }
 
@@ -719,8 +734,8 @@ void FolderMan::startScheduledSyncSoon()
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if (_currentSyncFolder) {
-        qCInfo(lcFolderMan) << "Currently folder " << _currentSyncFolder->remoteUrl().toString() << " is running, wait for finish!";
+    if (_currentSyncFolders.size() >= _maxConcurrentSyncs) {
+        qCInfo(lcFolderMan) << "Currently" << _currentSyncFolders.size() << "folders are syncing, wait for one to finish!";
         return;
     }
 
@@ -734,15 +749,8 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
-    Folder *folder = 0;
-    while (!_scheduledFolders.isEmpty()) {
-        Folder *g = _scheduledFolders.dequeue();
-        if (g->canSync()) {
-            folder = g;
-            break;
-        }
-    }
+    dropUnsyncableScheduledFolders();
+    Folder *folder = takeNextScheduledFolder();
 
     emit scheduleQueueChanged();
 
@@ -752,21 +760,106 @@ void FolderMan::slotStartScheduledFolderSync()
         // the folder path didn't exist previously.
         registerFolderMonitor(folder);
 
-        _currentSyncFolder = folder;
+        _currentSyncFolders.append(folder);
+        updateSyncBudgets();
         folder->startSync(QStringList());
+
+        // There may be room for another one
+        startScheduledSyncSoon();
     }
 }
 
+void FolderMan::dropUnsyncableScheduledFolders()
+{
+    QMutableListIterator<Folder *> it(_scheduledFolders);
+    while (it.hasNext()) {
+        Folder *f = it.next();
+        if (!f->canSync()) {
+            it.remove();
+            _prioritizedFolders.remove(f);
+        }
+    }
+}
+
+Folder *FolderMan::takeNextScheduledFolder()
+{
+    QHash<AccountState *, int> runningSyncs;
+    foreach (Folder *f, _currentSyncFolders) {
+        runningSyncs[f->accountState()]++;
+    }
+
+    int next = -1;
+    for (int i = 0; i < _scheduledFolders.size(); ++i) {
+        Folder *f = _scheduledFolders.at(i);
+        if (_currentSyncFolders.contains(f)) {
+            // Stays queued until the running sync is done
+            continue;
+        }
+        if (next >= 0) {
+            // Only choose within the highest priority, the queue is sorted by it
+            if (_prioritizedFolders.contains(f) != _prioritizedFolders.contains(_scheduledFolders.at(next))) {
+                break;
+            }
+            if (runningSyncs.value(f->accountState()) >= runningSyncs.value(_scheduledFolders.at(next)->accountState())) {
+                continue;
+            }
+        }
+        next = i;
+        if (runningSyncs.value(f->accountState()) == 0) {
+            break;
+        }
+    }
+    if (next < 0) {
+        return 0;
+    }
+
+    Folder *folder = _scheduledFolders.takeAt(next);
+    _prioritizedFolders.remove(folder);
+    return folder;
+}
+
+void FolderMan::updateSyncBudgets()
+{
+    QHash<AccountState *, int> runningSyncs;
+    foreach (Folder *f, _currentSyncFolders) {
+        runningSyncs[f->accountState()]++;
+    }
+
+    // Also for the accounts whose last sync just finished
+    foreach (Folder *f, _folderMap) {
+        if (f) {
+            f->accountState()->account()->setRunningSyncCount(runningSyncs.value(f->accountState()));
+        }
+    }
+    foreach (Folder *f, _currentSyncFolders) {
+        f->setDirtyNetworkLimits();
+    }
+}
+
+// "/A/B" -> "/A", the root is its own parent
+static QString remoteParentPath(const QString &remotePath)
+{
+    const QString path = QDir::cleanPath(QLatin1Char('/') + remotePath);
+    const int slash = path.lastIndexOf(QLatin1Char('/'));
+    return slash > 0 ? path.left(slash) : QString(QLatin1Char('/'));
+}
+
 void FolderMan::slotEtagPollTimerTimeout()
 {
     ConfigFile cfg;
     int polltime = cfg.remotePollInterval();
 
+    // The folders due for a check, by account and parent folder
+    QHash<AccountState *, QMap<QString, QList<Folder *>>> dueFolders;
+
     foreach (Folder *f, _folderMap) {
         if (!f) {
             continue;
         }
-        if (_currentSyncFolder == f) {
+        // With working change notifications polling is only a fallback
+        PushNotifications *push = _pushNotifications.value(f->accountState());
+        const int folderPolltime = push && push->isConnected() ? polltime * pushFallbackPollFactor : polltime;
+        if (_currentSyncFolders.contains(f)) {
             continue;
         }
         if (_scheduledFolders.contains(f)) {
@@ -775,16 +868,92 @@ void FolderMan::slotEtagPollTimerTimeout()
         if (_disabledFolders.contains(f)) {
             continue;
         }
-        if (f->etagJob() || f->isBusy() || !f->canSync()) {
+        if (f->etagJob() || _foldersInEtagBatch.contains(f) || f->isBusy() || !f->canSync()) {
             continue;
         }
-        if (f->msecSinceLastSync() < polltime) {
+        if (f->msecSinceLastSync() < folderPolltime) {
             continue;
         }
-        QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+        dueFolders[f->accountState()][remoteParentPath(f->remotePath())].append(f);
+    }
+
+    for (auto account = dueFolders.begin(); account != dueFolders.end(); ++account) {
+        QMap<QString, QList<Folder *>> &byParent = account.value();
+
+        // A folder that is the parent of others is in their listing as well
+        foreach (const QString &parent, byParent.keys()) {
+            QList<Folder *> &folders = byParent[parent];
+            for (int i = folders.size() - 1; i >= 0; --i) {
+                const QString path = QDir::cleanPath(QLatin1Char('/') + folders[i]->remotePath());
+                if (path != parent && byParent.contains(path)) {
+                    byParent[path].append(folders.takeAt(i));
+                }
+            }
+        }
+
+        // Old servers don't propagate etag changes to the parent folders,
+        // their folders need the Depth:1 check of RequestEtagJob.
+        const bool canBatch = account.key()->account()->rootEtagChangesNotOnlySubFolderEtags();
+        for (auto group = byParent.constBegin(); group != byParent.constEnd(); ++group) {
+            if (canBatch && group.value().size() > 1) {
+                runBatchedEtagJob(account.key(), group.key(), group.value());
+                continue;
+            }
+            foreach (Folder *f, group.value()) {
+                QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+            }
+        }
     }
 }
 
+void FolderMan::runBatchedEtagJob(AccountState *accountState, const QString &parentPath, const QList<Folder *> &folders)
+{
+    AccountPtr account = accountState->account();
+    qCInfo(lcFolderMan) << "Checking the etags of" << folders.size() << "folders below" << parentPath
+                        << "of" << account->displayName();
+
+    // The hrefs of the folder roots in the listing
+    QHash<QString, QPointer<Folder>> folderByHref;
+    foreach (Folder *f, folders) {
+        QString href = Utility::concatUrlPath(account->davUrl(), f->remotePath()).path(QUrl::FullyDecoded);
+        if (href.endsWith(QLatin1Char('/'))) {
+            href.chop(1);
+        }
+        folderByHref.insert(href, f);
+        _foldersInEtagBatch.insert(f);
+    }
+
+    auto job = new LsColJob(account, parentPath, this);
+    job->setProperties(QList<QByteArray>() << "getetag");
+    job->setTimeout(60 * 1000);
+
+    auto etags = QSharedPointer<QHash<QString, QString>>::create();
+    connect(job, &LsColJob::directoryListingIterated, this,
+        [etags](const QString &href, const QMap<QString, QString> &properties) {
+            etags->insert(href, properties.value(QLatin1String("getetag")));
+        });
+
+    auto done = [this, folderByHref, etags](bool success) {
+        for (auto it = folderByHref.constBegin(); it != folderByHref.constEnd(); ++it) {
+            Folder *f = it.value();
+            if (!f) {
+                continue;
+            }
+            _foldersInEtagBatch.remove(f);
+            const QString etag = etags->value(it.key());
+            if (success && !etag.isEmpty()) {
+                f->etagRetreived(etag);
+            } else {
+                // Not in the listing, let the folder look for itself
+                QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+            }
+        }
+    };
+    connect(job, &LsColJob::finishedWithoutError, this, [done] { done(true); });
+    connect(job, &LsColJob::finishedWithError, this, [done] { done(false); });
+    job->start();
+}
+
 void FolderMan::slotRemoveFoldersForAccount(AccountState *accountState)
 {
     QVarLengthArray<Folder *, 16> foldersToRemove;
@@ -800,6 +969,62 @@ void FolderMan::slotRemoveFoldersForAccount(AccountState *accountState)
     foreach (const auto &f, foldersToRemove) {
         removeFolder(f);
     }
+
+    delete _pushNotifications.take(accountState);
+}
+
+// "a/b" -> "/a/b/", so that prefixes only match whole path segments
+static QString remoteDirectoryPath(const QString &path)
+{
+    QString result = QDir::cleanPath(QLatin1Char('/') + path);
+    if (!result.endsWith(QLatin1Char('/'))) {
+        result += QLatin1Char('/');
+    }
+    return result;
+}
+
+void FolderMan::updatePushNotifications(AccountState *accountState)
+{
+    const QString path = accountState->isConnected()
+        ? accountState->account()->capabilities().pushNotificationsPath()
+        : QString();
+
+    if (path.isEmpty()) {
+        delete _pushNotifications.take(accountState);
+        return;
+    }
+    if (_pushNotifications.contains(accountState)) {
+        return;
+    }
+
+    auto push = new PushNotifications(accountState->account(), path, this);
+    connect(push, &PushNotifications::filesChanged, this, &FolderMan::slotPushNotificationReceived);
+    _pushNotifications.insert(accountState, push);
+    push->start();
+}
+
+void FolderMan::slotPushNotificationReceived(const QStringList &remotePaths)
+{
+    AccountState *accountState = _pushNotifications.key(qobject_cast<PushNotifications *>(sender()));
+    if (!accountState) {
+        return;
+    }
+
+    foreach (Folder *f, _folderMap) {
+        if (f->accountState() != accountState) {
+            continue;
+        }
+        // A change inside the folder or in one of its parents
+        const QString folderPath = remoteDirectoryPath(f->remotePath());
+        foreach (const QString &remotePath, remotePaths) {
+            const QString changedPath = remoteDirectoryPath(remotePath);
+            if (changedPath.startsWith(folderPath) || folderPath.startsWith(changedPath)) {
+                qCInfo(lcFolderMan) << "Server reported a change in" << remotePath << "for folder" << f->alias();
+                scheduleFolder(f);
+                break;
+            }
+        }
+    }
 }
 
 void FolderMan::slotForwardFolderSyncStateChange()
@@ -879,10 +1104,12 @@ void FolderMan::slotScheduleFolderByTime()
 
 void FolderMan::slotFolderSyncStarted()
 {
+    Folder *f = qobject_cast<Folder *>(sender());
+    ASSERT(f);
     qCInfo(lcFolderMan, ">========== Sync started for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()));
 }
 
 /*
@@ -893,13 +1120,16 @@ void FolderMan::slotFolderSyncStarted()
   */
 void FolderMan::slotFolderSyncFinished(const SyncResult &)
 {
+    Folder *f = qobject_cast<Folder *>(sender());
+    ASSERT(f);
     qCInfo(lcFolderMan, "<========== Sync finished for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()));
 
-    _lastSyncFolder = _currentSyncFolder;
-    _currentSyncFolder = 0;
+    _lastSyncFolder = f;
+    _currentSyncFolders.removeAll(f);
+    updateSyncBudgets();
 
     startScheduledSyncSoon();
 }
@@ -1013,12 +1243,13 @@ void FolderMan::removeFolder(Folder *f)
 
     qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-    const bool currentlyRunning = (_currentSyncFolder == f);
+    const bool currentlyRunning = _currentSyncFolders.contains(f);
     if (currentlyRunning) {
         // abort the sync now
-        terminateSyncProcess();
+        terminateSyncProcess(f);
     }
 
+    _prioritizedFolders.remove(f);
     if (_scheduledFolders.removeAll(f) > 0) {
         emit scheduleQueueChanged();
     }
@@ -1449,9 +1680,9 @@ QQueue<Folder *> FolderMan::scheduleQueue() const
     return _scheduledFolders;
 }
 
-Folder *FolderMan::currentSyncFolder() const
+QList<Folder *> FolderMan::currentSyncFolders() const
 {
-    return _currentSyncFolder;
+    return _currentSyncFolders;
 }
 
 void FolderMan::restartApplication()
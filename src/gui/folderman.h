@@ -32,6 +32,7 @@ class Application;
 class SyncResult;
 class SocketApi;
 class LockWatcher;
+class PushNotifications;
 
 /**
  * @brief The FolderMan class
@@ -50,6 +51,9 @@ class LockWatcher;
  * - The folder etag on the server has changed
  *   (_etagPollTimer)
  *
+ * - The server announces a change in the folder
+ *   (_pushNotifications and slotPushNotificationReceived())
+ *
  * - The locks of a monitored file are released
  *   (_lockWatcher and slotWatchedFileUnlocked())
  *
@@ -153,13 +157,18 @@ public:
 
     /**
      * Access to the current queue of scheduled folders.
+     *
+     * Folders that were scheduled with scheduleFolderNext() come first.
      */
     QQueue<Folder *> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folders.
      */
-    Folder *currentSyncFolder() const;
+    QList<Folder *> currentSyncFolders() const;
+
+    /** The number of folders that may sync at the same time */
+    int maxConcurrentSyncs() const { return _maxConcurrentSyncs; }
 
     /** Removes all folders */
     int unloadAndDeleteAllFolders();
@@ -183,11 +192,11 @@ public:
     void setDirtyNetworkLimits();
 
     /**
-     * Terminates the current folder sync.
+     * Terminates the sync of the folder, or all current folder syncs.
      *
      * It does not switch the folder to paused state.
      */
-    void terminateSyncProcess();
+    void terminateSyncProcess(Folder *folder = 0);
 
 signals:
     /**
@@ -252,6 +261,9 @@ private slots:
 
     void slotServerVersionChanged(Account *account);
 
+    /// Schedules the folders of the account that contain a changed path
+    void slotPushNotificationReceived(const QStringList &remotePaths);
+
     /**
      * A file whose locks were being monitored has become unlocked.
      *
@@ -291,10 +303,35 @@ private:
 
     void setupFoldersHelper(QSettings &settings, AccountStatePtr account, bool backwardsCompatible);
 
+    /** Removes the folders that can't sync currently from the schedule queue */
+    void dropUnsyncableScheduledFolders();
+
+    /** Removes the next folder to sync from the schedule queue, or returns null
+     *
+     * That is the first folder of the highest priority that is not syncing
+     * already. Among those, folders of accounts with fewer running syncs
+     * are preferred so one account can't take all the sync slots.
+     */
+    Folder *takeNextScheduledFolder();
+
+    /** Shares the connections and the bandwidth among the running syncs */
+    void updateSyncBudgets();
+
+    /** Checks the etags of several folders of one account with a single
+     *  Depth:1 PROPFIND on their common parent folder.
+     */
+    void runBatchedEtagJob(AccountState *accountState, const QString &parentPath, const QList<Folder *> &folders);
+
+    /** Listens for change notifications while the account is connected,
+     *  if the server supports them.
+     */
+    void updatePushNotifications(AccountState *accountState);
+
     QSet<Folder *> _disabledFolders;
     Folder::Map _folderMap;
     QString _folderConfigPath;
-    Folder *_currentSyncFolder;
+    QList<Folder *> _currentSyncFolders;
+    int _maxConcurrentSyncs;
     QPointer<Folder> _lastSyncFolder;
     bool _syncEnabled;
 
@@ -305,6 +342,12 @@ private:
     QTimer _etagPollTimer;
     /// The currently running etag query
     QPointer<RequestEtagJob> _currentEtagJob;
+    /// Folders whose etag is being checked by a batched job
+    QSet<Folder *> _foldersInEtagBatch;
+
+    /// Change notification channels of the connected accounts. While one
+    /// is connected the etags of its folders are polled much less often.
+    QHash<AccountState *, PushNotifications *> _pushNotifications;
 
     /// Watches files that couldn't be synced due to locks
     QScopedPointer<LockWatcher> _lockWatcher;
@@ -312,8 +355,10 @@ private:
     /// Occasionally schedules folders
     QTimer _timeScheduler;
 
-    /// Scheduled folders that should be synced as soon as possible
+    /// Scheduled folders that should be synced as soon as possible, by priority
     QQueue<Folder *> _scheduledFolders;
+    /// The folders at the front of _scheduledFolders, see scheduleFolderNext()
+    QSet<Folder *> _prioritizedFolders;
 
     /// Picks the next scheduled folder and starts the sync
     QTimer _startScheduledSyncTimer;
@@ -1047,8 +1047,8 @@ void FolderStatusModel::slotFolderSyncStateChange(Folder *f)
     } else if (state == SyncResult::NotYetStarted) {
         FolderMan *folderMan = FolderMan::instance();
         int pos = folderMan->scheduleQueue().indexOf(f);
-        if (folderMan->currentSyncFolder()
-            && folderMan->currentSyncFolder() != f) {
+        auto running = folderMan->currentSyncFolders();
+        if (running.size() >= folderMan->maxConcurrentSyncs() && !running.contains(f)) {
             pos += 1;
         }
         QString message;
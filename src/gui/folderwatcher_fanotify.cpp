@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "folderwatcher_fanotify.h"
+#include "folderwatcher_linux.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <QDir>
+#include <QFileInfo>
+#include <QVarLengthArray>
+
+namespace OCC {
+
+// Events are collected this long before they are handed to the folders
+static const int deliverDelayMsec = 100;
+
+#ifdef FAN_REPORT_DFID_NAME
+static const uint64_t watchMask = FAN_CREATE | FAN_DELETE | FAN_MOVE | FAN_ATTRIB | FAN_CLOSE_WRITE | FAN_ONDIR;
+#endif
+
+FanotifyWatcher *FanotifyWatcher::instance()
+{
+#ifdef FAN_REPORT_DFID_NAME
+    static FanotifyWatcher *watcher = 0;
+    static bool initialized = false;
+    if (!initialized) {
+        initialized = true;
+        if (qgetenv("OWNCLOUD_FANOTIFY") == "1") {
+            watcher = new FanotifyWatcher;
+            if (watcher->_fd == -1) {
+                delete watcher;
+                watcher = 0;
+            }
+        }
+    }
+    return watcher;
+#else
+    return 0;
+#endif
+}
+
+FanotifyPathMapper::FanotifyPathMapper()
+    : _overflowed(false)
+{
+}
+
+void FanotifyPathMapper::addRoot(const QString &canonicalRoot, const QString &alias)
+{
+    _rootAliases.insert(canonicalRoot, alias);
+}
+
+void FanotifyPathMapper::removeRoot(const QString &canonicalRoot)
+{
+    _rootAliases.remove(canonicalRoot);
+}
+
+QString FanotifyPathMapper::rootOf(const QString &path) const
+{
+    QString p = path;
+    while (!p.isEmpty()) {
+        if (_rootAliases.contains(p)) {
+            return p;
+        }
+        p = p.left(qMax(0, p.lastIndexOf(QLatin1Char('/'))));
+    }
+    return QString();
+}
+
+bool FanotifyPathMapper::pathChanged(const QString &path)
+{
+    // Events for the whole filesystem come in, only keep the ones below
+    // one of the watched folders.
+    if (rootOf(path).isNull()) {
+        return false;
+    }
+    _pendingPaths.insert(path);
+    return true;
+}
+
+QHash<QString, QStringList> FanotifyPathMapper::takeChanges()
+{
+    QHash<QString, QStringList> changes;
+
+    if (_overflowed) {
+        // Events were lost: let every folder look at everything
+        qCWarning(lcFolderWatcher) << "fanotify event queue overflowed";
+        for (auto it = _rootAliases.constBegin(); it != _rootAliases.constEnd(); ++it) {
+            changes[it.key()].append(it.value());
+        }
+        _overflowed = false;
+    }
+
+    foreach (const QString &path, _pendingPaths) {
+        // The root may have been removed in the meantime
+        const QString root = rootOf(path);
+        if (!root.isNull()) {
+            // Report it the way the folder spells its path
+            changes[root].append(_rootAliases.value(root) + path.mid(root.size()));
+        }
+    }
+    _pendingPaths.clear();
+    return changes;
+}
+
+FanotifyWatcher::FanotifyWatcher()
+    : _fd(-1)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    _fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+    if (_fd == -1) {
+        qCWarning(lcFolderWatcher) << "fanotify_init() failed, using inotify:" << strerror(errno);
+        return;
+    }
+    _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
+    connect(_socket.data(), &QSocketNotifier::activated, this, &FanotifyWatcher::slotReceivedNotification);
+
+    _deliverTimer.setSingleShot(true);
+    _deliverTimer.setInterval(deliverDelayMsec);
+    connect(&_deliverTimer, &QTimer::timeout, this, &FanotifyWatcher::slotDeliverChanges);
+#endif
+}
+
+FanotifyWatcher::~FanotifyWatcher()
+{
+    foreach (int mountFd, _mountFds) {
+        close(mountFd);
+    }
+    if (_fd != -1) {
+        close(_fd);
+    }
+}
+
+static quint64 fsidKey(const int val[2])
+{
+    return quint64(quint32(val[0])) | (quint64(quint32(val[1])) << 32);
+}
+
+bool FanotifyWatcher::addFolder(FolderWatcherPrivate *watcher, const QString &root)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    // The events carry paths without symlinks
+    const QString canonicalRoot = QFileInfo(root).canonicalFilePath();
+    if (canonicalRoot.isEmpty()) {
+        return false;
+    }
+    const QByteArray rootPath = canonicalRoot.toLocal8Bit();
+    struct statfs stats;
+    if (statfs(rootPath.constData(), &stats) != 0) {
+        qCWarning(lcFolderWatcher) << "statfs() failed for" << root << strerror(errno);
+        return false;
+    }
+    const quint64 fsid = fsidKey(stats.f_fsid.__val);
+
+    if (!_mountFds.contains(fsid)) {
+        int mountFd = open(rootPath.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (mountFd == -1) {
+            return false;
+        }
+        if (fanotify_mark(_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, watchMask, AT_FDCWD, rootPath.constData()) != 0) {
+            qCWarning(lcFolderWatcher) << "fanotify_mark() failed for" << root << ", using inotify:" << strerror(errno);
+            close(mountFd);
+            return false;
+        }
+        _mountFds.insert(fsid, mountFd);
+    }
+
+    qCInfo(lcFolderWatcher) << "Watching" << root << "with fanotify";
+    _roots.insert(canonicalRoot, watcher);
+    _rootFsids.insert(canonicalRoot, fsid);
+    _paths.addRoot(canonicalRoot, QDir(root).absolutePath());
+    return true;
+#else
+    Q_UNUSED(watcher)
+    Q_UNUSED(root)
+    return false;
+#endif
+}
+
+void FanotifyWatcher::removeFolder(FolderWatcherPrivate *watcher)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    foreach (const QString &root, _roots.keys(watcher)) {
+        _roots.remove(root);
+        _paths.removeRoot(root);
+        const quint64 fsid = _rootFsids.take(root);
+        if (_rootFsids.key(fsid).isNull()) {
+            // Nobody is interested in this filesystem anymore
+            fanotify_mark(_fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, watchMask, AT_FDCWD, root.toLocal8Bit().constData());
+            close(_mountFds.take(fsid));
+        }
+    }
+#else
+    Q_UNUSED(watcher)
+#endif
+}
+
+QString FanotifyWatcher::resolveDirectory(quint64 fsid, void *handle)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    const int mountFd = _mountFds.value(fsid, -1);
+    if (mountFd == -1) {
+        return QString();
+    }
+    const int fd = open_by_handle_at(mountFd, static_cast<struct file_handle *>(handle), O_PATH);
+    if (fd == -1) {
+        // The directory is gone already
+        return QString();
+    }
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    char target[PATH_MAX];
+    const ssize_t len = readlink(link, target, sizeof(target));
+    close(fd);
+    if (len <= 0) {
+        return QString();
+    }
+    return QString::fromLocal8Bit(target, len);
+#else
+    Q_UNUSED(fsid)
+    Q_UNUSED(handle)
+    return QString();
+#endif
+}
+
+void FanotifyWatcher::slotReceivedNotification(int fd)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    QVarLengthArray<char, 65536> buffer(65536);
+    while (true) {
+        const ssize_t len = read(fd, buffer.data(), buffer.size());
+        if (len <= 0) {
+            break;
+        }
+
+        auto metadata = reinterpret_cast<struct fanotify_event_metadata *>(buffer.data());
+        ssize_t remaining = len;
+        for (; FAN_EVENT_OK(metadata, remaining); metadata = FAN_EVENT_NEXT(metadata, remaining)) {
+            if (metadata->mask & FAN_Q_OVERFLOW) {
+                _paths.setOverflowed();
+                continue;
+            }
+
+            // With FAN_REPORT_DFID_NAME the parent directory and the name
+            // follow the metadata as an info record.
+            auto fid = reinterpret_cast<struct fanotify_event_info_fid *>(
+                reinterpret_cast<char *>(metadata) + metadata->metadata_len);
+            if (metadata->event_len <= metadata->metadata_len
+                || (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME
+                       && fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID)) {
+                continue;
+            }
+
+            QString path = resolveDirectory(fsidKey(fid->fsid.val), fid->handle);
+            if (path.isEmpty()) {
+                continue;
+            }
+            if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                auto handle = reinterpret_cast<struct file_handle *>(fid->handle);
+                const char *name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+                if (strcmp(name, ".") != 0) {
+                    path += QLatin1Char('/') + QString::fromLocal8Bit(name);
+                }
+            }
+            _paths.pathChanged(path);
+        }
+    }
+
+    if (_paths.hasPendingChanges() && !_deliverTimer.isActive()) {
+        _deliverTimer.start();
+    }
+#else
+    Q_UNUSED(fd)
+#endif
+}
+
+void FanotifyWatcher::slotDeliverChanges()
+{
+    const QHash<QString, QStringList> changes = _paths.takeChanges();
+    for (auto it = changes.constBegin(); it != changes.constEnd(); ++it) {
+        if (FolderWatcherPrivate *watcher = _roots.value(it.key())) {
+            watcher->fanotifyChangesDetected(it.value());
+        }
+    }
+}
+}
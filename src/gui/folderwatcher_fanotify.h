@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef MIRALL_FOLDERWATCHER_FANOTIFY_H
+#define MIRALL_FOLDERWATCHER_FANOTIFY_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QSocketNotifier>
+#include <QTimer>
+
+namespace OCC {
+
+class FolderWatcherPrivate;
+
+/**
+ * @brief Maps the paths of filesystem wide events to the watched folders
+ *
+ * This is the part of FanotifyWatcher that needs no fanotify descriptor.
+ * The folders are known by their canonical path, which is what the events
+ * report, and by their alias, the path as the folder spells it.
+ *
+ * @ingroup gui
+ */
+class FanotifyPathMapper
+{
+public:
+    FanotifyPathMapper();
+
+    void addRoot(const QString &canonicalRoot, const QString &alias);
+    void removeRoot(const QString &canonicalRoot);
+
+    /// Remembers the path if it is below one of the roots, returns whether it was
+    bool pathChanged(const QString &path);
+
+    /// Events were lost, every root will be reported as changed
+    void setOverflowed() { _overflowed = true; }
+
+    bool hasPendingChanges() const { return _overflowed || !_pendingPaths.isEmpty(); }
+
+    /// The changes since the last call: canonical root -> changed paths, as the folder spells them
+    QHash<QString, QStringList> takeChanges();
+
+private:
+    /// The canonical root path is below, or a null string
+    QString rootOf(const QString &path) const;
+
+    QHash<QString, QString> _rootAliases; // canonical root -> path as given by the folder
+    QSet<QString> _pendingPaths;
+    bool _overflowed;
+};
+
+/**
+ * @brief Watches whole filesystems with a single fanotify mark each
+ *
+ * Needs Linux 5.9 for FAN_REPORT_DFID_NAME and CAP_SYS_ADMIN for the
+ * filesystem marks. Unlike inotify no watch per directory is needed, so
+ * the cost of watching does not depend on the size of the tree.
+ *
+ * There is one instance per process, shared by all folder watchers. The
+ * changed paths are mapped back to the watched folders by path prefix and
+ * are delivered in coalesced batches.
+ *
+ * Opt-in with OWNCLOUD_FANOTIFY=1. If it is not available the inotify
+ * watcher is used.
+ *
+ * @ingroup gui
+ */
+class FanotifyWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    /// Returns 0 if fanotify is not enabled or can't be used
+    static FanotifyWatcher *instance();
+
+    /// Starts watching root for the watcher, returns false if not possible
+    bool addFolder(FolderWatcherPrivate *watcher, const QString &root);
+    void removeFolder(FolderWatcherPrivate *watcher);
+
+private slots:
+    void slotReceivedNotification(int fd);
+    void slotDeliverChanges();
+
+private:
+    FanotifyWatcher();
+    ~FanotifyWatcher();
+
+    QString resolveDirectory(quint64 fsid, void *handle);
+
+    int _fd;
+    QScopedPointer<QSocketNotifier> _socket;
+
+    // fsid -> fd of a directory on that filesystem, for open_by_handle_at
+    QHash<quint64, int> _mountFds;
+
+    // The keys are the canonical paths of the watched folders
+    QHash<QString, FolderWatcherPrivate *> _roots;
+    QHash<QString, quint64> _rootFsids;
+
+    FanotifyPathMapper _paths;
+    QTimer _deliverTimer;
+};
+}
+
+#endif
@@ -15,22 +15,66 @@
 #include "config.h"
 
 #include <sys/inotify.h>
+#include <unistd.h>
 
 #include "folder.h"
 #include "folderwatcher_linux.h"
+#include "folderwatcher_fanotify.h"
 
 #include <cerrno>
 #include <QStringList>
 #include <QObject>
 #include <QVarLengthArray>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <qtconcurrentrun.h>
 
 namespace OCC {
 
+// Number of folders that get a watch per pass through the event loop
+static const int registerChunkSize = 1000;
+
+// How often the subtrees without inotify watches are scanned for changes
+static const int unwatchedScanIntervalMsec = 30 * 1000;
+
+// Changes to our own files don't need to be reported
+static bool isSyncMetadataFile(const QByteArray &fileName)
+{
+    return fileName.startsWith("._sync_")
+        || fileName.startsWith(".csync_journal.db")
+        || fileName.startsWith(".owncloudsync.log")
+        || fileName.startsWith(".sync_");
+}
+
+FolderWatcherPrivate::FolderWatcherPrivate()
+    : QObject()
+    , _parent(0)
+    , _useFanotify(false)
+    , _fd(-1)
+    , _pendingIndex(0)
+    , _watchesExhausted(false)
+    , _hasUnwatchedSnapshot(false)
+{
+}
+
 FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path)
     : QObject()
     , _parent(p)
     , _folder(path)
+    , _useFanotify(false)
+    , _fd(-1)
+    , _pendingIndex(0)
+    , _watchesExhausted(false)
+    , _hasUnwatchedSnapshot(false)
 {
+    if (FanotifyWatcher *fanotify = FanotifyWatcher::instance()) {
+        _useFanotify = fanotify->addFolder(this, path);
+        if (_useFanotify) {
+            return;
+        }
+    }
+
     _fd = inotify_init();
     if (_fd != -1) {
         _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
@@ -39,11 +83,26 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path
         qCWarning(lcFolderWatcher) << "notify_init() failed: " << strerror(errno);
     }
 
-    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
+    _registerTimer.setSingleShot(true);
+    _registerTimer.setInterval(0);
+    connect(&_registerTimer, &QTimer::timeout, this, &FolderWatcherPrivate::slotRegisterPendingFolders);
+
+    _unwatchedScanTimer.setInterval(unwatchedScanIntervalMsec);
+    connect(&_unwatchedScanTimer, &QTimer::timeout, this, &FolderWatcherPrivate::slotScanUnwatchedFolders);
+    connect(&_unwatchedScan, &QFutureWatcherBase::finished, this, &FolderWatcherPrivate::slotUnwatchedFoldersScanned);
+
+    slotAddFolderRecursive(path);
 }
 
 FolderWatcherPrivate::~FolderWatcherPrivate()
 {
+    if (_useFanotify) {
+        FanotifyWatcher::instance()->removeFolder(this);
+    }
+    if (_fd != -1) {
+        _socket.reset();
+        close(_fd);
+    }
 }
 
 // attention: result list passed by reference!
@@ -71,50 +130,197 @@ bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullLi
     return ok;
 }
 
-void FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
+FolderWatcherPrivate::Snapshot FolderWatcherPrivate::snapshotBelow(const QStringList &roots)
+{
+    Snapshot snapshot;
+    foreach (const QString &root, roots) {
+        QDirIterator it(root, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+            QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            const QFileInfo info = it.fileInfo();
+            snapshot.insert(info.absoluteFilePath(),
+                qMakePair(info.lastModified().toMSecsSinceEpoch(), info.isDir() ? qint64(0) : info.size()));
+        }
+    }
+    return snapshot;
+}
+
+QStringList FolderWatcherPrivate::changedPaths(const Snapshot &before, const Snapshot &after)
 {
-    if (!path.isEmpty()) {
-        int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
-            IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
-        if (wd > -1) {
-            _watches.insert(wd, path);
+    QStringList changed;
+    for (auto it = after.constBegin(); it != after.constEnd(); ++it) {
+        auto old = before.constFind(it.key());
+        if (old == before.constEnd() || old.value() != it.value()) {
+            changed.append(it.key());
+        }
+    }
+    for (auto it = before.constBegin(); it != before.constEnd(); ++it) {
+        if (!after.contains(it.key())) {
+            changed.append(it.key());
+        }
+    }
+    return changed;
+}
+
+bool FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
+{
+    if (path.isEmpty() || _watchedPaths.contains(path)) {
+        return true;
+    }
+    int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
+        IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
+    if (wd > -1) {
+        // A path may get the wd of a folder that was removed before
+        _watchedPaths.remove(_watches.value(wd));
+        _watches.insert(wd, path);
+        _watchedPaths.insert(path, wd);
+        return true;
+    }
+    if (errno == ENOSPC) {
+        if (!_watchesExhausted) {
+            qCWarning(lcFolderWatcher) << "Ran out of inotify watches at" << path
+                                       << "- raise fs.inotify.max_user_watches. The folders that could"
+                                       << "not be watched are scanned for changes every"
+                                       << unwatchedScanIntervalMsec / 1000 << "seconds";
+            _watchesExhausted = true;
         }
+        return false;
     }
+    qCDebug(lcFolderWatcher) << "Could not watch" << path << strerror(errno);
+    return true;
+}
+
+bool FolderWatcherPrivate::isBelowUnwatchedFolder(const QString &path) const
+{
+    if (_unwatchedFolders.isEmpty()) {
+        return false;
+    }
+    QString p = path;
+    while (!p.isEmpty()) {
+        if (_unwatchedFolders.contains(p)) {
+            return true;
+        }
+        p = p.left(qMax(0, p.lastIndexOf(QLatin1Char('/'))));
+    }
+    return false;
 }
 
 void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
 {
-    int subdirs = 0;
     qCDebug(lcFolderWatcher) << "(+) Watcher:" << path;
+    if (_fd == -1) {
+        return;
+    }
 
-    QDir inPath(path);
-    inotifyRegisterPath(inPath.absolutePath());
+    // The folder itself is watched right away, its subfolders are
+    // collected in a background thread.
+    const QString absolutePath = QDir(path).absolutePath();
+    if (isBelowUnwatchedFolder(absolutePath)) {
+        return;
+    }
+    if (!inotifyRegisterPath(absolutePath)) {
+        _unwatchedFolders.insert(absolutePath);
+        _unwatchedScanTimer.start();
+        return;
+    }
 
-    const QStringList watchedFolders = _watches.values();
+    auto watcher = new QFutureWatcher<QStringList>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, &FolderWatcherPrivate::slotFoldersFound);
+    watcher->setFuture(QtConcurrent::run([absolutePath]() {
+        QStringList folders;
+        if (!findFoldersBelow(QDir(absolutePath), folders)) {
+            qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
+        }
+        return folders;
+    }));
+}
+
+void FolderWatcherPrivate::slotFoldersFound()
+{
+    auto watcher = static_cast<QFutureWatcher<QStringList> *>(sender());
+    watcher->deleteLater();
+    const QStringList folders = watcher->result();
+    qCDebug(lcFolderWatcher) << "    `-> and" << folders.size() << "subdirectories";
 
-    QStringList allSubfolders;
-    if (!findFoldersBelow(QDir(path), allSubfolders)) {
-        qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
+    _pendingFolders.append(folders);
+    slotRegisterPendingFolders();
+}
+
+void FolderWatcherPrivate::slotRegisterPendingFolders()
+{
+    const int end = qMin(_pendingFolders.size(), _pendingIndex + registerChunkSize);
+    for (; _pendingIndex < end; ++_pendingIndex) {
+        const QString &folder = _pendingFolders.at(_pendingIndex);
+
+        // The folders come in depth-first order: once a folder is skipped,
+        // its children follow immediately and are skipped too.
+        if (!_skipPrefix.isEmpty() && folder.startsWith(_skipPrefix)) {
+            continue;
+        }
+        _skipPrefix.clear();
+
+        if (_parent && _parent->pathIsIgnored(folder)) {
+            qCDebug(lcFolderWatcher) << "* Not adding" << folder;
+            _skipPrefix = folder + QLatin1Char('/');
+            continue;
+        }
+        if (!inotifyRegisterPath(folder)) {
+            _unwatchedFolders.insert(folder);
+            _skipPrefix = folder + QLatin1Char('/');
+        }
     }
-    QStringListIterator subfoldersIt(allSubfolders);
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        QDir folder(subfolder);
-        if (folder.exists() && !watchedFolders.contains(folder.absolutePath())) {
-            subdirs++;
-            if (_parent->pathIsIgnored(subfolder)) {
-                qCDebug(lcFolderWatcher) << "* Not adding" << folder.path();
-                continue;
-            }
-            inotifyRegisterPath(folder.absolutePath());
+
+    if (_pendingIndex < _pendingFolders.size()) {
+        _registerTimer.start();
+        return;
+    }
+
+    _pendingFolders.clear();
+    _pendingIndex = 0;
+    _skipPrefix.clear();
+    if (!_unwatchedFolders.isEmpty() && !_unwatchedScanTimer.isActive()) {
+        qCInfo(lcFolderWatcher) << _unwatchedFolders.size() << "folders could not be watched and are scanned periodically";
+        _unwatchedScanTimer.start();
+        slotScanUnwatchedFolders();
+    }
+}
+
+void FolderWatcherPrivate::slotScanUnwatchedFolders()
+{
+    if (_unwatchedScan.isRunning()) {
+        return;
+    }
+    if (_unwatchedFolders.isEmpty()) {
+        _unwatchedScanTimer.stop();
+        _unwatchedSnapshot.clear();
+        _hasUnwatchedSnapshot = false;
+        return;
+    }
+    _unwatchedScan.setFuture(QtConcurrent::run(&FolderWatcherPrivate::snapshotBelow, _unwatchedFolders.toList()));
+}
+
+void FolderWatcherPrivate::slotUnwatchedFoldersScanned()
+{
+    Snapshot snapshot = _unwatchedScan.result();
+
+    // Forget about the folders that were removed from the watcher meanwhile
+    for (auto it = snapshot.begin(); it != snapshot.end();) {
+        if (isBelowUnwatchedFolder(it.key())) {
+            ++it;
         } else {
-            qCDebug(lcFolderWatcher) << "    `-> discarded:" << folder.path();
+            it = snapshot.erase(it);
         }
     }
 
-    if (subdirs > 0) {
-        qCDebug(lcFolderWatcher) << "    `-> and" << subdirs << "subdirectories";
+    if (_hasUnwatchedSnapshot && _parent) {
+        const QStringList changed = changedPaths(_unwatchedSnapshot, snapshot);
+        if (!changed.isEmpty()) {
+            _parent->changeDetected(changed);
+        }
     }
+    _unwatchedSnapshot = snapshot;
+    _hasUnwatchedSnapshot = true;
 }
 
 void FolderWatcherPrivate::slotReceivedNotification(int fd)
@@ -157,15 +363,16 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             continue;
         }
 
+        // The kernel dropped the watch, the folder is gone
+        if (event->mask & IN_IGNORED) {
+            _watchedPaths.remove(_watches.take(event->wd));
+        }
+
         // Fire event for the path that was changed.
         if (event->len > 0 && event->wd > -1) {
             QByteArray fileName(event->name);
-            if (fileName.startsWith("._sync_")
-                || fileName.startsWith(".csync_journal.db")
-                || fileName.startsWith(".owncloudsync.log")
-                || fileName.startsWith(".sync_")) {
-            } else {
-                const QString p = _watches[event->wd] + '/' + fileName;
+            if (!isSyncMetadataFile(fileName)) {
+                const QString p = _watches.value(event->wd) + '/' + fileName;
                 _parent->changeDetected(p);
             }
         }
@@ -175,28 +382,41 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
     }
 }
 
+void FolderWatcherPrivate::fanotifyChangesDetected(const QStringList &paths)
+{
+    QStringList changed;
+    foreach (const QString &path, paths) {
+        if (!isSyncMetadataFile(path.mid(path.lastIndexOf(QLatin1Char('/')) + 1).toUtf8())) {
+            changed.append(path);
+        }
+    }
+    if (!changed.isEmpty()) {
+        _parent->changeDetected(changed);
+    }
+}
+
 void FolderWatcherPrivate::addPath(const QString &path)
 {
+    // fanotify watches the whole tree already
+    if (_useFanotify) {
+        return;
+    }
     slotAddFolderRecursive(path);
 }
 
 void FolderWatcherPrivate::removePath(const QString &path)
 {
-    int wid = -1;
-    // Remove the inotify watch.
-    QHash<int, QString>::const_iterator i = _watches.constBegin();
-
-    while (i != _watches.constEnd()) {
-        if (i.value() == path) {
-            wid = i.key();
-            break;
-        }
-        ++i;
+    if (_useFanotify) {
+        return;
     }
-    if (wid > -1) {
-        inotify_rm_watch(_fd, wid);
-        _watches.remove(wid);
+    // Remove the inotify watch.
+    auto it = _watchedPaths.find(path);
+    if (it != _watchedPaths.end()) {
+        inotify_rm_watch(_fd, it.value());
+        _watches.remove(it.value());
+        _watchedPaths.erase(it);
     }
+    _unwatchedFolders.remove(path);
 }
 
 } // ns mirall
@@ -19,7 +19,11 @@
 #include <QString>
 #include <QSocketNotifier>
 #include <QHash>
+#include <QSet>
 #include <QDir>
+#include <QPair>
+#include <QTimer>
+#include <QFutureWatcher>
 
 #include "folderwatcher.h"
 
@@ -27,34 +31,86 @@ namespace OCC {
 
 /**
  * @brief Linux (inotify) API implementation of FolderWatcher
+ *
+ * inotify is not recursive, every directory of the tree needs its own watch.
+ * The tree is walked in a background thread and the watches are added on
+ * the main thread in chunks, so huge trees don't block the GUI.
+ *
+ * When the kernel runs out of watches (fs.inotify.max_user_watches), the
+ * subtrees that could not be watched are scanned periodically instead.
+ *
+ * If the FanotifyWatcher is available it watches the whole folder and no
+ * inotify watches are needed at all.
+ *
  * @ingroup gui
  */
 class FolderWatcherPrivate : public QObject
 {
     Q_OBJECT
 public:
-    FolderWatcherPrivate() {}
+    FolderWatcherPrivate();
     FolderWatcherPrivate(FolderWatcher *p, const QString &path);
     ~FolderWatcherPrivate();
 
     void addPath(const QString &path);
     void removePath(const QString &);
 
+    /// Called by the FanotifyWatcher with the changes below our folder
+    void fanotifyChangesDetected(const QStringList &paths);
+
+    /// path -> (modification time, size) of everything below some folders
+    typedef QHash<QString, QPair<qint64, qint64>> Snapshot;
+
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotFoldersFound();
+    void slotRegisterPendingFolders();
+    void slotScanUnwatchedFolders();
+    void slotUnwatchedFoldersScanned();
 
 protected:
-    bool findFoldersBelow(const QDir &dir, QStringList &fullList);
-    void inotifyRegisterPath(const QString &path);
+    /** Lists all folders below dir, parents before their children.
+     *
+     * Does not touch any member and may be called from any thread.
+     */
+    static bool findFoldersBelow(const QDir &dir, QStringList &fullList);
+
+    /// Records the state of everything below the given folders, thread safe
+    static Snapshot snapshotBelow(const QStringList &roots);
+
+    /// The paths that were added, removed or modified between two snapshots
+    static QStringList changedPaths(const Snapshot &before, const Snapshot &after);
+
+    /// Returns false if the kernel ran out of inotify watches
+    bool inotifyRegisterPath(const QString &path);
 
 private:
+    bool isBelowUnwatchedFolder(const QString &path) const;
+
     FolderWatcher *_parent;
 
     QString _folder;
+    bool _useFanotify;
     QHash<int, QString> _watches;
+    QHash<QString, int> _watchedPaths; // reverse index of _watches
     QScopedPointer<QSocketNotifier> _socket;
     int _fd;
+
+    // Folders found by the background walks that still need a watch,
+    // parents before their children
+    QStringList _pendingFolders;
+    int _pendingIndex;
+    QString _skipPrefix; // children of this folder are skipped
+    QTimer _registerTimer;
+
+    // Subtrees that could not be watched because of max_user_watches
+    QSet<QString> _unwatchedFolders;
+    bool _watchesExhausted;
+    QTimer _unwatchedScanTimer;
+    QFutureWatcher<Snapshot> _unwatchedScan;
+    Snapshot _unwatchedSnapshot;
+    bool _hasUnwatchedSnapshot;
 };
 }
 
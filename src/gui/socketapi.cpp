@@ -15,6 +15,7 @@
  */
 
 #include "socketapi.h"
+#include "socketapi_p.h"
 
 #include "config.h"
 #include "configfile.h"
@@ -34,6 +35,7 @@
 #include "guiutility.h"
 
 #include <array>
+#include <cstring>
 #include <QBitArray>
 #include <QUrl>
 #include <QMetaMethod>
@@ -56,7 +58,7 @@
 // This is the version that is returned when the client asks for the VERSION.
 // The first number should be changed if there is an incompatible change that breaks old clients.
 // The second number should be changed when there are new features.
-#define MIRALL_SOCKET_API_VERSION "1.0"
+#define MIRALL_SOCKET_API_VERSION "1.2"
 
 static inline QString removeTrailingSlash(QString path)
 {
@@ -85,76 +87,6 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcSocketApi, "gui.socketapi", QtInfoMsg)
 
-class BloomFilter
-{
-    // Initialize with m=1024 bits and k=2 (high and low 16 bits of a qHash).
-    // For a client navigating in less than 100 directories, this gives us a probability less than (1-e^(-2*100/1024))^2 = 0.03147872136 false positives.
-    const static int NumBits = 1024;
-
-public:
-    BloomFilter()
-        : hashBits(NumBits)
-    {
-    }
-
-    void storeHash(uint hash)
-    {
-        hashBits.setBit((hash & 0xFFFF) % NumBits);
-        hashBits.setBit((hash >> 16) % NumBits);
-    }
-    bool isHashMaybeStored(uint hash) const
-    {
-        return hashBits.testBit((hash & 0xFFFF) % NumBits)
-            && hashBits.testBit((hash >> 16) % NumBits);
-    }
-
-private:
-    QBitArray hashBits;
-};
-
-class SocketListener
-{
-public:
-    QIODevice *socket;
-
-    SocketListener(QIODevice *socket = 0)
-        : socket(socket)
-    {
-    }
-
-    void sendMessage(const QString &message, bool doWait = false) const
-    {
-        qCInfo(lcSocketApi) << "Sending SocketAPI message -->" << message << "to" << socket;
-        QString localMessage = message;
-        if (!localMessage.endsWith(QLatin1Char('\n'))) {
-            localMessage.append(QLatin1Char('\n'));
-        }
-
-        QByteArray bytesToSend = localMessage.toUtf8();
-        qint64 sent = socket->write(bytesToSend);
-        if (doWait) {
-            socket->waitForBytesWritten(1000);
-        }
-        if (sent != bytesToSend.length()) {
-            qCWarning(lcSocketApi) << "Could not send all data on socket for " << localMessage;
-        }
-    }
-
-    void sendMessageIfDirectoryMonitored(const QString &message, uint systemDirectoryHash) const
-    {
-        if (_monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash))
-            sendMessage(message, false);
-    }
-
-    void registerMonitoredDirectory(uint systemDirectoryHash)
-    {
-        _monitoredDirectoriesBloomFilter.storeHash(systemDirectoryHash);
-    }
-
-private:
-    BloomFilter _monitoredDirectoriesBloomFilter;
-};
-
 struct ListenerHasSocketPred
 {
     QIODevice *socket;
@@ -209,6 +141,12 @@ SocketApi::SocketApi(QObject *parent)
 
     connect(&_localServer, &SocketApiServer::newConnection, this, &SocketApi::slotNewConnection);
 
+    // Collect the status changes for a short while, a sync of many files
+    // would otherwise mean one socket write per change and listener.
+    _statusPushTimer.setSingleShot(true);
+    _statusPushTimer.setInterval(100);
+    connect(&_statusPushTimer, &QTimer::timeout, this, &SocketApi::slotFlushStatusPushes);
+
     // folder watcher
     connect(FolderMan::instance(), &FolderMan::folderSyncStateChange, this, &SocketApi::slotUpdateFolderView);
 }
@@ -264,22 +202,72 @@ void SocketApi::slotReadSocket()
     ASSERT(socket);
     SocketListener *listener = &*std::find_if(_listeners.begin(), _listeners.end(), ListenerHasSocketPred(socket));
 
-    while (socket->canReadLine()) {
-        // Make sure to normalize the input from the socket to
-        // make sure that the path will match, especially on OS X.
-        QString line = QString::fromUtf8(socket->readLine()).normalized(QString::NormalizationForm_C);
-        line.chop(1); // remove the '\n'
-        qCInfo(lcSocketApi) << "Received SocketAPI message <--" << line << "from" << socket;
-        QByteArray command = line.split(":").value(0).toAscii();
-        QByteArray functionWithArguments = "command_" + command + "(QString,SocketListener*)";
-        int indexOfMethod = staticMetaObject.indexOfMethod(functionWithArguments);
-
-        QString argument = line.remove(0, command.length() + 1);
-        if (indexOfMethod != -1) {
-            staticMetaObject.method(indexOfMethod).invoke(this, Q_ARG(QString, argument), Q_ARG(SocketListener *, listener));
-        } else {
-            qCWarning(lcSocketApi) << "The command is not supported by this version of the client:" << command << "with argument:" << argument;
+    // Take everything at once and dispatch the lines in place
+    QByteArray data = socket->readAll();
+    if (!listener->incompleteLine.isEmpty()) {
+        data.prepend(listener->incompleteLine);
+        listener->incompleteLine.clear();
+    }
+
+    int start = 0;
+    for (int end = data.indexOf('\n'); end != -1; end = data.indexOf('\n', start)) {
+        dispatchLine(data.constData() + start, end - start, listener);
+        start = end + 1;
+    }
+    if (start < data.size())
+        listener->incompleteLine = data.mid(start);
+}
+
+const QHash<QByteArray, SocketApi::CommandHandler> &SocketApi::commandHandlers()
+{
+    static const QHash<QByteArray, CommandHandler> handlers = [] {
+        QHash<QByteArray, CommandHandler> h;
+#define SOCKETAPI_COMMAND(name) h.insert(QByteArrayLiteral(#name), &SocketApi::command_##name)
+        SOCKETAPI_COMMAND(RETRIEVE_FOLDER_STATUS);
+        SOCKETAPI_COMMAND(RETRIEVE_FILE_STATUS);
+        SOCKETAPI_COMMAND(RETRIEVE_FILE_STATUSES);
+        SOCKETAPI_COMMAND(SUBSCRIBE_STATUS);
+        SOCKETAPI_COMMAND(UNSUBSCRIBE_STATUS);
+        SOCKETAPI_COMMAND(VERSION);
+        SOCKETAPI_COMMAND(SHARE_STATUS);
+        SOCKETAPI_COMMAND(SHARE_MENU_TITLE);
+        SOCKETAPI_COMMAND(SHARE);
+        SOCKETAPI_COMMAND(COPY_PRIVATE_LINK);
+        SOCKETAPI_COMMAND(EMAIL_PRIVATE_LINK);
+        SOCKETAPI_COMMAND(GET_STRINGS);
+#undef SOCKETAPI_COMMAND
+
+        int commandMethods = 0;
+        for (int i = staticMetaObject.methodOffset(); i < staticMetaObject.methodCount(); ++i) {
+            if (staticMetaObject.method(i).name().startsWith("command_"))
+                ++commandMethods;
         }
+        ASSERT(commandMethods == h.size(), "A command_ method is missing from the dispatch table");
+        return h;
+    }();
+    return handlers;
+}
+
+void SocketApi::dispatchLine(const char *line, int size, SocketListener *listener)
+{
+    qCInfo(lcSocketApi) << "Received SocketAPI message <--" << QString::fromUtf8(line, size) << "from" << listener->socket;
+
+    const char *colon = static_cast<const char *>(memchr(line, ':', size));
+    const int commandSize = colon ? int(colon - line) : size;
+    // The lookup only needs to compare the bytes, don't copy them
+    const QByteArray command = QByteArray::fromRawData(line, commandSize);
+
+    // Make sure to normalize the input from the socket to
+    // make sure that the path will match, especially on OS X.
+    QString argument;
+    if (colon)
+        argument = QString::fromUtf8(colon + 1, size - commandSize - 1).normalized(QString::NormalizationForm_C);
+
+    auto handler = commandHandlers().constFind(command);
+    if (handler != commandHandlers().constEnd()) {
+        (this->*(*handler))(argument, listener);
+    } else {
+        qCWarning(lcSocketApi) << "The command is not supported by this version of the client:" << command << "with argument:" << argument;
     }
 }
 
@@ -338,6 +326,9 @@ void SocketApi::slotUpdateFolderView(Folder *f)
 
 void SocketApi::broadcastMessage(const QString &msg, bool doWait)
 {
+    // Keep the pushed statuses in order with the other messages
+    slotFlushStatusPushes();
+
     foreach (auto &listener, _listeners) {
         listener.sendMessage(msg, doWait);
     }
@@ -345,11 +336,59 @@ void SocketApi::broadcastMessage(const QString &msg, bool doWait)
 
 void SocketApi::broadcastStatusPushMessage(const QString &systemPath, SyncFileStatus fileStatus)
 {
-    QString msg = buildMessage(QLatin1String("STATUS"), systemPath, fileStatus.toSocketAPIString());
     Q_ASSERT(!systemPath.endsWith('/'));
-    uint directoryHash = qHash(systemPath.left(systemPath.lastIndexOf('/')));
+    if (_listeners.isEmpty())
+        return;
+
+    auto index = _pendingStatusPushIndex.find(systemPath);
+    if (index != _pendingStatusPushIndex.end()) {
+        if (_pendingStatusPushes[*index]._status == fileStatus)
+            return;
+        // Superseded, the new status goes after the changes that happened in between
+        _pendingStatusPushes[*index]._systemPath.clear();
+        *index = _pendingStatusPushes.size();
+    } else {
+        _pendingStatusPushIndex.insert(systemPath, _pendingStatusPushes.size());
+    }
+    _pendingStatusPushes.append(PendingStatusPush{ systemPath, fileStatus });
+
+    if (!_statusPushTimer.isActive())
+        _statusPushTimer.start();
+}
+
+void SocketApi::slotFlushStatusPushes()
+{
+    _statusPushTimer.stop();
+    if (_pendingStatusPushes.isEmpty())
+        return;
+
+    QVector<PendingStatusPush> pushes;
+    std::swap(pushes, _pendingStatusPushes);
+    _pendingStatusPushIndex.clear();
+
+    QStringList messages;
+    QVector<uint> directoryHashes;
+    messages.reserve(pushes.size());
+    directoryHashes.reserve(pushes.size());
+    foreach (const PendingStatusPush &push, pushes) {
+        if (push._systemPath.isNull())
+            continue;
+        messages.append(buildMessage(QLatin1String("STATUS"), push._systemPath, push._status.toSocketAPIString()));
+        directoryHashes.append(qHash(push._systemPath.left(push._systemPath.lastIndexOf('/'))));
+    }
+
+    // One write per listener for all the statuses it is interested in
     foreach (auto &listener, _listeners) {
-        listener.sendMessageIfDirectoryMonitored(msg, directoryHash);
+        QString batch;
+        for (int i = 0; i < messages.size(); ++i) {
+            if (!listener.isDirectoryMonitored(directoryHashes.at(i)))
+                continue;
+            if (!batch.isEmpty())
+                batch.append(QLatin1Char('\n'));
+            batch.append(messages.at(i));
+        }
+        if (!batch.isEmpty())
+            listener.sendMessage(batch);
     }
 }
 
@@ -387,6 +426,64 @@ void SocketApi::command_RETRIEVE_FILE_STATUS(const QString &argument, SocketList
     listener->sendMessage(message);
 }
 
+void SocketApi::command_RETRIEVE_FILE_STATUSES(const QString &argument, SocketListener *listener)
+{
+    QString directory = QDir::cleanPath(argument);
+    if (directory.endsWith(QLatin1Char('/')))
+        directory.truncate(directory.length() - 1);
+    // Ends every answer, even an empty one, so the shell extension knows that
+    // whatever is still missing won't come without asking for it.
+    const QString endMessage = QLatin1String("STATUSES_END:") % QDir::toNativeSeparators(directory);
+
+    Folder *syncFolder = FolderMan::instance()->folderForPath(argument);
+    if (!syncFolder) {
+        // Same answer as RETRIEVE_FILE_STATUS would give for the directory itself
+        listener->sendMessage(QLatin1String("STATUS:NOP:") % QDir::toNativeSeparators(argument) % QLatin1Char('\n') % endMessage);
+        return;
+    }
+
+    // The listener now wants status pushes for the entries of this directory
+    listener->registerMonitoredDirectory(qHash(directory));
+
+    QString relativeDirectory = directory.mid(syncFolder->cleanPath().length() + 1);
+    if (!relativeDirectory.isEmpty())
+        relativeDirectory.append(QLatin1Char('/'));
+
+    const QStringList entries = QDir(directory).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    QStringList relativePaths;
+    relativePaths.reserve(entries.size());
+    foreach (const QString &entry, entries) {
+        relativePaths.append(relativeDirectory + entry);
+    }
+    const QVector<SyncFileStatus> statuses = syncFolder->syncEngine().syncFileStatusTracker().fileStatuses(relativePaths);
+
+    // One STATUS line per entry, written to the socket at once
+    QStringList messages;
+    messages.reserve(entries.size() + 1);
+    for (int i = 0; i < entries.size(); ++i) {
+        messages.append(QLatin1String("STATUS:") % statuses.at(i).toSocketAPIString() % QLatin1Char(':')
+            % QDir::toNativeSeparators(directory % QLatin1Char('/') % entries.at(i)));
+    }
+    messages.append(endMessage);
+    listener->sendMessage(messages.join(QLatin1Char('\n')));
+}
+
+void SocketApi::command_SUBSCRIBE_STATUS(const QString &argument, SocketListener *listener)
+{
+    QString directory = QDir::cleanPath(argument);
+    if (directory.endsWith(QLatin1Char('/')))
+        directory.truncate(directory.length() - 1);
+    listener->subscribeDirectory(qHash(directory));
+}
+
+void SocketApi::command_UNSUBSCRIBE_STATUS(const QString &argument, SocketListener *listener)
+{
+    QString directory = QDir::cleanPath(argument);
+    if (directory.endsWith(QLatin1Char('/')))
+        directory.truncate(directory.length() - 1);
+    listener->unsubscribeDirectory(qHash(directory));
+}
+
 void SocketApi::command_SHARE(const QString &localFile, SocketListener *listener)
 {
     auto theme = Theme::instance();
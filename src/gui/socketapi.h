@@ -20,6 +20,10 @@
 #include "syncfilestatus.h"
 // #include "ownsql.h"
 
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+
 #if defined(Q_OS_MAC)
 #include "socketapisocket_mac.h"
 #else
@@ -30,6 +34,7 @@ typedef QLocalServer SocketApiServer;
 class QUrl;
 class QLocalSocket;
 class QStringList;
+class TestSocketApi;
 
 namespace OCC {
 
@@ -63,6 +68,7 @@ private slots:
     void onLostConnection();
     void slotSocketDestroyed(QObject *obj);
     void slotReadSocket();
+    void slotFlushStatusPushes();
 
     void copyPrivateLinkToClipboard(const QString &link) const;
     void emailPrivateLink(const QString &link) const;
@@ -70,8 +76,21 @@ private slots:
 private:
     void broadcastMessage(const QString &msg, bool doWait = false);
 
+    // The commands a client can send as "<NAME>:<argument>\n" are the command_<NAME>
+    // methods, they need to be listed in commandHandlers() as well.
+    typedef void (SocketApi::*CommandHandler)(const QString &argument, SocketListener *listener);
+    static const QHash<QByteArray, CommandHandler> &commandHandlers();
+    void dispatchLine(const char *line, int size, SocketListener *listener);
+
     Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener);
     Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString &argument, SocketListener *listener);
+    // Like RETRIEVE_FILE_STATUS for every entry of the directory given as argument,
+    // followed by STATUSES_END:<directory>
+    Q_INVOKABLE void command_RETRIEVE_FILE_STATUSES(const QString &argument, SocketListener *listener);
+
+    // Restrict the status pushes to the directories the client has open
+    Q_INVOKABLE void command_SUBSCRIBE_STATUS(const QString &argument, SocketListener *listener);
+    Q_INVOKABLE void command_UNSUBSCRIBE_STATUS(const QString &argument, SocketListener *listener);
 
     Q_INVOKABLE void command_VERSION(const QString &argument, SocketListener *listener);
 
@@ -91,6 +110,20 @@ private:
     QSet<QString> _registeredAliases;
     QList<SocketListener> _listeners;
     SocketApiServer _localServer;
+
+    // Status changes waiting for _statusPushTimer, only the latest one per path
+    // is kept. Superseded entries get a null path, so that the order of the
+    // pushes still follows the order of the changes.
+    struct PendingStatusPush
+    {
+        QString _systemPath;
+        SyncFileStatus _status;
+    };
+    QVector<PendingStatusPush> _pendingStatusPushes;
+    QHash<QString, int> _pendingStatusPushIndex; // system path -> index in _pendingStatusPushes
+    QTimer _statusPushTimer;
+
+    friend class ::TestSocketApi;
 };
 }
 #endif // SOCKETAPI_H
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) by Dominik Schmidt <dev@dominik-schmidt.de>
+ * Copyright (C) by Klaas Freitag <freitag@owncloud.com>
+ * Copyright (C) by Roeland Jago Douma <roeland@famdouma.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QBitArray>
+#include <QIODevice>
+#include <QLoggingCategory>
+#include <QSet>
+#include <QString>
+
+namespace OCC {
+
+Q_DECLARE_LOGGING_CATEGORY(lcSocketApi)
+
+class BloomFilter
+{
+    // Initialize with m=1024 bits and k=2 (high and low 16 bits of a qHash).
+    // For a client navigating in less than 100 directories, this gives us a probability less than (1-e^(-2*100/1024))^2 = 0.03147872136 false positives.
+    const static int NumBits = 1024;
+
+public:
+    BloomFilter()
+        : hashBits(NumBits)
+    {
+    }
+
+    void storeHash(uint hash)
+    {
+        hashBits.setBit((hash & 0xFFFF) % NumBits);
+        hashBits.setBit((hash >> 16) % NumBits);
+    }
+    bool isHashMaybeStored(uint hash) const
+    {
+        return hashBits.testBit((hash & 0xFFFF) % NumBits)
+            && hashBits.testBit((hash >> 16) % NumBits);
+    }
+
+private:
+    QBitArray hashBits;
+};
+
+class SocketListener
+{
+public:
+    QIODevice *socket;
+
+    // What was received after the last complete line
+    QByteArray incompleteLine;
+
+    SocketListener(QIODevice *socket = 0)
+        : socket(socket)
+        , _usesSubscriptions(false)
+    {
+    }
+
+    void sendMessage(const QString &message, bool doWait = false) const
+    {
+        qCInfo(lcSocketApi) << "Sending SocketAPI message -->" << message << "to" << socket;
+        QString localMessage = message;
+        if (!localMessage.endsWith(QLatin1Char('\n'))) {
+            localMessage.append(QLatin1Char('\n'));
+        }
+
+        QByteArray bytesToSend = localMessage.toUtf8();
+        qint64 sent = socket->write(bytesToSend);
+        if (doWait) {
+            socket->waitForBytesWritten(1000);
+        }
+        if (sent != bytesToSend.length()) {
+            qCWarning(lcSocketApi) << "Could not send all data on socket for " << localMessage;
+        }
+    }
+
+    bool isDirectoryMonitored(uint systemDirectoryHash) const
+    {
+        // Clients that subscribe explicitly only get what they asked for,
+        // the bloom filter never forgets a directory.
+        if (_usesSubscriptions)
+            return _subscribedDirectories.contains(systemDirectoryHash);
+        return _monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash);
+    }
+
+    void registerMonitoredDirectory(uint systemDirectoryHash)
+    {
+        _monitoredDirectoriesBloomFilter.storeHash(systemDirectoryHash);
+    }
+
+    void subscribeDirectory(uint systemDirectoryHash)
+    {
+        _usesSubscriptions = true;
+        _subscribedDirectories.insert(systemDirectoryHash);
+    }
+
+    void unsubscribeDirectory(uint systemDirectoryHash)
+    {
+        _subscribedDirectories.remove(systemDirectoryHash);
+    }
+
+private:
+    BloomFilter _monitoredDirectoriesBloomFilter;
+    bool _usesSubscriptions;
+    QSet<uint> _subscribedDirectories;
+};
+}
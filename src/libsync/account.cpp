@@ -140,18 +140,12 @@ void Account::setCredentials(AbstractCredentials *cred)
     _credentials.reset(cred);
     cred->setAccount(this);
 
-    // Note: This way the QNAM can outlive the Account and Credentials.
-    // This is necessary to avoid issues with the QNAM being deleted while
-    // processing slotHandleSslErrors().
-    _am = QSharedPointer<QNetworkAccessManager>(_credentials->createQNAM(), &QObject::deleteLater);
+    _am = createNetworkAccessManager();
 
     if (jar) {
         _am->setCookieJar(jar);
     }
-    connect(_am.data(), SIGNAL(sslErrors(QNetworkReply *, QList<QSslError>)),
-        SLOT(slotHandleSslErrors(QNetworkReply *, QList<QSslError>)));
-    connect(_am.data(), &QNetworkAccessManager::proxyAuthenticationRequired,
-        this, &Account::proxyAuthenticationRequired);
+    resetNetworkAccessManagerPool();
     connect(_credentials.data(), &AbstractCredentials::fetched,
         this, &Account::slotCredentialsFetched);
     connect(_credentials.data(), &AbstractCredentials::asked,
@@ -206,15 +200,77 @@ void Account::resetNetworkAccessManager()
     qCDebug(lcAccount) << "Resetting QNAM";
     QNetworkCookieJar *jar = _am->cookieJar();
 
+    _am = createNetworkAccessManager();
+
+    _am->setCookieJar(jar); // takes ownership of the old cookie jar
+    resetNetworkAccessManagerPool();
+}
+
+QSharedPointer<QNetworkAccessManager> Account::createNetworkAccessManager()
+{
+    // Note: This way the QNAM can outlive the Account and Credentials.
+    // This is necessary to avoid issues with the QNAM being deleted while
+    // processing slotHandleSslErrors().
     // Use a QSharedPointer to allow locking the life of the QNAM on the stack.
     // Make it call deleteLater to make sure that we can return to any QNAM stack frames safely.
-    _am = QSharedPointer<QNetworkAccessManager>(_credentials->createQNAM(), &QObject::deleteLater);
+    QSharedPointer<QNetworkAccessManager> am(_credentials->createQNAM(), &QObject::deleteLater);
 
-    _am->setCookieJar(jar); // takes ownership of the old cookie jar
-    connect(_am.data(), SIGNAL(sslErrors(QNetworkReply *, QList<QSslError>)),
+    connect(am.data(), SIGNAL(sslErrors(QNetworkReply *, QList<QSslError>)),
         SLOT(slotHandleSslErrors(QNetworkReply *, QList<QSslError>)));
-    connect(_am.data(), &QNetworkAccessManager::proxyAuthenticationRequired,
+    connect(am.data(), &QNetworkAccessManager::proxyAuthenticationRequired,
         this, &Account::proxyAuthenticationRequired);
+    return am;
+}
+
+void Account::setMaxHttpConnections(int connections)
+{
+    connections = qMax(1, connections);
+    if (connections == _maxHttpConnections) {
+        return;
+    }
+    _maxHttpConnections = connections;
+    if (_credentials && _am) {
+        resetNetworkAccessManagerPool();
+    }
+}
+
+void Account::resetNetworkAccessManagerPool()
+{
+    _amPool.clear();
+    _amPoolNext = 0;
+
+    // Including _am
+    const int poolSize = (_maxHttpConnections + connectionsPerNetworkAccessManager - 1) / connectionsPerNetworkAccessManager;
+    for (int i = 1; i < poolSize; ++i) {
+        auto am = createNetworkAccessManager();
+        lendCookieJarTo(am.data());
+        _amPool.append(am);
+    }
+    if (!_amPool.isEmpty()) {
+        qCInfo(lcAccount) << "Using" << poolSize << "network access managers for up to" << _maxHttpConnections << "connections";
+    }
+}
+
+QNetworkAccessManager *Account::nextNetworkAccessManager()
+{
+    // HTTP/2 multiplexes all requests over one connection anyway
+    if (_amPool.isEmpty() || _http2Supported) {
+        return _am.data();
+    }
+
+    // Round robin over _am and the pool
+    const int index = _amPoolNext;
+    _amPoolNext = (_amPoolNext + 1) % (_amPool.size() + 1);
+    if (index == 0) {
+        return _am.data();
+    }
+
+    // The proxy is configured on networkAccessManager() only
+    QNetworkAccessManager *am = _amPool.at(index - 1).data();
+    if (am->proxy() != _am->proxy()) {
+        am->setProxy(_am->proxy());
+    }
+    return am;
 }
 
 QNetworkAccessManager *Account::networkAccessManager()
@@ -231,18 +287,19 @@ QNetworkReply *Account::sendRawRequest(const QByteArray &verb, const QUrl &url,
 {
     req.setUrl(url);
     req.setSslConfiguration(this->getOrCreateSslConfig());
+    QNetworkAccessManager *am = nextNetworkAccessManager();
     if (verb == "HEAD" && !data) {
-        return _am->head(req);
+        return am->head(req);
     } else if (verb == "GET" && !data) {
-        return _am->get(req);
+        return am->get(req);
     } else if (verb == "POST") {
-        return _am->post(req, data);
+        return am->post(req, data);
     } else if (verb == "PUT") {
-        return _am->put(req, data);
+        return am->put(req, data);
     } else if (verb == "DELETE" && !data) {
-        return _am->deleteResource(req);
+        return am->deleteResource(req);
     }
-    return _am->sendCustomRequest(req, verb, data);
+    return am->sendCustomRequest(req, verb, data);
 }
 
 SimpleNetworkJob *Account::sendRequest(const QByteArray &verb, const QUrl &url, QNetworkRequest req, QIODevice *data)
@@ -408,6 +465,9 @@ void Account::handleInvalidCredentials()
 void Account::clearQNAMCache()
 {
     _am->clearAccessCache();
+    foreach (const auto &am, _amPool) {
+        am->clearAccessCache();
+    }
 }
 
 const Capabilities &Account::capabilities() const
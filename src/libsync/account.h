@@ -27,6 +27,7 @@
 #include <QSslError>
 #include <QSharedPointer>
 #include <QPixmap>
+#include <QVector>
 
 #include "common/utility.h"
 #include <memory>
@@ -219,6 +220,25 @@ public:
     QNetworkAccessManager *networkAccessManager();
     QSharedPointer<QNetworkAccessManager> sharedNetworkAccessManager();
 
+    /** The number of connections a single QNAM opens to one host at most */
+    static const int connectionsPerNetworkAccessManager = 6;
+
+    /** The number of parallel connections to the server
+     *
+     * Without HTTP/2, a QNAM opens at most six connections to a host. For
+     * more, sendRawRequest() spreads the requests over a pool of QNAMs that
+     * share the cookie jar, credentials and proxy of networkAccessManager().
+     */
+    int maxHttpConnections() const { return _maxHttpConnections; }
+    void setMaxHttpConnections(int connections);
+
+    /** The number of syncs currently running on this account
+     *
+     * They share the connections, see OwncloudPropagator::hardMaximumActiveJob().
+     */
+    int runningSyncCount() const { return _runningSyncCount; }
+    void setRunningSyncCount(int count) { _runningSyncCount = qMax(1, count); }
+
     /// Called by network jobs on credential errors, emits invalidCredentials()
     void handleInvalidCredentials();
 
@@ -255,6 +275,10 @@ private:
     Account(QObject *parent = 0);
     void setSharedThis(AccountPtr sharedThis);
 
+    QSharedPointer<QNetworkAccessManager> createNetworkAccessManager();
+    void resetNetworkAccessManagerPool();
+    QNetworkAccessManager *nextNetworkAccessManager();
+
     QWeakPointer<Account> _sharedThis;
     QString _id;
     QString _davUser;
@@ -268,6 +292,11 @@ private:
     QScopedPointer<AbstractSslErrorHandler> _sslErrorHandler;
     QuotaInfo *_quotaInfo;
     QSharedPointer<QNetworkAccessManager> _am;
+    /// Additional QNAMs for more connections, see setMaxHttpConnections()
+    QVector<QSharedPointer<QNetworkAccessManager>> _amPool;
+    int _amPoolNext = 0;
+    int _maxHttpConnections = connectionsPerNetworkAccessManager;
+    int _runningSyncCount = 1;
     QScopedPointer<AbstractCredentials> _credentials;
     bool _http2Supported = false;
 
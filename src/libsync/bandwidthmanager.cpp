@@ -31,60 +31,154 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcBandwidthManager, "sync.bandwidthmanager", QtInfoMsg)
 
+// How often the buckets are refilled. Shorter intervals give smoother
+// transfers at the cost of more wakeups.
+static const int refillIntervalMsec = 100;
+
+// Never hand out less than this to a consumer, so that a low limit with many
+// parallel transfers doesn't degenerate into tiny reads.
+static const qint64 minimumQuota = 4 * 1024;
+
 // Because of the many layers of buffering inside Qt (and probably the OS and the network)
 // we cannot lower this value much more. If we do, the estimated bw will be very high
 // because the buffers fill fast while the actual network algorithms are not relevant yet.
-static qint64 relativeLimitMeasuringTimerIntervalMsec = 1000 * 2;
+static const qint64 relativeMeasuringMsec = 1000 * 2;
 // See also WritingState in http://code.woboq.org/qt5/qtbase/src/network/access/qhttpprotocolhandler.cpp.html#_ZN20QHttpProtocolHandler11sendRequestEv
 
+// For relative limits, how long to limit after each measurement
+static const qint64 relativeLimitingMsec = 4 * relativeMeasuringMsec;
+
 // FIXME At some point:
 //  * Register device only after the QNR received its metaDataChanged() signal
 //  * Incorporate Qt buffer fill state (it's a negative absolute delta).
 //  * Incorporate SSL overhead (percentage)
-//  * For relative limiting, do less measuring and more delaying+giving quota
 //  * For relative limiting, smoothen measurements
 
+template <typename Consumer>
+qint64 BandwidthManager::Bucket<Consumer>::request(Consumer *consumer, qint64 wanted, bool measuring)
+{
+    if (_rate <= 0) {
+        if (measuring) {
+            _measuredBytes += wanted;
+        }
+        return wanted;
+    }
+
+    // Don't jump the queue: if others are waiting, wait for the next refill as well
+    if (_tokens <= 0 || !_waiting.isEmpty()) {
+        if (!_waiting.contains(consumer)) {
+            _waiting.append(consumer);
+        }
+        return 0;
+    }
+
+    qint64 quota = qMin(_tokens, qMax(_rate / qMax(1, _consumers.size()), minimumQuota));
+    _tokens -= quota;
+    return quota;
+}
+
+template <typename Consumer>
+void BandwidthManager::Bucket<Consumer>::refill(qint64 elapsedMsec)
+{
+    if (_rate <= 0) {
+        return;
+    }
+
+    // The bucket holds at most one second worth of tokens
+    _tokens = qMin(_tokens + _rate * elapsedMsec / 1000, qMax(_rate, minimumQuota));
+
+    // Split the tokens equally between the waiting consumers, in the order they
+    // asked. If there is not enough for everyone, the rest stays at the front
+    // of the queue for the next refill.
+    while (!_waiting.isEmpty() && _tokens > 0) {
+        qint64 quota = qMax(_tokens / _waiting.size(), qMin(_tokens, minimumQuota));
+        _tokens -= quota;
+        _waiting.takeFirst()->giveBandwidthQuota(quota);
+    }
+}
+
+template <typename Consumer>
+void BandwidthManager::Bucket<Consumer>::setRate(qint64 rate)
+{
+    _rate = rate;
+    if (_rate <= 0) {
+        _tokens = 0;
+        // Not limited anymore: wake everyone up, they will ask again
+        while (!_waiting.isEmpty()) {
+            _waiting.takeFirst()->giveBandwidthQuota(0);
+        }
+    } else {
+        _tokens = qMin(_tokens, qMax(_rate, minimumQuota));
+    }
+}
+
+template <typename Consumer>
+void BandwidthManager::Bucket<Consumer>::remove(Consumer *consumer, qint64 unusedQuota)
+{
+    _consumers.removeAll(consumer);
+    _waiting.removeAll(consumer);
+    if (_rate > 0 && unusedQuota > 0) {
+        _tokens = qMin(_tokens + unusedQuota, qMax(_rate, minimumQuota));
+    }
+}
+
+template <typename Consumer>
+void BandwidthManager::finishMeasuring(Bucket<Consumer> &bucket)
+{
+    if (bucket._limit >= 0 || bucket._measuredBytes == 0) {
+        // Nothing to limit, or nothing was transferred: stay unlimited until
+        // the next measurement
+        return;
+    }
+
+    qint64 fullSpeed = bucket._measuredBytes * 1000 / relativeMeasuringMsec;
+
+    // don't use too extreme values
+    double percent = qBound(qint64(10), -bucket._limit, qint64(90)) / 100.0;
+
+    // The measuring phase ran at full speed, compensate for that in the
+    // limiting phase so that the average matches the configured percentage.
+    double factor = percent - (1 - percent) * relativeMeasuringMsec / double(relativeLimitingMsec);
+    qint64 rate = qMax(qint64(1), qint64(fullSpeed * qMax(factor, 0.05)));
+
+    qCDebug(lcBandwidthManager) << bucket._measuredBytes / 1024 << "kB measured, full speed" << fullSpeed / 1024
+                                << "kB/sec, limiting to" << rate / 1024 << "kB/sec for" << percent * 100 << "%";
+    bucket.setRate(rate);
+}
+
+template <typename Consumer>
+void BandwidthManager::applyLimit(Bucket<Consumer> &bucket, qint64 limit, const char *direction)
+{
+    if (limit == bucket._limit) {
+        return;
+    }
+    qCInfo(lcBandwidthManager) << direction << "Bandwidth limit changed" << bucket._limit << limit;
+    bucket._limit = limit;
+
+    // Relative limits run unlimited until the next measurement
+    bucket.setRate(limit > 0 ? limit : 0);
+}
+
 BandwidthManager::BandwidthManager(OwncloudPropagator *p)
     : QObject()
     , _propagator(p)
-    , _relativeLimitCurrentMeasuredDevice(0)
-    , _relativeUploadLimitProgressAtMeasuringRestart(0)
-    , _currentUploadLimit(0)
-    , _relativeLimitCurrentMeasuredJob(0)
-    , _currentDownloadLimit(0)
+    , _relativeMeasuring(true)
 {
-    _currentUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    _currentDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
+    applyLimit(_upload, _propagator->_uploadLimit.fetchAndAddAcquire(0), "Upload");
+    applyLimit(_download, _propagator->_downloadLimit.fetchAndAddAcquire(0), "Download");
 
     QObject::connect(&_switchingTimer, &QTimer::timeout, this, &BandwidthManager::switchingTimerExpired);
     _switchingTimer.setInterval(10 * 1000);
     _switchingTimer.start();
     QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
 
-    // absolute uploads/downloads
-    QObject::connect(&_absoluteLimitTimer, &QTimer::timeout, this, &BandwidthManager::absoluteLimitTimerExpired);
-    _absoluteLimitTimer.setInterval(1000);
-    _absoluteLimitTimer.start();
-
-    // Relative uploads
-    QObject::connect(&_relativeUploadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadMeasuringTimerExpired);
-    _relativeUploadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeUploadMeasuringTimer.start();
-    _relativeUploadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeUploadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadDelayTimerExpired);
-    _relativeUploadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
-
-    // Relative downloads
-    QObject::connect(&_relativeDownloadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadMeasuringTimerExpired);
-    _relativeDownloadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeDownloadMeasuringTimer.start();
-    _relativeDownloadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeDownloadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadDelayTimerExpired);
-    _relativeDownloadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
+    QObject::connect(&_refillTimer, &QTimer::timeout, this, &BandwidthManager::refillTimerExpired);
+    _refillTimer.setInterval(refillIntervalMsec);
+
+    // Relative limits start out measuring
+    QObject::connect(&_relativeLimitTimer, &QTimer::timeout, this, &BandwidthManager::relativeLimitTimerExpired);
+    _relativeLimitTimer.setSingleShot(true); // restarted with the duration of the next phase
+    _relativeLimitTimer.start(relativeMeasuringMsec);
 }
 
 BandwidthManager::~BandwidthManager()
@@ -93,20 +187,9 @@ BandwidthManager::~BandwidthManager()
 
 void BandwidthManager::registerUploadDevice(UploadDevice *p)
 {
-    _absoluteUploadDeviceList.append(p);
-    _relativeUploadDeviceList.append(p);
+    _upload._consumers.append(p);
     QObject::connect(p, SIGNAL(destroyed(QObject *)), this, SLOT(unregisterUploadDevice(QObject *)));
-
-    if (usingAbsoluteUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(false);
-    } else if (usingRelativeUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(true);
-    } else {
-        p->setBandwidthLimited(false);
-        p->setChoked(false);
-    }
+    updateRefillTimer();
 }
 
 void BandwidthManager::unregisterUploadDevice(QObject *o)
@@ -119,38 +202,23 @@ void BandwidthManager::unregisterUploadDevice(QObject *o)
 
 void BandwidthManager::unregisterUploadDevice(UploadDevice *p)
 {
-    _absoluteUploadDeviceList.removeAll(p);
-    _relativeUploadDeviceList.removeAll(p);
-    if (p == _relativeLimitCurrentMeasuredDevice) {
-        _relativeLimitCurrentMeasuredDevice = 0;
-        _relativeUploadLimitProgressAtMeasuringRestart = 0;
-    }
+    _upload.remove(p, p->_bandwidthQuota);
+    p->_bandwidthQuota = 0;
+    updateRefillTimer();
 }
 
 void BandwidthManager::registerDownloadJob(GETFileJob *j)
 {
-    _downloadJobList.append(j);
+    _download._consumers.append(j);
     QObject::connect(j, SIGNAL(destroyed(QObject *)), this, SLOT(unregisterDownloadJob(QObject *)));
-
-    if (usingAbsoluteDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(false);
-    } else if (usingRelativeDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(true);
-    } else {
-        j->setBandwidthLimited(false);
-        j->setChoked(false);
-    }
+    updateRefillTimer();
 }
 
 void BandwidthManager::unregisterDownloadJob(GETFileJob *j)
 {
-    _downloadJobList.removeAll(j);
-    if (_relativeLimitCurrentMeasuredJob == j) {
-        _relativeLimitCurrentMeasuredJob = 0;
-        _relativeDownloadLimitProgressAtMeasuringRestart = 0;
-    }
+    _download.remove(j, j->_bandwidthQuota);
+    j->_bandwidthQuota = 0;
+    updateRefillTimer();
 }
 
 void BandwidthManager::unregisterDownloadJob(QObject *o)
@@ -161,249 +229,63 @@ void BandwidthManager::unregisterDownloadJob(QObject *o)
     }
 }
 
-void BandwidthManager::relativeUploadMeasuringTimerExpired()
+qint64 BandwidthManager::requestUploadQuota(UploadDevice *device, qint64 wanted)
 {
-    if (!usingRelativeUploadLimit() || _relativeUploadDeviceList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
-        return;
-    }
-    if (_relativeLimitCurrentMeasuredDevice == 0) {
-        qCDebug(lcBandwidthManager) << "No device set, just waiting 1 sec";
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
-        return;
-    }
-
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                               + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeUploadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeUploadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
-
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredDevice->_readWithProgress << _relativeLimitCurrentMeasuredDevice->_read
-                                << qAbs(_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                       - _relativeLimitCurrentMeasuredDevice->_read)
-                                << ")";
-
-    qint64 uploadLimitPercent = -_currentUploadLimit;
-    // don't use too extreme values
-    uploadLimitPercent = qMin(uploadLimitPercent, qint64(90));
-    uploadLimitPercent = qMax(qint64(10), uploadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / uploadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << uploadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any upload to timeout
-    _relativeUploadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeUploadDelayTimer.start();
-
-    int deviceCount = _relativeUploadDeviceList.count();
-    qint64 quotaPerDevice = relativeLimitProgressDifference * (uploadLimitPercent / 100.0) / deviceCount + 1.0;
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        ud->setBandwidthLimited(true);
-        ud->setChoked(false);
-        ud->giveBandwidthQuota(quotaPerDevice);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerDevice / 1024.0 << "kB to" << ud;
-    }
-    _relativeLimitCurrentMeasuredDevice = 0;
+    return _upload.request(device, wanted, _relativeMeasuring);
 }
 
-void BandwidthManager::relativeUploadDelayTimerExpired()
+qint64 BandwidthManager::requestDownloadQuota(GETFileJob *job, qint64 wanted)
 {
-    // Switch to measuring state
-    _relativeUploadMeasuringTimer.start(); // always start to continue the cycle
-
-    if (!usingRelativeUploadLimit()) {
-        return; // oh, not actually needed
-    }
-
-    if (_relativeUploadDeviceList.isEmpty()) {
-        return;
-    }
-
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting measuring";
-
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredDevice = _relativeUploadDeviceList.takeFirst();
-    _relativeUploadDeviceList.append(_relativeLimitCurrentMeasuredDevice);
-
-    _relativeUploadLimitProgressAtMeasuringRestart = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                                         + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    _relativeLimitCurrentMeasuredDevice->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredDevice->setChoked(false);
-
-    // choke all other UploadDevices
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        if (ud != _relativeLimitCurrentMeasuredDevice) {
-            ud->setBandwidthLimited(true);
-            ud->setChoked(true);
-        }
-    }
-
-    // now we're in measuring state
+    return _download.request(job, wanted, _relativeMeasuring);
 }
 
-// for downloads:
-void BandwidthManager::relativeDownloadMeasuringTimerExpired()
+void BandwidthManager::refillTimerExpired()
 {
-    if (!usingRelativeDownloadLimit() || _downloadJobList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
-    }
-    if (_relativeLimitCurrentMeasuredJob == 0) {
-        qCDebug(lcBandwidthManager) << "No job set, just waiting 1 sec";
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
-    }
-
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeDownloadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeDownloadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
-
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-
-    qint64 downloadLimitPercent = -_currentDownloadLimit;
-    // don't use too extreme values
-    downloadLimitPercent = qMin(downloadLimitPercent, qint64(90));
-    downloadLimitPercent = qMax(qint64(10), downloadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / downloadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << downloadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any download to timeout
-    _relativeDownloadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeDownloadDelayTimer.start();
-
-    int jobCount = _downloadJobList.count();
-    qint64 quota = relativeLimitProgressDifference * (downloadLimitPercent / 100.0);
-    if (quota > 20 * 1024) {
-        qCInfo(lcBandwidthManager) << "ADJUSTING QUOTA FROM " << quota << " TO " << quota - 20 * 1024;
-        quota -= 20 * 1024;
-    }
-    qint64 quotaPerJob = quota / jobCount + 1.0;
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        gfj->setBandwidthLimited(true);
-        gfj->setChoked(false);
-        gfj->giveBandwidthQuota(quotaPerJob);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerJob / 1024.0 << "kB to" << gfj;
-    }
-    _relativeLimitCurrentMeasuredDevice = 0;
+    qint64 elapsedMsec = _sinceRefill.restart();
+    _upload.refill(elapsedMsec);
+    _download.refill(elapsedMsec);
 }
 
-void BandwidthManager::relativeDownloadDelayTimerExpired()
+void BandwidthManager::updateRefillTimer()
 {
-    // Switch to measuring state
-    _relativeDownloadMeasuringTimer.start(); // always start to continue the cycle
-
-    if (!usingRelativeDownloadLimit()) {
-        return; // oh, not actually needed
+    const bool needed = _upload.needsRefill() || _download.needsRefill();
+    if (needed && !_refillTimer.isActive()) {
+        _sinceRefill.start();
+        _refillTimer.start();
+    } else if (!needed && _refillTimer.isActive()) {
+        _refillTimer.stop();
     }
+}
 
-    if (_downloadJobList.isEmpty()) {
-        qCDebug(lcBandwidthManager) << _downloadJobList.count() << "No jobs?";
+void BandwidthManager::relativeLimitTimerExpired()
+{
+    if (_relativeMeasuring) {
+        finishMeasuring(_upload);
+        finishMeasuring(_download);
+        updateRefillTimer();
+        _relativeMeasuring = false;
+        _relativeLimitTimer.start(relativeLimitingMsec);
         return;
     }
 
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting measuring";
-
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredJob = _downloadJobList.takeFirst();
-    _downloadJobList.append(_relativeLimitCurrentMeasuredJob);
-
-    _relativeDownloadLimitProgressAtMeasuringRestart = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    _relativeLimitCurrentMeasuredJob->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredJob->setChoked(false);
-
-    // choke all other download jobs
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        if (gfj != _relativeLimitCurrentMeasuredJob) {
-            gfj->setBandwidthLimited(true);
-            gfj->setChoked(true);
-        }
+    // Lift relative limits for a while to measure the full speed
+    if (usingRelativeUploadLimit()) {
+        _upload.setRate(0);
     }
-
-    // now we're in measuring state
-}
-
-// end downloads
-
-void BandwidthManager::switchingTimerExpired()
-{
-    qint64 newUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    if (newUploadLimit != _currentUploadLimit) {
-        qCInfo(lcBandwidthManager) << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
-        _currentUploadLimit = newUploadLimit;
-        Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-            if (newUploadLimit == 0) {
-                ud->setBandwidthLimited(false);
-                ud->setChoked(false);
-            } else if (newUploadLimit > 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(false);
-            } else if (newUploadLimit < 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(true);
-            }
-        }
-    }
-    qint64 newDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-    if (newDownloadLimit != _currentDownloadLimit) {
-        qCInfo(lcBandwidthManager) << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
-        _currentDownloadLimit = newDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            if (usingAbsoluteDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(false);
-            } else if (usingRelativeDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(true);
-            } else {
-                j->setBandwidthLimited(false);
-                j->setChoked(false);
-            }
-        }
+    if (usingRelativeDownloadLimit()) {
+        _download.setRate(0);
     }
+    updateRefillTimer();
+    _upload._measuredBytes = 0;
+    _download._measuredBytes = 0;
+    _relativeMeasuring = true;
+    _relativeLimitTimer.start(relativeMeasuringMsec);
 }
 
-void BandwidthManager::absoluteLimitTimerExpired()
+void BandwidthManager::switchingTimerExpired()
 {
-    if (usingAbsoluteUploadLimit() && _absoluteUploadDeviceList.count() > 0) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax(1, _absoluteUploadDeviceList.count());
-        qCDebug(lcBandwidthManager) << quotaPerDevice << _absoluteUploadDeviceList.count() << _currentUploadLimit;
-        Q_FOREACH (UploadDevice *device, _absoluteUploadDeviceList) {
-            device->giveBandwidthQuota(quotaPerDevice);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerDevice / 1024.0 << " kB to" << device;
-        }
-    }
-    if (usingAbsoluteDownloadLimit() && _downloadJobList.count() > 0) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax(1, _downloadJobList.count());
-        qCDebug(lcBandwidthManager) << quotaPerJob << _downloadJobList.count() << _currentDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            j->giveBandwidthQuota(quotaPerJob);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerJob / 1024.0 << " kB to" << j;
-        }
-    }
+    applyLimit(_upload, _propagator->_uploadLimit.fetchAndAddAcquire(0), "Upload");
+    applyLimit(_download, _propagator->_downloadLimit.fetchAndAddAcquire(0), "Download");
+    updateRefillTimer();
 }
 }
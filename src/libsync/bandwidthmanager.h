@@ -19,6 +19,7 @@
 #include <QLinkedList>
 #include <QTimer>
 #include <QIODevice>
+#include <QElapsedTimer>
 
 namespace OCC {
 
@@ -27,7 +28,20 @@ class GETFileJob;
 class OwncloudPropagator;
 
 /**
- * @brief The BandwidthManager class
+ * @brief Limits the aggregate upload and download bandwidth of a propagator
+ *
+ * Each direction has a token bucket that is refilled at the limited rate.
+ * UploadDevice and GETFileJob instances ask for quota whenever they ran out
+ * of it. If the bucket is empty, they are queued and get an equal share of
+ * the tokens on the next refill, so that a single big transfer can't starve
+ * the others. Since the limit applies to the sum of all transfers, many
+ * small transfers can run in parallel under a limit.
+ *
+ * Absolute limits (positive values of OwncloudPropagator::_uploadLimit and
+ * _downloadLimit, in bytes per second) set the refill rate directly. Relative
+ * limits (negative values, in percent) periodically measure the unlimited
+ * throughput of all transfers and derive the refill rate from that.
+ *
  * @ingroup libsync
  */
 class BandwidthManager : public QObject
@@ -37,11 +51,22 @@ public:
     BandwidthManager(OwncloudPropagator *p);
     ~BandwidthManager();
 
-    bool usingAbsoluteUploadLimit() { return _currentUploadLimit > 0; }
-    bool usingRelativeUploadLimit() { return _currentUploadLimit < 0; }
-    bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
-    bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
+    bool usingAbsoluteUploadLimit() { return _upload._limit > 0; }
+    bool usingRelativeUploadLimit() { return _upload._limit < 0; }
+    bool usingAbsoluteDownloadLimit() { return _download._limit > 0; }
+    bool usingRelativeDownloadLimit() { return _download._limit < 0; }
+
+    /** Asks for permission to send data, returns the number of bytes the device may send now.
+     *
+     * Under a limit this is a fair share of the available tokens, which may be
+     * more or less than \a wanted. If it returns 0, the device has to wait: it
+     * gets quota with UploadDevice::giveBandwidthQuota() as soon as there are
+     * tokens again. Without a limit this returns \a wanted.
+     */
+    qint64 requestUploadQuota(UploadDevice *device, qint64 wanted);
 
+    /** Same as requestUploadQuota(), for downloads */
+    qint64 requestDownloadQuota(GETFileJob *job, qint64 wanted);
 
 public slots:
     void registerUploadDevice(UploadDevice *);
@@ -52,55 +77,64 @@ public slots:
     void unregisterDownloadJob(GETFileJob *);
     void unregisterDownloadJob(QObject *);
 
-    void absoluteLimitTimerExpired();
+    void refillTimerExpired();
     void switchingTimerExpired();
-
-    void relativeUploadMeasuringTimerExpired();
-    void relativeUploadDelayTimerExpired();
-
-    void relativeDownloadMeasuringTimerExpired();
-    void relativeDownloadDelayTimerExpired();
+    void relativeLimitTimerExpired();
 
 private:
-    // for switching between absolute and relative bw limiting
-    QTimer _switchingTimer;
+    /** The token bucket of one direction */
+    template <typename Consumer>
+    struct Bucket
+    {
+        Bucket()
+            : _limit(0)
+            , _rate(0)
+            , _tokens(0)
+            , _measuredBytes(0)
+        {
+        }
+
+        qint64 request(Consumer *consumer, qint64 wanted, bool measuring);
+        void refill(qint64 elapsedMsec);
+        void setRate(qint64 rate);
+        void remove(Consumer *consumer, qint64 unusedQuota);
+        bool needsRefill() const { return _rate > 0 && !_consumers.isEmpty(); }
+
+        // The configured limit: bytes per second if positive, percent if negative
+        qint64 _limit;
+        // Bytes per second the bucket is refilled with, 0 if it doesn't limit currently
+        qint64 _rate;
+        qint64 _tokens;
+        // Bytes handed out while measuring the unlimited throughput for a relative limit
+        qint64 _measuredBytes;
+
+        QLinkedList<Consumer *> _consumers;
+        // Consumers that ran out of quota, in the order they asked for more
+        QLinkedList<Consumer *> _waiting;
+    };
+
+    template <typename Consumer>
+    void applyLimit(Bucket<Consumer> &bucket, qint64 limit, const char *direction);
+    template <typename Consumer>
+    void finishMeasuring(Bucket<Consumer> &bucket);
+    // Only wake up for refills while something is limited
+    void updateRefillTimer();
 
     // FIXME this timer and this variable should be replaced
     // by the propagator emitting the changed limit values to us as signal
     OwncloudPropagator *_propagator;
+    QTimer _switchingTimer;
 
-    // for absolute up/down bw limiting
-    QTimer _absoluteLimitTimer;
-
-    // FIXME merge these two lists
-    QLinkedList<UploadDevice *> _absoluteUploadDeviceList;
-    QLinkedList<UploadDevice *> _relativeUploadDeviceList;
-
-    QTimer _relativeUploadMeasuringTimer;
-
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeUploadDelayTimer;
-
-    // the device measured
-    UploadDevice *_relativeLimitCurrentMeasuredDevice;
-
-    // for measuring how much progress we made at start
-    qint64 _relativeUploadLimitProgressAtMeasuringRestart;
-    qint64 _currentUploadLimit;
-
-    QLinkedList<GETFileJob *> _downloadJobList;
-    QTimer _relativeDownloadMeasuringTimer;
-
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeDownloadDelayTimer;
-
-    // the device measured
-    GETFileJob *_relativeLimitCurrentMeasuredJob;
+    QTimer _refillTimer;
+    QElapsedTimer _sinceRefill;
 
-    // for measuring how much progress we made at start
-    qint64 _relativeDownloadLimitProgressAtMeasuringRestart;
+    // Alternates between measuring the unlimited throughput and limiting
+    // for relative limits
+    QTimer _relativeLimitTimer;
+    bool _relativeMeasuring;
 
-    qint64 _currentDownloadLimit;
+    Bucket<UploadDevice> _upload;
+    Bucket<GETFileJob> _download;
 };
 }
 
@@ -127,6 +127,34 @@ bool Capabilities::chunkingNg() const
     return _capabilities["dav"].toMap()["chunking"].toByteArray() >= "1.0";
 }
 
+bool Capabilities::bulkUpload() const
+{
+    static const auto bulkupload = qgetenv("OWNCLOUD_BULK_UPLOAD");
+    if (bulkupload == "0")
+        return false;
+    if (bulkupload == "1")
+        return true;
+    return _capabilities["dav"].toMap()["bulkupload"].toByteArray() >= "1.0";
+}
+
+bool Capabilities::deltaSync() const
+{
+    static const auto deltasync = qgetenv("OWNCLOUD_DELTA_SYNC");
+    if (deltasync == "0")
+        return false;
+    if (deltasync == "1")
+        return true;
+    return _capabilities["dav"].toMap()["deltasync"].toByteArray() >= "1.0";
+}
+
+QString Capabilities::pushNotificationsPath() const
+{
+    static const auto push = qgetenv("OWNCLOUD_PUSH_NOTIFICATIONS");
+    if (push == "0")
+        return QString();
+    return _capabilities["notify"].toMap()["longpoll"].toString();
+}
+
 bool Capabilities::chunkingParallelUploadDisabled() const
 {
     return _capabilities["dav"].toMap()["chunkingParallelUploadDisabled"].toBool();
@@ -47,6 +47,37 @@ public:
     /// disable parallel upload in chunking
     bool chunkingParallelUploadDisabled() const;
 
+    /**
+     * Whether small files can be uploaded in batches with a single
+     * multipart request to remote.php/dav/bulk, see BulkUploadJob.
+     *
+     * Path: dav/bulkupload
+     * Default: empty, meaning no bulk upload
+     * Can be overridden with the OWNCLOUD_BULK_UPLOAD environment variable.
+     */
+    bool bulkUpload() const;
+
+    /**
+     * Whether the server can assemble a chunked upload from the uploaded
+     * chunks plus the unchanged parts of the previous version, see the
+     * OC-Delta-Base header in PropagateUploadFileNG.
+     *
+     * Path: dav/deltasync
+     * Default: empty, meaning no delta sync
+     * Can be overridden with the OWNCLOUD_DELTA_SYNC environment variable.
+     */
+    bool deltaSync() const;
+
+    /**
+     * The path of the long-poll endpoint that announces remote changes,
+     * relative to the account url, see PushNotifications.
+     *
+     * Path: notify/longpoll
+     * Default: empty, meaning the folders are polled for etag changes
+     * Can be disabled with OWNCLOUD_PUSH_NOTIFICATIONS=0.
+     */
+    QString pushNotificationsPath() const;
+
     /// Whether the "privatelink" DAV property is available
     bool privateLinkPropertyAvailable() const;
 
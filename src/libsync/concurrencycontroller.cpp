@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "concurrencycontroller.h"
+
+#include <QLoggingCategory>
+#include <qmath.h>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcConcurrency, "sync.propagator.concurrency", QtInfoMsg)
+
+// A period lasts at least this many jobs, so that small windows still get
+// a somewhat meaningful measurement.
+static const int minimumPeriodJobs = 4;
+
+// The throughput has to improve by at least 5% to count as improvement.
+static const double improvementFactor = 1.05;
+
+// Small requests taking twice as long as the best seen average (and at least
+// latencySlackMsec more) means requests are queueing up somewhere.
+static const double latencyInflationFactor = 2.0;
+static const double latencySlackMsec = 50.0;
+
+// After this many periods without change, probe a larger window again.
+static const int probeAfterHoldPeriods = 8;
+
+int FixedConcurrencyController::maximumActiveTransferJob(int hardMaximum)
+{
+    return qMin(3, qCeil(hardMaximum / 2.));
+}
+
+AdaptiveConcurrencyController::AdaptiveConcurrencyController(int initialWindow)
+    : _window(qMax(1, initialWindow))
+    , _hardMaximum(_window)
+    , _lastAction(Hold)
+    , _holdPeriods(0)
+    , _finishedSinceDecrease(0)
+    , _errorGraceJobs(0)
+    , _periodStartMsec(-1)
+    , _periodJobs(0)
+    , _periodBytes(0)
+    , _periodQuickJobs(0)
+    , _periodQuickMsec(0)
+    , _lastItemRate(0)
+    , _lastByteRate(0)
+    , _minLatencyMsec(0)
+{
+}
+
+int AdaptiveConcurrencyController::maximumActiveTransferJob(int hardMaximum)
+{
+    _hardMaximum = qMax(1, hardMaximum);
+    return qBound(1, _window, _hardMaximum);
+}
+
+void AdaptiveConcurrencyController::jobFinished(const Sample &sample)
+{
+    const qint64 now = sample._finishedAtMsec;
+    if (_periodStartMsec < 0) {
+        startPeriod(now - sample._durationMsec);
+    }
+
+    ++_finishedSinceDecrease;
+
+    if (sample._httpErrorCode == 429 || sample._httpErrorCode == 503) {
+        // Jobs that were started before the last decrease may still fail,
+        // don't punish the reduced window for them.
+        if (_finishedSinceDecrease > _errorGraceJobs) {
+            _errorGraceJobs = qBound(1, _window, _hardMaximum);
+            _finishedSinceDecrease = 0;
+            setWindow(qMax(1, _window / 2), Decrease, "server asked to slow down");
+
+            // Start over with the measurements: additive increase resumes from here.
+            _lastItemRate = 0;
+            _lastByteRate = 0;
+            startPeriod(now);
+        }
+        return;
+    }
+
+    ++_periodJobs;
+    _periodBytes += sample._bytes;
+    if (sample._likelyFinishedQuickly && sample._httpErrorCode == 0) {
+        ++_periodQuickJobs;
+        _periodQuickMsec += sample._durationMsec;
+    }
+
+    if (_periodJobs >= qMax(2 * _window, minimumPeriodJobs)) {
+        endPeriod(now);
+    }
+}
+
+void AdaptiveConcurrencyController::syncStarted()
+{
+    // The previous sync's period and rates would be compared against
+    // timestamps of a different clock, and include the idle time in between.
+    _periodStartMsec = -1;
+    _lastItemRate = 0;
+    _lastByteRate = 0;
+    _lastAction = Hold;
+    _holdPeriods = 0;
+    _finishedSinceDecrease = 0;
+    _errorGraceJobs = 0;
+}
+
+void AdaptiveConcurrencyController::startPeriod(qint64 now)
+{
+    _periodStartMsec = now;
+    _periodJobs = 0;
+    _periodBytes = 0;
+    _periodQuickJobs = 0;
+    _periodQuickMsec = 0;
+}
+
+void AdaptiveConcurrencyController::endPeriod(qint64 now)
+{
+    const double elapsedMsec = qMax(qint64(1), now - _periodStartMsec);
+    const double itemRate = _periodJobs * 1000.0 / elapsedMsec;
+    const double byteRate = _periodBytes * 1000.0 / elapsedMsec;
+
+    const bool improved = itemRate > _lastItemRate * improvementFactor
+        || byteRate > _lastByteRate * improvementFactor;
+
+    bool latencyInflated = false;
+    if (_periodQuickJobs > 0) {
+        const double latency = double(_periodQuickMsec) / _periodQuickJobs;
+        if (_minLatencyMsec <= 0 || latency < _minLatencyMsec) {
+            _minLatencyMsec = latency;
+        }
+        latencyInflated = latency > _minLatencyMsec * latencyInflationFactor
+            && latency - _minLatencyMsec > latencySlackMsec;
+    }
+
+    qCDebug(lcConcurrency) << "Period of" << _periodJobs << "jobs:" << itemRate << "items/s"
+                           << byteRate << "bytes/s, previously" << _lastItemRate << "items/s"
+                           << _lastByteRate << "bytes/s, window" << _window;
+
+    // When stepping back, the next period should be compared to what the
+    // smaller window achieved before, not to this bad period.
+    bool keepReference = false;
+
+    if (improved && !latencyInflated) {
+        if (_window < _hardMaximum) {
+            setWindow(_window + 1, Increase, "throughput improved");
+        } else {
+            setWindow(_window, Hold, nullptr);
+        }
+    } else if (improved) {
+        setWindow(_window, Hold, nullptr);
+    } else if (_lastAction == Increase || latencyInflated) {
+        setWindow(qMax(1, _window - 1), Decrease,
+            latencyInflated ? "request latency inflated" : "last increase did not pay off");
+        keepReference = _lastItemRate > 0 || _lastByteRate > 0;
+    } else if (++_holdPeriods >= probeAfterHoldPeriods && _window < _hardMaximum) {
+        setWindow(_window + 1, Increase, "probing");
+    }
+
+    if (!keepReference) {
+        _lastItemRate = itemRate;
+        _lastByteRate = byteRate;
+    }
+    startPeriod(now);
+}
+
+void AdaptiveConcurrencyController::setWindow(int window, Action action, const char *reason)
+{
+    if (window != _window) {
+        qCInfo(lcConcurrency) << "Changing transfer parallelism from" << _window << "to" << window
+                              << "because" << reason;
+    }
+    _window = window;
+    _lastAction = action;
+    _holdPeriods = 0;
+}
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QtGlobal>
+
+namespace OCC {
+
+/**
+ * @brief Decides how many transfer jobs the propagator runs in parallel
+ *
+ * The propagator asks the controller for its transfer parallelism whenever
+ * it schedules jobs and reports every finished network job back to it.
+ *
+ * Controllers can be shared between several syncs of the same folder
+ * (see SyncOptions::_concurrencyController) so that whatever they learned
+ * about the server carries over.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ConcurrencyController
+{
+public:
+    /** What the propagator knows about a finished job */
+    struct Sample
+    {
+        Sample()
+            : _bytes(0)
+            , _durationMsec(0)
+            , _finishedAtMsec(0)
+            , _httpErrorCode(0)
+            , _likelyFinishedQuickly(false)
+        {
+        }
+
+        /// Payload bytes that were transferred, 0 for metadata-only jobs
+        qint64 _bytes;
+        /// Time between the job being scheduled and it being done
+        qint64 _durationMsec;
+        /// Monotonic timestamp of the job completion
+        qint64 _finishedAtMsec;
+        /// The http error code of a failed job, 0 otherwise
+        int _httpErrorCode;
+        /// Whether the job was a small one, used to track request latency
+        bool _likelyFinishedQuickly;
+    };
+
+    virtual ~ConcurrencyController() {}
+
+    /** Called by the propagator before it starts a new sync.
+     *
+     * The timestamps of the samples are only comparable within one sync.
+     */
+    virtual void syncStarted() {}
+
+    /** The number of transfer jobs that should be active in parallel.
+     *
+     * The result must be within [1, hardMaximum].
+     */
+    virtual int maximumActiveTransferJob(int hardMaximum) = 0;
+
+    /** Called by the propagator for every network job that finished. */
+    virtual void jobFinished(const Sample &sample) = 0;
+};
+
+/**
+ * @brief The static default: half of the hard maximum, but never more than 3
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT FixedConcurrencyController : public ConcurrencyController
+{
+public:
+    int maximumActiveTransferJob(int hardMaximum) Q_DECL_OVERRIDE;
+    void jobFinished(const Sample &) Q_DECL_OVERRIDE {}
+};
+
+/**
+ * @brief Adjusts the transfer parallelism with additive increase / multiplicative decrease
+ *
+ * Finished jobs are grouped into measuring periods of roughly two rounds of
+ * the current window. At the end of each period the aggregate throughput
+ * (finished items per second and bytes per second) is compared to the
+ * previous period:
+ *
+ *  - If it improved, the window grows by one.
+ *  - If the last increase did not pay off, or the latency of small requests
+ *    inflated, the increase is undone.
+ *  - Otherwise the window is kept, but a larger window is probed again
+ *    every few periods, since network conditions change.
+ *
+ * A 429 (Too Many Requests) or 503 (Service Unavailable) answer halves the
+ * window immediately. Further errors are ignored until the reduced window
+ * had a chance to take effect.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT AdaptiveConcurrencyController : public ConcurrencyController
+{
+public:
+    explicit AdaptiveConcurrencyController(int initialWindow = 3);
+
+    int maximumActiveTransferJob(int hardMaximum) Q_DECL_OVERRIDE;
+    void jobFinished(const Sample &sample) Q_DECL_OVERRIDE;
+    /** Keeps the window, but measures the throughput from scratch */
+    void syncStarted() Q_DECL_OVERRIDE;
+
+    /** The current window, not yet bounded by the hard maximum */
+    int window() const { return _window; }
+
+private:
+    enum Action {
+        Hold,
+        Increase,
+        Decrease
+    };
+
+    void startPeriod(qint64 now);
+    void endPeriod(qint64 now);
+    void setWindow(int window, Action action, const char *reason);
+
+    int _window;
+    int _hardMaximum;
+    Action _lastAction;
+    int _holdPeriods;
+
+    // Jobs that finished since the last multiplicative decrease, and how
+    // many of them may still have been started with the old window
+    int _finishedSinceDecrease;
+    int _errorGraceJobs;
+
+    // The current measuring period
+    qint64 _periodStartMsec;
+    int _periodJobs;
+    qint64 _periodBytes;
+    int _periodQuickJobs;
+    qint64 _periodQuickMsec;
+
+    // Results of the previous period
+    double _lastItemRate;
+    double _lastByteRate;
+
+    // Lowest average latency of small jobs seen in any period
+    double _minLatencyMsec;
+};
+}
@@ -58,6 +58,9 @@ static const char chunkSizeC[] = "chunkSize";
 static const char minChunkSizeC[] = "minChunkSize";
 static const char maxChunkSizeC[] = "maxChunkSize";
 static const char targetChunkUploadDurationC[] = "targetChunkUploadDuration";
+static const char adaptiveParallelismC[] = "adaptiveParallelism";
+static const char maxHttpConnectionsC[] = "maxHttpConnections";
+static const char maxConcurrentSyncsC[] = "maxConcurrentSyncs";
 
 static const char proxyHostC[] = "Proxy/host";
 static const char proxyTypeC[] = "Proxy/type";
@@ -152,6 +155,24 @@ quint64 ConfigFile::targetChunkUploadDuration() const
     return settings.value(QLatin1String(targetChunkUploadDurationC), 60 * 1000).toLongLong(); // default to 1 minute
 }
 
+bool ConfigFile::adaptiveParallelism() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(adaptiveParallelismC), false).toBool();
+}
+
+int ConfigFile::maxHttpConnections() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(maxHttpConnectionsC), 6).toInt(); // what a single QNAM does
+}
+
+int ConfigFile::maxConcurrentSyncs() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(maxConcurrentSyncsC), 2).toInt();
+}
+
 void ConfigFile::setOptionalDesktopNotifications(bool show)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
@@ -121,6 +121,12 @@ public:
     quint64 maxChunkSize() const;
     quint64 minChunkSize() const;
     quint64 targetChunkUploadDuration() const;
+    /** Whether the transfer parallelism adapts to the measured throughput */
+    bool adaptiveParallelism() const;
+    /** The number of parallel connections to a server without HTTP/2 */
+    int maxHttpConnections() const;
+    /** The number of folders that may sync at the same time */
+    int maxConcurrentSyncs() const;
 
     void saveGeometry(QWidget *w);
     void restoreGeometry(QWidget *w);
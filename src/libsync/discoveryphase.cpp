@@ -31,34 +31,6 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcDiscovery, "sync.discovery", QtInfoMsg)
 
-/* Given a sorted list of paths ending with '/', return whether or not the given path is within one of the paths of the list*/
-static bool findPathInList(const QStringList &list, const QString &path)
-{
-    Q_ASSERT(std::is_sorted(list.begin(), list.end()));
-
-    if (list.size() == 1 && list.first() == QLatin1String("/")) {
-        // Special case for the case "/" is there, it matches everything
-        return true;
-    }
-
-    QString pathSlash = path + QLatin1Char('/');
-
-    // Since the list is sorted, we can do a binary search.
-    // If the path is a prefix of another item or right after in the lexical order.
-    auto it = std::lower_bound(list.begin(), list.end(), pathSlash);
-
-    if (it != list.end() && *it == pathSlash) {
-        return true;
-    }
-
-    if (it == list.begin()) {
-        return false;
-    }
-    --it;
-    Q_ASSERT(it->endsWith(QLatin1Char('/'))); // Folder::setSelectiveSyncBlackList makes sure of that
-    return pathSlash.startsWith(*it);
-}
-
 bool DiscoveryJob::isInSelectiveSyncBlackList(const QByteArray &path) const
 {
     if (_selectiveSyncBlackList.isEmpty()) {
@@ -67,7 +39,7 @@ bool DiscoveryJob::isInSelectiveSyncBlackList(const QByteArray &path) const
     }
 
     // Block if it is in the black list
-    if (findPathInList(_selectiveSyncBlackList, QString::fromUtf8(path))) {
+    if (_selectiveSyncBlackListSet.containsPrefixOf(path)) {
         return true;
     }
 
@@ -75,7 +47,7 @@ bool DiscoveryJob::isInSelectiveSyncBlackList(const QByteArray &path) const
     if (csync_rename_count(_csync_ctx)) {
         QByteArray adjusted = csync_rename_adjust_path_source(_csync_ctx, path);
         if (adjusted != path) {
-            return findPathInList(_selectiveSyncBlackList, QString::fromUtf8(adjusted));
+            return _selectiveSyncBlackListSet.containsPrefixOf(adjusted);
         }
     }
 
@@ -98,7 +70,7 @@ bool DiscoveryJob::checkSelectiveSyncNewFolder(const QString &path, RemotePermis
 
         // Only allow it if the white list contains exactly this path (not parents)
         // We want to ask confirmation for external storage even if the parents where selected
-        if (_selectiveSyncWhiteList.contains(path + QLatin1Char('/'))) {
+        if (_selectiveSyncWhiteListSet.contains(path)) {
             return false;
         }
 
@@ -107,7 +79,7 @@ bool DiscoveryJob::checkSelectiveSyncNewFolder(const QString &path, RemotePermis
     }
 
     // If this path or the parent is in the white list, then we do not block this file
-    if (findPathInList(_selectiveSyncWhiteList, path)) {
+    if (_selectiveSyncWhiteListSet.containsPrefixOf(path)) {
         return false;
     }
 
@@ -133,13 +105,7 @@ bool DiscoveryJob::checkSelectiveSyncNewFolder(const QString &path, RemotePermis
     } else {
         // it is not too big, put it in the white list (so we will not do more query for the children)
         // and and do not block.
-        auto p = path;
-        if (!p.endsWith(QLatin1Char('/'))) {
-            p += QLatin1Char('/');
-        }
-        _selectiveSyncWhiteList.insert(std::upper_bound(_selectiveSyncWhiteList.begin(),
-                                           _selectiveSyncWhiteList.end(), p),
-            p);
+        _selectiveSyncWhiteListSet.insert(path);
 
         return false;
     }
@@ -706,8 +672,8 @@ void DiscoveryJob::remote_vio_closedir_hook(csync_vio_handle_t *dhandle, void *u
 
 void DiscoveryJob::start()
 {
-    _selectiveSyncBlackList.sort();
-    _selectiveSyncWhiteList.sort();
+    _selectiveSyncBlackListSet = PathPrefixSet(_selectiveSyncBlackList);
+    _selectiveSyncWhiteListSet = PathPrefixSet(_selectiveSyncWhiteList);
     _csync_ctx->callbacks.update_callback_userdata = this;
     _csync_ctx->callbacks.update_callback = update_job_update_callback;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = isInSelectiveSyncBlackListCallback;
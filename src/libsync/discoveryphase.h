@@ -20,6 +20,8 @@
 #include <csync.h>
 #include <QMap>
 #include "networkjobs.h"
+#include "concurrencycontroller.h"
+#include "pathprefixset.h"
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
@@ -44,7 +46,9 @@ struct SyncOptions
         , _minChunkSize(1 * 1000 * 1000) // 1 MB
         , _maxChunkSize(100 * 1000 * 1000) // 100 MB
         , _targetChunkUploadDuration(60 * 1000) // 1 minute
+        , _deltaSyncMinFileSize(100 * 1000 * 1000) // 100 MB
         , _parallelNetworkJobs(true)
+        , _syncDownloadsToDisk(false)
     {
     }
 
@@ -76,8 +80,31 @@ struct SyncOptions
      */
     quint64 _targetChunkUploadDuration;
 
+    /** Files of at least this size (in bytes) are uploaded with delta sync if
+     * the server supports it.
+     *
+     * Only the blocks of _initialChunkSize bytes that changed since the last
+     * upload are sent, see PropagateUploadFileNG.
+     */
+    quint64 _deltaSyncMinFileSize;
+
     /** Whether parallel network jobs are allowed. */
     bool _parallelNetworkJobs;
+
+    /** Whether downloaded files are flushed to the disk (fsync) before they
+     * replace the local file.
+     *
+     * Slower, but the new file content survives a power loss right after
+     * the sync.
+     */
+    bool _syncDownloadsToDisk;
+
+    /** Decides how many transfers run in parallel.
+     *
+     * If null, the propagator uses a FixedConcurrencyController. The same
+     * controller may be passed to several syncs so it keeps what it learned.
+     */
+    QSharedPointer<ConcurrencyController> _concurrencyController;
 };
 
 
@@ -230,6 +257,10 @@ class DiscoveryJob : public QObject
     QMutex _vioMutex;
     QWaitCondition _vioWaitCondition;
 
+    // Built from the lists below when the job starts
+    PathPrefixSet _selectiveSyncBlackListSet;
+    PathPrefixSet _selectiveSyncWhiteListSet;
+
 
 public:
     explicit DiscoveryJob(CSYNC *ctx, QObject *parent = 0)
@@ -18,6 +18,18 @@
 #include <QFile>
 #include <QFileInfo>
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#endif
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+#ifdef Q_OS_WIN
+#include <io.h>
+#endif
+
 // We use some internals of csync:
 extern "C" int c_utimes(const char *, const struct timeval *);
 
@@ -139,5 +151,36 @@ qint64 FileSystem::getSize(const QString &filename)
     return QFileInfo(filename).size();
 }
 
+bool FileSystem::reserveFileSpace(QFile &file, qint64 size)
+{
+#ifdef Q_OS_LINUX
+    if (size <= 0 || file.handle() == -1) {
+        return false;
+    }
+    // FALLOC_FL_KEEP_SIZE: unlike posix_fallocate() this doesn't change the file size
+    if (fallocate(file.handle(), FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+        qCDebug(lcFileSystem) << "Could not reserve" << size << "bytes for" << file.fileName() << strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+bool FileSystem::syncFileToDisk(QFile &file)
+{
+    if (!file.flush() || file.handle() == -1) {
+        return false;
+    }
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
 
 } // namespace OCC
@@ -77,6 +77,22 @@ namespace FileSystem {
     bool verifyFileUnchanged(const QString &fileName,
         qint64 previousSize,
         time_t previousMtime);
+
+    /**
+ * @brief Reserves disk space for the first \a size bytes of the open \a file
+ *
+ * The file size does not change, so the file can still be appended to and
+ * its size tells how much was written. Avoids fragmentation of files that
+ * are written in many small pieces.
+ *
+ * Only supported on Linux, does nothing elsewhere.
+ */
+    bool OWNCLOUDSYNC_EXPORT reserveFileSpace(QFile &file, qint64 size);
+
+    /**
+ * @brief Flushes the data of the open \a file to the disk (fsync)
+ */
+    bool OWNCLOUDSYNC_EXPORT syncFileToDisk(QFile &file);
 }
 
 /** @} */
@@ -39,7 +39,6 @@
 #include <QTimer>
 #include <QObject>
 #include <QTimerEvent>
-#include <qmath.h>
 
 namespace OCC {
 
@@ -47,6 +46,9 @@ Q_LOGGING_CATEGORY(lcPropagator, "sync.propagator", QtInfoMsg)
 Q_LOGGING_CATEGORY(lcDirectory, "sync.propagator.directory", QtInfoMsg)
 Q_LOGGING_CATEGORY(lcCleanupPolls, "sync.propagator.cleanuppolls", QtInfoMsg)
 
+// A less important task queue gets its turn after being passed over this often
+static const int maxTaskSkips = 8;
+
 qint64 criticalFreeSpaceLimit()
 {
     qint64 value = 50 * 1000 * 1000LL;
@@ -80,13 +82,12 @@ OwncloudPropagator::~OwncloudPropagator()
 
 int OwncloudPropagator::maximumActiveTransferJob()
 {
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0
-        || _uploadLimit.fetchAndAddAcquire(0) != 0
-        || !_syncOptions._parallelNetworkJobs) {
-        // disable parallelism when there is a network limit.
+    // Network limits don't affect the parallelism: the BandwidthManager
+    // limits the sum of all transfers.
+    if (!_syncOptions._parallelNetworkJobs) {
         return 1;
     }
-    return qMin(3, qCeil(hardMaximumActiveJob() / 2.));
+    return _concurrencyController->maximumActiveTransferJob(hardMaximumActiveJob());
 }
 
 /* The maximum number of active jobs in parallel  */
@@ -97,9 +98,10 @@ int OwncloudPropagator::hardMaximumActiveJob()
     static int max = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
     if (max)
         return max;
-    if (_account->isHttp2Supported())
-        return 20;
-    return 6; // (Qt cannot do more anyway)
+    // A QNAM cannot do more than 6 without HTTP/2, the account pools several for more
+    const int connections = _account->isHttp2Supported() ? 20 : _account->maxHttpConnections();
+    // The syncs running in parallel on this account share them
+    return qMax(1, connections / _account->runningSyncCount());
 }
 
 PropagateItemJob::~PropagateItemJob()
@@ -277,6 +279,9 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
         qCWarning(lcPropagator) << "Could not complete propagation of" << _item->destination() << "by" << this << "with status" << _item->_status << "and error:" << _item->_errorString;
     else
         qCInfo(lcPropagator) << "Completed propagation of" << _item->destination() << "by" << this << "with status" << _item->_status;
+    if (_jobTimer.isValid()) {
+        propagator()->reportJobFinished(*_item, _jobTimer.elapsed());
+    }
     emit propagator()->itemCompleted(_item);
     emit finished(_item->_status);
 
@@ -391,6 +396,11 @@ PropagateItemJob *OwncloudPropagator::createJob(const SyncFileItemPtr &item)
             if (item->_size > syncOptions()._initialChunkSize && account()->capabilities().chunkingNg()) {
                 // Item is above _initialChunkSize, thus will be classified as to be chunked
                 job = new PropagateUploadFileNG(this, item);
+            } else if (item->_size < smallFileSize() && account()->capabilities().bulkUpload()
+                && _uploadLimit.fetchAndAddAcquire(0) == 0) {
+                // Small files are batched. The batches don't go through the
+                // bandwidth manager, so not when there is an upload limit.
+                job = new PropagateUploadFileBulk(this, item);
             } else {
                 job = new PropagateUploadFileV1(this, item);
             }
@@ -422,6 +432,8 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
 {
     Q_ASSERT(std::is_sorted(items.begin(), items.end()));
 
+    _concurrencyController->syncStarted();
+
     /* This builds all the jobs needed for the propagation.
      * Each directory is a PropagateDirectory job, which contains the files in it.
      * In order to do that we loop over the items. (which are sorted by destination)
@@ -526,6 +538,14 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
     scheduleNextJob();
 }
 
+BulkUploadQueue *OwncloudPropagator::bulkUploadQueue()
+{
+    if (!_bulkUploadQueue) {
+        _bulkUploadQueue = new BulkUploadQueue(this);
+    }
+    return _bulkUploadQueue;
+}
+
 const SyncOptions &OwncloudPropagator::syncOptions() const
 {
     return _syncOptions;
@@ -535,6 +555,11 @@ void OwncloudPropagator::setSyncOptions(const SyncOptions &syncOptions)
 {
     _syncOptions = syncOptions;
     _chunkSize = syncOptions._initialChunkSize;
+    if (syncOptions._concurrencyController) {
+        _concurrencyController = syncOptions._concurrencyController;
+    } else {
+        _concurrencyController.reset(new FixedConcurrencyController);
+    }
 }
 
 // ownCloud server  < 7.0 did not had permissions so we need some other euristics
@@ -665,14 +690,15 @@ void OwncloudPropagator::scheduleNextJobImpl()
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
     if (_activeJobList.count() < maximumActiveTransferJob()) {
-        if (_rootJob->scheduleSelfOrChild()) {
+        if ((hasPriorityPaths() && _rootJob->schedulePriorityTask())
+            || _rootJob->scheduleSelfOrChild()) {
             scheduleNextJob();
         }
     } else if (_activeJobList.count() < hardMaximumActiveJob()) {
         int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
+        // NOTE: Only counts the first maximumActiveTransferJob() jobs! Then for each
         // one that is likely finished quickly, we can launch another one.
-        // When a job finishes another one will "move up" to be one of the first 3 and then
+        // When a job finishes another one will "move up" to be one of the first ones and then
         // be counted too.
         for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
             if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
@@ -684,6 +710,11 @@ void OwncloudPropagator::scheduleNextJobImpl()
             if (_rootJob->scheduleSelfOrChild()) {
                 scheduleNextJob();
             }
+        } else if (_rootJob->scheduleDirectoryCreation()) {
+            // The transfer slots are taken, but creating a directory is cheap
+            // and lets the jobs below it start as soon as a slot frees up.
+            qCDebug(lcPropagator) << "Started a directory creation while transfers are busy, activeJobs =" << _activeJobList.count();
+            scheduleNextJob();
         }
     }
 }
@@ -693,6 +724,55 @@ void OwncloudPropagator::reportProgress(const SyncFileItem &item, quint64 bytes)
     emit progress(item, bytes);
 }
 
+// Whether the file content went over the network to propagate this item
+static bool isTransfer(const SyncFileItem &item)
+{
+    if (item.isDirectory()) {
+        return false;
+    }
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_CONFLICT:
+    case CSYNC_INSTRUCTION_TYPE_CHANGE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+OwncloudPropagator::TaskPriority OwncloudPropagator::taskPriority(const SyncFileItem &item)
+{
+    if (_priorityPaths.contains(item._file) || _priorityPaths.contains(item.destination())) {
+        return UserPriority;
+    }
+    if (!isTransfer(item)) {
+        return MetadataPriority;
+    }
+    return item._size < smallFileSize() ? SmallTransferPriority : LargeTransferPriority;
+}
+
+void OwncloudPropagator::reportJobFinished(const SyncFileItem &item, qint64 durationMsec)
+{
+    // Local operations (mkdir, remove, rename) tell nothing about the server.
+    // Everything that goes up talks to the server, downwards only the transfers do.
+    if (item._instruction == CSYNC_INSTRUCTION_IGNORE || item._instruction == CSYNC_INSTRUCTION_ERROR
+        || (item._direction != SyncFileItem::Up && !isTransfer(item))) {
+        return;
+    }
+
+    ConcurrencyController::Sample sample;
+    sample._durationMsec = durationMsec;
+    sample._finishedAtMsec = _propagationTimer.elapsed();
+    // Successful jobs store their 2xx status code there too
+    sample._httpErrorCode = item._httpErrorCode >= 400 ? item._httpErrorCode : 0;
+    sample._likelyFinishedQuickly = !isTransfer(item) || item._size < smallFileSize();
+    if (isTransfer(item) && (item._status == SyncFileItem::Success || item._status == SyncFileItem::Conflict)) {
+        sample._bytes = item._size;
+    }
+    _concurrencyController->jobFinished(sample);
+}
+
 AccountPtr OwncloudPropagator::account() const
 {
     return _account;
@@ -777,22 +857,15 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
         _runningJobs.append(nextJob);
         return possiblyRunNextJob(nextJob);
     }
-    while (!_tasksToDo.isEmpty()) {
-        SyncFileItemPtr nextTask = _tasksToDo.first();
-        _tasksToDo.remove(0);
-        PropagatorJob *job = propagator()->createJob(nextTask);
-        if (!job) {
-            qCWarning(lcDirectory) << "Useless task found for file" << nextTask->destination() << "instruction" << nextTask->_instruction;
-            continue;
+    while (hasTasksToDo()) {
+        if (startTask(takeNextTask())) {
+            return true;
         }
-
-        _runningJobs.append(job);
-        return possiblyRunNextJob(job);
     }
 
     // If neither us or our children had stuff left to do we could hang. Make sure
     // we mark this job as finished so that the propagator can schedule a new one.
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && !hasTasksToDo() && _runningJobs.isEmpty()) {
         // Our parent jobs are already iterating over their running jobs, post to the event loop
         // to avoid removing ourself from that list while they iterate.
         QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
@@ -800,6 +873,132 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
     return false;
 }
 
+bool PropagatorCompositeJob::scheduleDirectoryCreation()
+{
+    if (_state == Finished) {
+        return false;
+    }
+
+    if (_state == NotYetStarted) {
+        _state = Running;
+    }
+
+    // Same order and blocking rules as in scheduleSelfOrChild()
+    for (int i = 0; i < _runningJobs.size(); ++i) {
+        if (_runningJobs.at(i)->scheduleDirectoryCreation()) {
+            return true;
+        }
+        if (_runningJobs.at(i)->parallelism() == WaitForFinished) {
+            return false;
+        }
+    }
+
+    // Pending directories are started in order, as long as they are new on the
+    // server or have no job of their own. Anything else, like the removed
+    // directories at the end of the root job, stops the early start.
+    while (!_jobsToDo.isEmpty()) {
+        auto nextDir = qobject_cast<PropagateDirectory *>(_jobsToDo.first());
+        if (!nextDir || (nextDir->_firstJob && !nextDir->createsRemoteDirectory())) {
+            break;
+        }
+        _jobsToDo.remove(0);
+        _runningJobs.append(nextDir);
+        connect(nextDir, &PropagatorJob::finished, this, &PropagatorCompositeJob::slotSubJobFinished);
+        if (nextDir->scheduleDirectoryCreation()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PropagatorCompositeJob::schedulePriorityTask()
+{
+    if (_state != Running) {
+        return false;
+    }
+
+    for (int i = 0; i < _runningJobs.size(); ++i) {
+        if (_runningJobs.at(i)->schedulePriorityTask()) {
+            return true;
+        }
+        if (_runningJobs.at(i)->parallelism() == WaitForFinished) {
+            return false;
+        }
+    }
+
+    // Our own tasks don't depend on anything but the running sub jobs
+    while (hasTasksToDo() && !_tasksToDo.at(OwncloudPropagator::UserPriority).isEmpty()) {
+        if (startTask(takeNextTask())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PropagatorCompositeJob::appendTask(const SyncFileItemPtr &item)
+{
+    if (_tasksToDo.isEmpty()) {
+        _tasksToDo.resize(OwncloudPropagator::TaskPriorityCount);
+        _tasksToDoSkips.resize(OwncloudPropagator::TaskPriorityCount);
+    }
+    _tasksToDo[propagator()->taskPriority(*item)].enqueue(item);
+}
+
+bool PropagatorCompositeJob::hasTasksToDo() const
+{
+    foreach (const auto &queue, _tasksToDo) {
+        if (!queue.isEmpty())
+            return true;
+    }
+    return false;
+}
+
+SyncFileItemPtr PropagatorCompositeJob::takeNextTask()
+{
+    int next = -1;
+    bool aged = false;
+    for (int i = 0; i < _tasksToDo.size(); ++i) {
+        if (_tasksToDo.at(i).isEmpty())
+            continue;
+        if (next < 0) {
+            next = i;
+            // The user is waiting for these, they don't take turns
+            if (next == OwncloudPropagator::UserPriority)
+                break;
+        } else if (_tasksToDoSkips.at(i) >= maxTaskSkips) {
+            next = i;
+            aged = true;
+            break;
+        }
+    }
+    if (next < 0)
+        return SyncFileItemPtr();
+
+    // The less important queues that were passed over age
+    _tasksToDoSkips[next] = 0;
+    for (int i = next + 1; i < _tasksToDo.size(); ++i) {
+        if (!_tasksToDo.at(i).isEmpty())
+            ++_tasksToDoSkips[i];
+    }
+
+    SyncFileItemPtr task = _tasksToDo[next].dequeue();
+    qCDebug(lcDirectory) << "Scheduling" << task->destination() << "with priority" << next
+                         << (aged ? "after being passed over" : "");
+    return task;
+}
+
+bool PropagatorCompositeJob::startTask(const SyncFileItemPtr &task)
+{
+    PropagatorJob *job = propagator()->createJob(task);
+    if (!job) {
+        qCWarning(lcDirectory) << "Useless task found for file" << task->destination() << "instruction" << task->_instruction;
+        return false;
+    }
+
+    _runningJobs.append(job);
+    return possiblyRunNextJob(job);
+}
+
 void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
 {
     PropagatorJob *subJob = static_cast<PropagatorJob *>(sender());
@@ -818,7 +1017,7 @@ void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
         _hasError = status;
     }
 
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && !hasTasksToDo() && _runningJobs.isEmpty()) {
         finalize();
     } else {
         propagator()->scheduleNextJob();
@@ -894,6 +1093,40 @@ bool PropagateDirectory::scheduleSelfOrChild()
     return _subJobs.scheduleSelfOrChild();
 }
 
+bool PropagateDirectory::scheduleDirectoryCreation()
+{
+    if (_state == NotYetStarted) {
+        if (createsRemoteDirectory()) {
+            return scheduleSelfOrChild();
+        }
+        if (_firstJob) {
+            return false;
+        }
+        // Nothing of our own to do, but there may be new directories below
+        _state = Running;
+    }
+
+    // The children have to wait for our own first job
+    if (_state != Running || _firstJob) {
+        return false;
+    }
+
+    return _subJobs.scheduleDirectoryCreation();
+}
+
+bool PropagateDirectory::schedulePriorityTask()
+{
+    if (_state != Running || _firstJob) {
+        return false;
+    }
+    return _subJobs.schedulePriorityTask();
+}
+
+bool PropagateDirectory::createsRemoteDirectory() const
+{
+    return _firstJob && qobject_cast<PropagateRemoteMkdir *>(_firstJob.data());
+}
+
 void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
 {
     _firstJob.take()->deleteLater();
@@ -24,11 +24,14 @@
 #include <QPointer>
 #include <QIODevice>
 #include <QMutex>
+#include <QQueue>
+#include <QSet>
 
 #include "csync_util.h"
 #include "syncfileitem.h"
 #include "common/syncjournaldb.h"
 #include "bandwidthmanager.h"
+#include "concurrencycontroller.h"
 #include "accountfwd.h"
 #include "discoveryphase.h"
 
@@ -49,6 +52,7 @@ qint64 freeSpaceLimit();
 
 class SyncJournalDb;
 class OwncloudPropagator;
+class BulkUploadQueue;
 
 /**
  * @brief the base class of propagator jobs
@@ -104,6 +108,21 @@ public slots:
      * returns true if a job was started.
      */
     virtual bool scheduleSelfOrChild() = 0;
+
+    /** Starts the creation of a new remote directory somewhere below this job
+     * returns true if a job was started.
+     *
+     * Unlike scheduleSelfOrChild() this only starts directory creations, which
+     * are cheap and unblock everything below the new directory.
+     */
+    virtual bool scheduleDirectoryCreation() { return false; }
+
+    /** Starts a task for one of the OwncloudPropagator::setPriorityPaths() files
+     * returns true if a job was started.
+     *
+     * Tasks in directories that were not started yet are not considered.
+     */
+    virtual bool schedulePriorityTask() { return false; }
 signals:
     /**
      * Emitted when the job is fully finished
@@ -145,6 +164,7 @@ protected slots:
 
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
+    QElapsedTimer _jobTimer; // started when the job is scheduled
 
 public:
     PropagateItemJob(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
@@ -163,6 +183,7 @@ public:
         qCInfo(lcPropagator) << "Starting" << instruction_str << "propagation of" << _item->_file << "by" << this;
 
         _state = Running;
+        _jobTimer.start();
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
         return true;
     }
@@ -175,6 +196,10 @@ public slots:
 
 /**
  * @brief Job that runs subjobs. It becomes finished only when all subjobs are finished.
+ *
+ * The sub jobs (directories) are started in order. The tasks (files) don't
+ * depend on each other and are started by priority, see takeNextTask().
+ *
  * @ingroup libsync
  */
 class PropagatorCompositeJob : public PropagatorJob
@@ -182,7 +207,8 @@ class PropagatorCompositeJob : public PropagatorJob
     Q_OBJECT
 public:
     QVector<PropagatorJob *> _jobsToDo;
-    SyncFileItemVector _tasksToDo;
+    /// The tasks not started yet, one queue per OwncloudPropagator::TaskPriority
+    QVector<QQueue<SyncFileItemPtr>> _tasksToDo;
     QVector<PropagatorJob *> _runningJobs;
     SyncFileItem::Status _hasError; // NoStatus,  or NormalError / SoftError if there was an error
 
@@ -202,12 +228,12 @@ public:
     {
         _jobsToDo.append(job);
     }
-    void appendTask(const SyncFileItemPtr &item)
-    {
-        _tasksToDo.append(item);
-    }
+    void appendTask(const SyncFileItemPtr &item);
+    bool hasTasksToDo() const;
 
     virtual bool scheduleSelfOrChild() Q_DECL_OVERRIDE;
+    virtual bool scheduleDirectoryCreation() Q_DECL_OVERRIDE;
+    virtual bool schedulePriorityTask() Q_DECL_OVERRIDE;
     virtual JobParallelism parallelism() Q_DECL_OVERRIDE;
     virtual void abort() Q_DECL_OVERRIDE
     {
@@ -228,6 +254,20 @@ private slots:
 
     void slotSubJobFinished(SyncFileItem::Status status);
     void finalize();
+
+private:
+    /** Removes the task to start next from _tasksToDo
+     *
+     * That is the first task of the most important non-empty queue, unless
+     * a less important queue was passed over too often: then that one gets
+     * its turn, so large transfers are not starved.
+     */
+    SyncFileItemPtr takeNextTask();
+
+    /// Starts the given task, returns false if it turned out to be useless
+    bool startTask(const SyncFileItemPtr &task);
+
+    QVector<int> _tasksToDoSkips; // how often each queue was passed over
 };
 
 /**
@@ -257,6 +297,8 @@ public:
     }
 
     virtual bool scheduleSelfOrChild() Q_DECL_OVERRIDE;
+    virtual bool scheduleDirectoryCreation() Q_DECL_OVERRIDE;
+    virtual bool schedulePriorityTask() Q_DECL_OVERRIDE;
     virtual JobParallelism parallelism() Q_DECL_OVERRIDE;
     virtual void abort() Q_DECL_OVERRIDE
     {
@@ -265,6 +307,9 @@ public:
         _subJobs.abort();
     }
 
+    /// Whether the first job of this directory creates it on the server
+    bool createsRemoteDirectory() const;
+
     void increaseAffectedCount()
     {
         _firstJob->_item->_affectedItems++;
@@ -323,7 +368,10 @@ public:
         , _anotherSyncNeeded(false)
         , _chunkSize(10 * 1000 * 1000) // 10 MB, overridden in setSyncOptions
         , _account(account)
+        , _concurrencyController(new FixedConcurrencyController)
+        , _bulkUploadQueue(0)
     {
+        _propagationTimer.start();
     }
 
     ~OwncloudPropagator();
@@ -375,6 +423,27 @@ public:
     quint64 _chunkSize;
     quint64 smallFileSize();
 
+    /** Priority classes of the tasks in a directory, most important first */
+    enum TaskPriority {
+        UserPriority, // one of the priority paths
+        MetadataPriority, // no file content goes over the network
+        SmallTransferPriority,
+        LargeTransferPriority,
+        TaskPriorityCount
+    };
+    TaskPriority taskPriority(const SyncFileItem &item);
+
+    /** Files that the user is waiting for, like the ones recently changed
+     *
+     * Their tasks are started before all others. Paths are relative to
+     * the sync root. Must be set before start().
+     */
+    void setPriorityPaths(const QSet<QString> &paths) { _priorityPaths = paths; }
+    bool hasPriorityPaths() const { return !_priorityPaths.isEmpty(); }
+
+    /** Collects the uploads of small files into batches, created on first use */
+    BulkUploadQueue *bulkUploadQueue();
+
     /* The maximum number of active jobs in parallel  */
     int hardMaximumActiveJob();
 
@@ -402,6 +471,12 @@ public:
     void scheduleNextJob();
     void reportProgress(const SyncFileItem &, quint64 bytes);
 
+    /** Tells the concurrency controller about a finished item job.
+     *
+     * Jobs that did not talk to the server are ignored.
+     */
+    void reportJobFinished(const SyncFileItem &item, qint64 durationMsec);
+
     void abort()
     {
         _abortRequested.fetchAndStoreOrdered(true);
@@ -463,6 +538,10 @@ private:
     AccountPtr _account;
     QScopedPointer<PropagateDirectory> _rootJob;
     SyncOptions _syncOptions;
+    QSharedPointer<ConcurrencyController> _concurrencyController;
+    QElapsedTimer _propagationTimer;
+    BulkUploadQueue *_bulkUploadQueue;
+    QSet<QString> _priorityPaths;
 };
 
 
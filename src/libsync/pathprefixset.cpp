@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "pathprefixset.h"
+
+namespace OCC {
+
+PathPrefixSet::PathPrefixSet()
+    : _nodes(1)
+    , _size(0)
+{
+}
+
+PathPrefixSet::PathPrefixSet(const QStringList &paths)
+    : _nodes(1)
+    , _size(0)
+{
+    foreach (const QString &path, paths) {
+        insert(path);
+    }
+}
+
+void PathPrefixSet::insert(const QByteArray &path)
+{
+    int node = 0;
+    int start = 0;
+    while (start < path.size()) {
+        int end = path.indexOf('/', start);
+        if (end < 0)
+            end = path.size();
+        if (end > start) {
+            const QByteArray segment = path.mid(start, end - start);
+            int child = _nodes[node]._children.value(segment, -1);
+            if (child < 0) {
+                child = _nodes.size();
+                _nodes[node]._children.insert(segment, child);
+                _nodes.append(Node());
+            }
+            node = child;
+        }
+        start = end + 1;
+    }
+    if (!_nodes[node]._inSet) {
+        _nodes[node]._inSet = true;
+        ++_size;
+    }
+}
+
+int PathPrefixSet::find(const QByteArray &path, bool stopAtMember, bool *found) const
+{
+    int node = 0;
+    int start = 0;
+    while (start < path.size()) {
+        if (stopAtMember && _nodes[node]._inSet)
+            break;
+        int end = path.indexOf('/', start);
+        if (end < 0)
+            end = path.size();
+        if (end > start) {
+            // Avoid the copy of the segment when this node has no children anyway
+            const auto &children = _nodes[node]._children;
+            int child = children.isEmpty() ? -1 : children.value(QByteArray::fromRawData(path.constData() + start, end - start), -1);
+            if (child < 0) {
+                *found = false;
+                return node;
+            }
+            node = child;
+        }
+        start = end + 1;
+    }
+    *found = true;
+    return node;
+}
+
+bool PathPrefixSet::contains(const QByteArray &path) const
+{
+    if (isEmpty())
+        return false;
+    bool found = false;
+    int node = find(path, false, &found);
+    return found && _nodes[node]._inSet;
+}
+
+bool PathPrefixSet::containsPrefixOf(const QByteArray &path) const
+{
+    if (isEmpty())
+        return false;
+    bool found = false;
+    int node = find(path, true, &found);
+    return _nodes[node]._inSet;
+}
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+namespace OCC {
+
+/**
+ * @brief A set of folder paths, stored as a tree of path segments
+ *
+ * Answers "is this path, or one of its parent folders, in the set?" in
+ * time proportional to the depth of the path, independent of the number
+ * of paths in the set. Used for the selective sync lists.
+ *
+ * Paths are relative to the sync root and may end with a '/', like the
+ * entries of the selective sync lists. The path "/" (or "") stands for the
+ * root folder and thus contains everything.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT PathPrefixSet
+{
+public:
+    PathPrefixSet();
+    explicit PathPrefixSet(const QStringList &paths);
+
+    void insert(const QByteArray &path);
+    void insert(const QString &path) { insert(path.toUtf8()); }
+
+    /// Whether exactly this path was inserted
+    bool contains(const QByteArray &path) const;
+    bool contains(const QString &path) const { return contains(path.toUtf8()); }
+
+    /// Whether this path or one of its parent folders was inserted
+    bool containsPrefixOf(const QByteArray &path) const;
+    bool containsPrefixOf(const QString &path) const { return containsPrefixOf(path.toUtf8()); }
+
+    bool isEmpty() const { return _size == 0; }
+
+private:
+    struct Node
+    {
+        Node()
+            : _inSet(false)
+        {
+        }
+        QHash<QByteArray, int> _children; // segment -> index in _nodes
+        bool _inSet;
+    };
+
+    /** Finds the node for the path, or the deepest node on the way to it.
+     *
+     * Returns the node index and sets *found to whether the whole path
+     * was matched. If stopAtMember is true, the walk stops at the first
+     * node that is in the set.
+     */
+    int find(const QByteArray &path, bool stopAtMember, bool *found) const;
+
+    QVector<Node> _nodes; // _nodes[0] is the root folder
+    int _size;
+};
+}
@@ -65,6 +65,10 @@ QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous)
     }
 }
 
+// Received data is collected and written to the temporary file in pieces
+// of this size, instead of one write per network read.
+static const int writeBufferSize = 1024 * 1024;
+
 // DOES NOT take ownership of the device.
 GETFileJob::GETFileJob(AccountPtr account, const QString &path, QFile *device,
     const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
@@ -75,8 +79,6 @@ GETFileJob::GETFileJob(AccountPtr account, const QString &path, QFile *device,
     , _expectedEtagForResume(expectedEtagForResume)
     , _resumeStart(resumeStart)
     , _errorStatus(SyncFileItem::NoStatus)
-    , _bandwidthLimited(false)
-    , _bandwidthChoked(false)
     , _bandwidthQuota(0)
     , _bandwidthManager(0)
     , _hasEmittedFinishedSignal(false)
@@ -95,8 +97,6 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
     , _resumeStart(resumeStart)
     , _errorStatus(SyncFileItem::NoStatus)
     , _directDownloadUrl(url)
-    , _bandwidthLimited(false)
-    , _bandwidthChoked(false)
     , _bandwidthQuota(0)
     , _bandwidthManager(0)
     , _hasEmittedFinishedSignal(false)
@@ -128,7 +128,6 @@ void GETFileJob::start()
     }
 
     reply()->setReadBufferSize(16 * 1024); // keep low so we can easier limit the bandwidth
-    qCDebug(lcGetJob) << _bandwidthManager << _bandwidthChoked << _bandwidthLimited;
     if (_bandwidthManager) {
         _bandwidthManager->registerDownloadJob(this);
     }
@@ -216,6 +215,13 @@ void GETFileJob::slotMetaDataChanged()
     if (!lastModified.isNull()) {
         _lastModified = Utility::qDateTimeToTime_t(lastModified.toDateTime());
     }
+
+    // Allocate the space for the whole file up front, so it doesn't get
+    // fragmented by growing piece by piece.
+    const qint64 contentLength = reply()->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    if (contentLength > 0) {
+        FileSystem::reserveFileSpace(*_device, _resumeStart + contentLength);
+    }
 }
 
 void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
@@ -223,73 +229,87 @@ void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
     _bandwidthManager = bwm;
 }
 
-void GETFileJob::setChoked(bool c)
-{
-    _bandwidthChoked = c;
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
-}
-
-void GETFileJob::setBandwidthLimited(bool b)
-{
-    _bandwidthLimited = b;
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
-}
-
 void GETFileJob::giveBandwidthQuota(qint64 q)
 {
-    _bandwidthQuota = q;
+    _bandwidthQuota += q;
     qCDebug(lcGetJob) << "Got" << q << "bytes";
     QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
 }
 
 qint64 GETFileJob::currentDownloadPosition()
 {
-    if (_device && _device->pos() > 0 && _device->pos() > qint64(_resumeStart)) {
-        return _device->pos();
+    if (_device && _device->pos() + _writeBuffer.size() > qint64(_resumeStart)) {
+        return _device->pos() + _writeBuffer.size();
     }
     return _resumeStart;
 }
 
+bool GETFileJob::flushWriteBuffer()
+{
+    if (_writeBuffer.isEmpty()) {
+        return true;
+    }
+    if (!_device->isOpen()) {
+        // Not writing the reply body, see slotMetaDataChanged()
+        _writeBuffer.clear();
+        return true;
+    }
+
+    qint64 w = _device->write(_writeBuffer.constData(), _writeBuffer.size());
+    if (w != _writeBuffer.size()) {
+        _errorString = _device->errorString();
+        _errorStatus = SyncFileItem::NormalError;
+        qCWarning(lcGetJob) << "Error while writing to file" << w << _writeBuffer.size() << _errorString;
+        _writeBuffer.clear();
+        return false;
+    }
+    _writeBuffer.clear();
+    return true;
+}
+
 void GETFileJob::slotReadyRead()
 {
     if (!reply())
         return;
-    int bufferSize = qMin(1024 * 8ll, reply()->bytesAvailable());
-    QByteArray buffer(bufferSize, Qt::Uninitialized);
+    if (_writeBuffer.capacity() < writeBufferSize) {
+        _writeBuffer.reserve(writeBufferSize);
+    }
 
     while (reply()->bytesAvailable() > 0) {
-        if (_bandwidthChoked) {
-            qCWarning(lcGetJob) << "Download choked";
-            break;
-        }
-        qint64 toRead = bufferSize;
-        if (_bandwidthLimited) {
-            toRead = qMin(qint64(bufferSize), _bandwidthQuota);
-            if (toRead == 0) {
-                qCWarning(lcGetJob) << "Out of quota";
+        qint64 toRead = reply()->bytesAvailable();
+        if (_bandwidthManager) {
+            if (_bandwidthQuota <= 0) {
+                _bandwidthQuota += _bandwidthManager->requestDownloadQuota(this, toRead);
+            }
+            toRead = qMin(toRead, _bandwidthQuota);
+            if (toRead <= 0) {
+                // Out of quota, giveBandwidthQuota() will continue
                 break;
             }
-            _bandwidthQuota -= toRead;
         }
+        toRead = qMin(toRead, qint64(writeBufferSize - _writeBuffer.size()));
 
-        qint64 r = reply()->read(buffer.data(), toRead);
+        // Read directly into the write buffer
+        const int oldSize = _writeBuffer.size();
+        _writeBuffer.resize(oldSize + toRead);
+        qint64 r = reply()->read(_writeBuffer.data() + oldSize, toRead);
         if (r < 0) {
+            _writeBuffer.resize(oldSize);
             _errorString = networkReplyErrorString(*reply());
             _errorStatus = SyncFileItem::NormalError;
             qCWarning(lcGetJob) << "Error while reading from device: " << _errorString;
+            flushWriteBuffer();
             reply()->abort();
             return;
         }
+        _writeBuffer.resize(oldSize + r);
+        if (_bandwidthManager) {
+            _bandwidthQuota -= r;
+        }
 
-        if (_device->isOpen()) {
-            qint64 w = _device->write(buffer.constData(), r);
-            if (w != r) {
-                _errorString = _device->errorString();
-                _errorStatus = SyncFileItem::NormalError;
-                qCWarning(lcGetJob) << "Error while writing to file" << w << r << _errorString;
-                reply()->abort();
-                return;
-            }
+        if (_writeBuffer.size() >= writeBufferSize && !flushWriteBuffer()) {
+            reply()->abort();
+            return;
         }
     }
 
@@ -299,6 +319,7 @@ void GETFileJob::slotReadyRead()
             _bandwidthManager->unregisterDownloadJob(this);
         }
         if (!_hasEmittedFinishedSignal) {
+            flushWriteBuffer();
             qCInfo(lcGetJob) << "GET of" << reply()->request().url().toString() << "FINISHED WITH STATUS"
                              << reply()->error()
                              << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString())
@@ -346,12 +367,11 @@ void PropagateDownloadFile::start()
         }
     }
 
-    // If we have a conflict where size and mtime are identical,
-    // compare the remote checksum to the local one.
+    // If we have a conflict where the sizes are identical, compare the
+    // remote checksum to the local one.
     // Maybe it's not a real conflict and no download is necessary!
     if (_item->_instruction == CSYNC_INSTRUCTION_CONFLICT
         && _item->_size == _item->_previousSize
-        && _item->_modtime == _item->_previousModtime
         && !_item->_checksumHeader.isEmpty()) {
         qCDebug(lcPropagateDownload) << _item->_file << "may not need download, computing checksum";
         auto computeChecksum = new ComputeChecksum(this);
@@ -367,8 +387,24 @@ void PropagateDownloadFile::start()
 
 void PropagateDownloadFile::conflictChecksumComputed(const QByteArray &checksumType, const QByteArray &checksum)
 {
-    if (makeChecksumHeader(checksumType, checksum) == _item->_checksumHeader) {
+    _localChecksumHeader = makeChecksumHeader(checksumType, checksum);
+    if (_localChecksumHeader == _item->_checksumHeader) {
         qCDebug(lcPropagateDownload) << _item->_file << "remote and local checksum match";
+
+        if (_item->_modtime != _item->_previousModtime) {
+            // Same content, but the local mtime needs to become the remote one,
+            // or the next sync would see a local change.
+            QString fn = propagator()->getFilePath(_item->_file);
+            if (!FileSystem::verifyFileUnchanged(fn, _item->_previousSize, _item->_previousModtime)) {
+                propagator()->_anotherSyncNeeded = true;
+                done(SyncFileItem::SoftError, tr("File has changed since discovery"));
+                return;
+            }
+            emit propagator()->touchedFile(fn);
+            FileSystem::setModTime(fn, _item->_modtime);
+            _item->_modtime = FileSystem::getModTime(fn);
+        }
+
         // No download necessary, just update metadata
         updateMetadata(/*isConflict=*/false);
         return;
@@ -570,6 +606,12 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
+    if (job->errorStatus() != SyncFileItem::NoStatus) {
+        // Writing the last received data to the temporary file failed
+        done(job->errorStatus(), job->errorString());
+        return;
+    }
+
     if (!job->etag().isEmpty()) {
         // The etag will be empty if we used a direct download URL.
         // (If it was really empty by the server, the GETFileJob will have errored
@@ -582,6 +624,9 @@ void PropagateDownloadFile::slotGetFinished()
     }
     _item->_responseTimeStamp = job->responseTimestamp();
 
+    if (propagator()->syncOptions()._syncDownloadsToDisk && !FileSystem::syncFileToDisk(_tmpFile)) {
+        qCWarning(lcPropagateDownload) << "Could not flush" << _tmpFile.fileName() << "to disk";
+    }
     _tmpFile.close();
     _tmpFile.flush();
 
@@ -775,8 +820,17 @@ void PropagateDownloadFile::downloadFinished()
 
     // In case of conflict, make a backup of the old file
     // Ignore conflicts where both files are binary equal
-    bool isConflict = _item->_instruction == CSYNC_INSTRUCTION_CONFLICT
-        && !FileSystem::fileEquals(fn, _tmpFile.fileName());
+    bool isConflict = false;
+    if (_item->_instruction == CSYNC_INSTRUCTION_CONFLICT) {
+        if (!_localChecksumHeader.isEmpty()
+            && parseChecksumHeaderType(_localChecksumHeader) == parseChecksumHeaderType(_item->_checksumHeader)) {
+            // The checksum of the downloaded data can be compared directly
+            // to the one computed for the local file before the download.
+            isConflict = _localChecksumHeader != _item->_checksumHeader;
+        } else {
+            isConflict = !FileSystem::fileEquals(fn, _tmpFile.fileName());
+        }
+    }
     if (isConflict) {
         QString renameError;
         QString conflictFileName = FileSystem::makeConflictFileName(
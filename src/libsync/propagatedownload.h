@@ -36,12 +36,14 @@ class GETFileJob : public AbstractNetworkJob
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _bandwidthChoked; // if download is paused (won't read on readyRead())
-    qint64 _bandwidthQuota;
+    qint64 _bandwidthQuota; // bytes that may still be read before asking the manager again
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    QByteArray _writeBuffer; // received data that wasn't written to _device yet
+    friend class BandwidthManager;
+
+    bool flushWriteBuffer();
 
 public:
     // DOES NOT take ownership of the device.
@@ -69,6 +71,7 @@ public:
                 _bandwidthManager->unregisterDownloadJob(this);
             }
             if (!_hasEmittedFinishedSignal) {
+                flushWriteBuffer();
                 emit finishedSignal();
             }
             _hasEmittedFinishedSignal = true;
@@ -77,8 +80,7 @@ public:
     }
 
     void setBandwidthManager(BandwidthManager *bwm);
-    void setChoked(bool c);
-    void setBandwidthLimited(bool b);
+    /** Adds to the quota and continues reading */
     void giveBandwidthQuota(qint64 q);
     qint64 currentDownloadPosition();
 
@@ -114,7 +116,7 @@ private slots:
     |
     | deleteExistingFolder() if enabled
     |
-    +--> mtime and size identical?
+    +--> conflict with identical size?
     |    then compute the local checksum
     |                               done?-> conflictChecksumComputed()
     |                                              |
@@ -198,6 +200,9 @@ private:
     QFile _tmpFile;
     bool _deleteExisting;
 
+    // Checksum of the local file in case of a conflict, if it was computed
+    QByteArray _localChecksumHeader;
+
     QElapsedTimer _stopwatch;
 };
 }
@@ -39,6 +39,7 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcPutJob, "sync.networkjob.put", QtInfoMsg)
 Q_LOGGING_CATEGORY(lcPollJob, "sync.networkjob.poll", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcCopyJob, "sync.networkjob.copy", QtInfoMsg)
 Q_LOGGING_CATEGORY(lcPropagateUpload, "sync.propagator.upload", QtInfoMsg)
 
 /**
@@ -158,6 +159,39 @@ bool PollJob::finished()
     return true;
 }
 
+CopyJob::CopyJob(AccountPtr account, const QString &path, const QString &destination,
+    const QMap<QByteArray, QByteArray> &extraHeaders, QObject *parent)
+    : AbstractNetworkJob(account, path, parent)
+    , _destination(destination)
+    , _extraHeaders(extraHeaders)
+{
+}
+
+void CopyJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Destination", QUrl::toPercentEncoding(_destination, "/"));
+    for (auto it = _extraHeaders.constBegin(); it != _extraHeaders.constEnd(); ++it) {
+        req.setRawHeader(it.key(), it.value());
+    }
+    sendRequest("COPY", makeDavUrl(path()), req);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qCWarning(lcCopyJob) << " Network error: " << reply()->errorString();
+    }
+    AbstractNetworkJob::start();
+}
+
+bool CopyJob::finished()
+{
+    qCInfo(lcCopyJob) << "COPY of" << reply()->request().url() << "FINISHED WITH STATUS"
+                      << reply()->error()
+                      << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString());
+
+    emit finishedSignal();
+    return true;
+}
+
 void PropagateUploadFileCommon::setDeleteExisting(bool enabled)
 {
     _deleteExisting = enabled;
@@ -318,16 +352,93 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
         return;
     }
 
+    if (startCopyFromDuplicate()) {
+        return;
+    }
+
     doStartUpload();
 }
 
+bool PropagateUploadFileCommon::startCopyFromDuplicate()
+{
+    // Small files are cheap to upload (and may go in a bulk upload), and
+    // existing files need the If-Match checks of the upload.
+    if (_item->_instruction != CSYNC_INSTRUCTION_NEW || _deleteExisting
+        || _item->_size < propagator()->smallFileSize()) {
+        return false;
+    }
+
+    const SyncJournalFileRecord source =
+        propagator()->_journal->getFileRecordByChecksum(_item->_checksumHeader, _item->_size);
+    if (!source.isValid() || source._path == _item->_file || source._etag.isEmpty()) {
+        return false;
+    }
+
+    qCInfo(lcPropagateUpload) << "Copying" << source._path << "on the server to" << _item->_file
+                              << "instead of uploading it";
+
+    QMap<QByteArray, QByteArray> headers;
+    // If-Match applies to the source: it must still have the content the checksum is about
+    headers["If-Match"] = '"' + source._etag + '"';
+    // Something that appeared on the server meanwhile must not be overwritten
+    headers["Overwrite"] = "F";
+    headers["X-OC-Mtime"] = QByteArray::number(qint64(_item->_modtime));
+    headers[checkSumHeaderC] = _item->_checksumHeader;
+
+    const QString destination = QDir::cleanPath(propagator()->account()->url().path() + QLatin1Char('/')
+        + propagator()->account()->davPath() + propagator()->_remoteFolder + _item->_file);
+    auto job = new CopyJob(propagator()->account(), propagator()->_remoteFolder + source._path,
+        destination, headers, this);
+    _jobs.append(job);
+    connect(job, &CopyJob::finishedSignal, this, &PropagateUploadFileCommon::slotCopyFinished);
+    connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
+    propagator()->_activeJobList.append(this);
+    job->start();
+    return true;
+}
+
+void PropagateUploadFileCommon::slotCopyFinished()
+{
+    auto job = qobject_cast<CopyJob *>(sender());
+    ASSERT(job);
+    slotJobDestroyed(job); // remove it from the _jobs list
+    propagator()->_activeJobList.removeOne(this);
+
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    const int httpStatus = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const QByteArray fileId = job->reply()->rawHeader("OC-FileID");
+    const QByteArray etag = getEtagFromReply(job->reply());
+    if (job->reply()->error() != QNetworkReply::NoError
+        || (httpStatus != 201 && httpStatus != 204)
+        || fileId.isEmpty() || etag.isEmpty()) {
+        // The source may have changed or be gone, the destination may exist...
+        // in any case the normal upload knows how to deal with it.
+        qCInfo(lcPropagateUpload) << "Server side copy of" << _item->_file << "failed with status"
+                                  << httpStatus << job->errorString() << ", uploading it";
+        doStartUpload();
+        return;
+    }
+
+    _item->_fileId = fileId;
+    _item->_etag = etag;
+    _item->_responseTimeStamp = job->responseTimestamp();
+
+    const QString fullFilePath = propagator()->getFilePath(_item->_file);
+    if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        // The record keeps the old modtime, so the next sync uploads the new content
+        propagator()->_anotherSyncNeeded = true;
+    }
+
+    finalize();
+}
+
 UploadDevice::UploadDevice(BandwidthManager *bwm)
     : _read(0)
     , _bandwidthManager(bwm)
     , _bandwidthQuota(0)
-    , _readWithProgress(0)
-    , _bandwidthLimited(false)
-    , _choked(false)
 {
     _bandwidthManager->registerUploadDevice(this);
 }
@@ -383,12 +494,12 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
     if (maxlen == 0) {
         return 0;
     }
-    if (isChoked()) {
-        return 0;
-    }
-    if (isBandwidthLimited()) {
+    if (_bandwidthManager) {
+        if (_bandwidthQuota <= 0) {
+            _bandwidthQuota += _bandwidthManager->requestUploadQuota(this, maxlen);
+        }
         maxlen = qMin(maxlen, _bandwidthQuota);
-        if (maxlen <= 0) { // no quota
+        if (maxlen <= 0) { // no quota, giveBandwidthQuota() will wake us up
             return 0;
         }
         _bandwidthQuota -= maxlen;
@@ -398,14 +509,6 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
     return maxlen;
 }
 
-void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
-{
-    if (sent == 0 || t == 0) {
-        return;
-    }
-    _readWithProgress = sent;
-}
-
 bool UploadDevice::atEnd() const
 {
     return _read >= _data.size();
@@ -441,26 +544,12 @@ bool UploadDevice::seek(qint64 pos)
 
 void UploadDevice::giveBandwidthQuota(qint64 bwq)
 {
+    _bandwidthQuota += bwq;
     if (!atEnd()) {
-        _bandwidthQuota = bwq;
         QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection); // tell QNAM that we have quota
     }
 }
 
-void UploadDevice::setBandwidthLimited(bool b)
-{
-    _bandwidthLimited = b;
-    QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
-}
-
-void UploadDevice::setChoked(bool b)
-{
-    _choked = b;
-    if (!_choked) {
-        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
-    }
-}
-
 void PropagateUploadFileCommon::startPollJob(const QString &path)
 {
     PollJob *job = new PollJob(propagator()->account(), path, _item,
@@ -518,6 +607,11 @@ void PropagateUploadFileCommon::commonErrorHandling(AbstractNetworkJob *job)
     QString errorString = job->errorStringParsingBody(&replyContent);
     qCDebug(lcPropagateUpload) << replyContent; // display the XML error in the debug
 
+    commonErrorHandling(job->reply()->error(), errorString);
+}
+
+void PropagateUploadFileCommon::commonErrorHandling(QNetworkReply::NetworkError error, QString errorString)
+{
     if (_item->_httpErrorCode == 412) {
         // Precondition Failed: Either an etag or a checksum mismatch.
 
@@ -530,7 +624,7 @@ void PropagateUploadFileCommon::commonErrorHandling(AbstractNetworkJob *job)
     // Ensure errors that should eventually reset the chunked upload are tracked.
     checkResettingErrors();
 
-    SyncFileItem::Status status = classifyError(job->reply()->error(), _item->_httpErrorCode,
+    SyncFileItem::Status status = classifyError(error, _item->_httpErrorCode,
         &propagator()->_anotherSyncNeeded);
 
     // Insufficient remote storage.
@@ -605,6 +699,15 @@ QMap<QByteArray, QByteArray> PropagateUploadFileCommon::headers()
 }
 
 void PropagateUploadFileCommon::finalize()
+{
+    if (!updateJournal())
+        return;
+    propagator()->_journal->commit("upload file start");
+
+    done(SyncFileItem::Success);
+}
+
+bool PropagateUploadFileCommon::updateJournal()
 {
     _finished = true;
 
@@ -616,13 +719,11 @@ void PropagateUploadFileCommon::finalize()
     // Update the database entry
     if (!propagator()->_journal->setFileRecord(_item->toSyncJournalFileRecordWithInode(propagator()->getFilePath(_item->_file)))) {
         done(SyncFileItem::FatalError, tr("Error writing metadata to the database"));
-        return;
+        return false;
     }
 
     // Remove from the progress database:
     propagator()->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
-    propagator()->_journal->commit("upload file start");
-
-    done(SyncFileItem::Success);
+    return true;
 }
 }
@@ -19,6 +19,8 @@
 #include <QBuffer>
 #include <QFile>
 #include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QTimer>
 
 
 namespace OCC {
@@ -50,10 +52,7 @@ public:
     bool isSequential() const Q_DECL_OVERRIDE;
     bool seek(qint64 pos) Q_DECL_OVERRIDE;
 
-    void setBandwidthLimited(bool);
-    bool isBandwidthLimited() { return _bandwidthLimited; }
-    void setChoked(bool);
-    bool isChoked() { return _choked; }
+    /** Adds to the quota and tells QNAM that it may read again */
     void giveBandwidthQuota(qint64 bwq);
 
 signals:
@@ -66,13 +65,8 @@ private:
 
     // Bandwidth manager related
     QPointer<BandwidthManager> _bandwidthManager;
-    qint64 _bandwidthQuota;
-    qint64 _readWithProgress;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _choked; // if upload is paused (readData() will return 0)
+    qint64 _bandwidthQuota; // bytes that may still be read before asking the manager again
     friend class BandwidthManager;
-protected slots:
-    void slotJobUploadProgress(qint64 sent, qint64 t);
 };
 
 /**
@@ -177,6 +171,30 @@ signals:
     void finishedSignal();
 };
 
+/**
+ * @brief Copies a file on the server with the WebDAV COPY method
+ *
+ * Used instead of an upload when a file with the same content is known
+ * to exist on the server already.
+ * @ingroup libsync
+ */
+class CopyJob : public AbstractNetworkJob
+{
+    Q_OBJECT
+    const QString _destination;
+    QMap<QByteArray, QByteArray> _extraHeaders;
+
+public:
+    explicit CopyJob(AccountPtr account, const QString &path, const QString &destination,
+        const QMap<QByteArray, QByteArray> &extraHeaders, QObject *parent = 0);
+
+    void start() Q_DECL_OVERRIDE;
+    bool finished() Q_DECL_OVERRIDE;
+
+signals:
+    void finishedSignal();
+};
+
 /**
  * @brief The PropagateUploadFileCommon class is the code common between all chunking algorithms
  * @ingroup libsync
@@ -192,6 +210,8 @@ signals:
  *         |
  *         v
  *    slotStartUpload()  -> doStartUpload()
+ *         |                        .
+ *         +--> (copy job, for new files with known content) -> finalize() or doStartUpload()
  *                                  .
  *                                  .
  *                                  v
@@ -239,12 +259,27 @@ private slots:
     void slotComputeTransmissionChecksum(const QByteArray &contentChecksumType, const QByteArray &contentChecksum);
     // transmission checksum computed, prepare the upload
     void slotStartUpload(const QByteArray &transmissionChecksumType, const QByteArray &transmissionChecksum);
+    // the server side copy finished, on failure upload the file normally
+    void slotCopyFinished();
+
+private:
+    /**
+     * Starts a server side copy if the journal knows a file with the same
+     * content, returns false if there is none.
+     */
+    bool startCopyFromDuplicate();
 
 public:
     virtual void doStartUpload() = 0;
 
     void startPollJob(const QString &path);
     void finalize();
+
+    /** Writes the file record of a successful upload to the journal, without committing.
+     *
+     * Calls done() and returns false if that fails.
+     */
+    bool updateJournal();
     void abortWithError(SyncFileItem::Status status, const QString &error);
 
 public slots:
@@ -267,6 +302,12 @@ protected:
      */
     void commonErrorHandling(AbstractNetworkJob *job);
 
+    /**
+     * Same as above, with the error string already parsed from the reply body,
+     * e.g. for a reply shared by several jobs.
+     */
+    void commonErrorHandling(QNetworkReply::NetworkError error, QString errorString);
+
     // Bases headers that need to be sent with every chunk
     QMap<QByteArray, QByteArray> headers();
 };
@@ -343,6 +384,18 @@ private:
     };
     QMap<int, ServerChunkInfo> _serverChunks;
 
+    // Delta sync: the file is split into blocks of _blockSize bytes and only
+    // the blocks whose checksum differs from the one stored in the journal
+    // for the previous upload are sent. Each of them is uploaded as a chunk
+    // named after its block number, and the MOVE tells the server with the
+    // OC-Delta-Base header to take the missing blocks from the version the
+    // client is replacing.
+    quint64 _blockSize; /// 0 if no block checksums are computed for this upload
+    QByteArray _blockChecksums; /// see SyncJournalDb::BlockChecksums
+    QFutureWatcher<QByteArray> _blockChecksumsWatcher;
+    bool _deltaSync; /// whether only _changedBlocks are uploaded
+    QVector<int> _changedBlocks;
+
     /**
      * Return the URL of a chunk.
      * If chunk == -1, returns the URL of the parent folder containing the chunks
@@ -353,15 +406,27 @@ public:
     PropagateUploadFileNG(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
         : PropagateUploadFileCommon(propagator, item)
         , _currentChunkSize(0)
+        , _blockSize(0)
+        , _deltaSync(false)
     {
     }
 
     void doStartUpload() Q_DECL_OVERRIDE;
 
+    /**
+     * Computes the SHA1 checksums of consecutive blocks of the file, concatenated.
+     *
+     * Returns an empty array if the file could not be read.
+     */
+    static QByteArray computeBlockChecksums(const QString &filePath, quint64 blockSize);
+
 private:
+    void startUploadOrResume();
+    bool findChangedBlocks();
     void startNewUpload();
     void startNextChunk();
 private slots:
+    void slotBlockChecksumsComputed();
     void slotPropfindFinished();
     void slotPropfindFinishedWithError();
     void slotPropfindIterate(const QString &name, const QMap<QString, QString> &properties);
@@ -371,4 +436,142 @@ private slots:
     void slotMoveJobFinished();
     void slotUploadProgress(qint64, qint64);
 };
+
+/**
+ * @brief Uploads several small files with a single multipart request
+ *
+ * The files are sent as the parts of a multipart/related POST to
+ * remote.php/dav/bulk. Each part carries the headers of the corresponding
+ * PUT (X-OC-Mtime, OC-Checksum, If-Match, ...) plus the X-File-Path header
+ * with the percent-encoded path of the file relative to the dav root.
+ *
+ * The server answers with a JSON object that has an entry for every path:
+ *   { "/path/to/file": { "error": false, "etag": "...", "fileid": "...",
+ *                        "checksum": "SHA1:...", "status": 201, "message": "" } }
+ *
+ * @ingroup libsync
+ */
+class BulkUploadJob : public AbstractNetworkJob
+{
+    Q_OBJECT
+public:
+    struct Part
+    {
+        QString _path;
+        QByteArray _data;
+        QMap<QByteArray, QByteArray> _headers;
+    };
+
+    struct Result
+    {
+        Result()
+            : _error(true)
+            , _httpErrorCode(0)
+        {
+        }
+
+        bool _error;
+        int _httpErrorCode;
+        QString _message;
+        QByteArray _etag;
+        QByteArray _fileId;
+        QByteArray _checksumHeader;
+    };
+
+    explicit BulkUploadJob(AccountPtr account, const QVector<Part> &parts, QObject *parent = 0);
+
+    void start() Q_DECL_OVERRIDE;
+    bool finished() Q_DECL_OVERRIDE;
+
+    /** The result for each path, only valid after a successful request */
+    const QHash<QString, Result> &results() const { return _results; }
+
+    /** Whether the server answered with a valid result list */
+    bool hasValidResults() const { return _validResults; }
+
+signals:
+    void finishedSignal();
+
+private:
+    QVector<Part> _parts;
+    QHash<QString, Result> _results;
+    bool _validResults;
+};
+
+class PropagateUploadFileBulk;
+
+/**
+ * @brief Collects small file uploads and sends them as BulkUploadJob batches
+ *
+ * Jobs are added while the propagator keeps scheduling. A batch is sent
+ * once it is full, or when no more jobs were added for a short while.
+ * Each batch in transit occupies a single slot in the propagator's active
+ * job list. The journal is committed once per batch.
+ *
+ * @ingroup libsync
+ */
+class BulkUploadQueue : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BulkUploadQueue(OwncloudPropagator *propagator);
+
+    void append(PropagateUploadFileBulk *job, const BulkUploadJob::Part &part);
+    void remove(PropagateUploadFileBulk *job);
+
+private slots:
+    void sendBatch();
+    void slotBatchFinished();
+
+private:
+    OwncloudPropagator *_propagator;
+    QTimer _collectTimer;
+
+    // waiting to be sent
+    QVector<QPair<QPointer<PropagateUploadFileBulk>, BulkUploadJob::Part>> _pending;
+    qint64 _pendingBytes;
+
+    // in transit
+    struct Batch
+    {
+        QVector<QPointer<PropagateUploadFileBulk>> _jobs;
+        // what occupies the batch's slot in the active job list
+        PropagateItemJob *_activeJob;
+    };
+    QHash<BulkUploadJob *, Batch> _inTransit;
+};
+
+/**
+ * @ingroup libsync
+ *
+ * Propagation job uploading a small file as part of a bulk upload.
+ * See BulkUploadQueue and BulkUploadJob.
+ */
+class PropagateUploadFileBulk : public PropagateUploadFileCommon
+{
+    Q_OBJECT
+public:
+    PropagateUploadFileBulk(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
+        : PropagateUploadFileCommon(propagator, item)
+    {
+    }
+
+    void doStartUpload() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+
+    /** Called by the BulkUploadQueue when the batch was sent */
+    void batchStarted(BulkUploadJob *job);
+
+    /** Called by the BulkUploadQueue with the result of the batch.
+     *
+     * The error string is parsed from the reply once for the whole batch.
+     * Returns true if the upload succeeded and the journal was updated.
+     * In that case the job waits for finishBatch(), so that the journal can
+     * be committed once for the whole batch first.
+     */
+    bool batchFinished(BulkUploadJob *job, const QString &errorString);
+
+    /** Completes a job for which batchFinished() returned true */
+    void finishBatch();
+};
 }
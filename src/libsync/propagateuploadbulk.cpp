@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "config.h"
+#include "propagateupload.h"
+#include "owncloudpropagator_p.h"
+#include "networkjobs.h"
+#include "account.h"
+#include "common/syncjournaldb.h"
+#include "common/utility.h"
+#include "filesystem.h"
+#include "common/checksums.h"
+#include "common/asserts.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QUuid>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcBulkUpload, "sync.networkjob.bulkupload", QtInfoMsg)
+
+// A batch is sent as soon as it reaches one of these limits
+static const int maximumBatchFiles = 100;
+static const qint64 maximumBatchBytes = 10 * 1000 * 1000;
+
+// Otherwise it is sent when no file was added for this long
+static const int batchCollectMsec = 50;
+
+BulkUploadJob::BulkUploadJob(AccountPtr account, const QVector<Part> &parts, QObject *parent)
+    : AbstractNetworkJob(account, QString(), parent)
+    , _parts(parts)
+    , _validResults(false)
+{
+}
+
+void BulkUploadJob::start()
+{
+    const QByteArray boundary = "bulk-" + QUuid::createUuid().toByteArray().mid(1, 36);
+
+    QByteArray body;
+    foreach (const Part &part, _parts) {
+        body += "--" + boundary + "\r\n";
+        body += "X-File-Path: " + QUrl::toPercentEncoding(part._path, "/") + "\r\n";
+        for (auto it = part._headers.constBegin(); it != part._headers.constEnd(); ++it) {
+            body += it.key() + ": " + it.value() + "\r\n";
+        }
+        body += "Content-Length: " + QByteArray::number(part._data.size()) + "\r\n\r\n";
+        body += part._data;
+        body += "\r\n";
+    }
+    body += "--" + boundary + "--\r\n";
+
+    QNetworkRequest req;
+    req.setRawHeader("Content-Type", "multipart/related; boundary=" + boundary);
+    req.setPriority(QNetworkRequest::LowPriority); // Long uploads must not block non-propagation jobs.
+
+    QBuffer *buf = new QBuffer(this);
+    buf->setData(body);
+    buf->open(QIODevice::ReadOnly);
+    // assumes ownership
+    sendRequest("POST", Utility::concatUrlPath(account()->url(), QLatin1String("remote.php/dav/bulk")), req, buf);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qCWarning(lcBulkUpload) << " Network error: " << reply()->errorString();
+    }
+
+    connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
+    AbstractNetworkJob::start();
+}
+
+bool BulkUploadJob::finished()
+{
+    qCInfo(lcBulkUpload) << "POST of" << _parts.size() << "files FINISHED WITH STATUS"
+                         << reply()->error()
+                         << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString())
+                         << reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+
+    if (reply()->error() == QNetworkReply::NoError) {
+        QJsonParseError jsonParseError;
+        const QJsonObject json = QJsonDocument::fromJson(reply()->readAll(), &jsonParseError).object();
+        _validResults = jsonParseError.error == QJsonParseError::NoError;
+        for (auto it = json.constBegin(); it != json.constEnd(); ++it) {
+            const QJsonObject entry = it.value().toObject();
+            Result result;
+            result._error = entry["error"].toBool();
+            result._httpErrorCode = entry["status"].toInt();
+            result._message = entry["message"].toString();
+            result._etag = parseEtag(entry["etag"].toString().toUtf8());
+            result._fileId = entry["fileid"].toString().toUtf8();
+            result._checksumHeader = entry["checksum"].toString().toUtf8();
+            _results.insert(it.key(), result);
+        }
+    }
+
+    emit finishedSignal();
+    return true;
+}
+
+BulkUploadQueue::BulkUploadQueue(OwncloudPropagator *propagator)
+    : QObject(propagator)
+    , _propagator(propagator)
+    , _pendingBytes(0)
+{
+    _collectTimer.setSingleShot(true);
+    _collectTimer.setInterval(batchCollectMsec);
+    connect(&_collectTimer, &QTimer::timeout, this, &BulkUploadQueue::sendBatch);
+}
+
+void BulkUploadQueue::append(PropagateUploadFileBulk *job, const BulkUploadJob::Part &part)
+{
+    _pending.append(qMakePair(QPointer<PropagateUploadFileBulk>(job), part));
+    _pendingBytes += part._data.size();
+
+    if (_pending.size() >= maximumBatchFiles || _pendingBytes >= maximumBatchBytes) {
+        sendBatch();
+    } else {
+        // Wait for more files as long as they keep coming
+        _collectTimer.start();
+    }
+}
+
+void BulkUploadQueue::remove(PropagateUploadFileBulk *job)
+{
+    for (int i = _pending.size() - 1; i >= 0; --i) {
+        if (_pending.at(i).first == job) {
+            _pendingBytes -= _pending.at(i).second._data.size();
+            _pending.remove(i);
+        }
+    }
+}
+
+void BulkUploadQueue::sendBatch()
+{
+    _collectTimer.stop();
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    QVector<BulkUploadJob::Part> parts;
+    QVector<QPointer<PropagateUploadFileBulk>> jobs;
+    qint64 bytes = 0;
+    while (!_pending.isEmpty() && parts.size() < maximumBatchFiles && bytes < maximumBatchBytes) {
+        auto entry = _pending.takeFirst();
+        _pendingBytes -= entry.second._data.size();
+        if (!entry.first) {
+            continue;
+        }
+        bytes += entry.second._data.size();
+        parts.append(entry.second);
+        jobs.append(entry.first);
+    }
+    if (jobs.isEmpty()) {
+        return;
+    }
+
+    qCInfo(lcBulkUpload) << "Sending a batch of" << jobs.size() << "files," << bytes << "bytes";
+
+    auto job = new BulkUploadJob(_propagator->account(), parts, this);
+    connect(job, &BulkUploadJob::finishedSignal, this, &BulkUploadQueue::slotBatchFinished);
+    // The whole batch counts as one transfer
+    Batch batch;
+    batch._jobs = jobs;
+    batch._activeJob = jobs.first();
+    _inTransit.insert(job, batch);
+    foreach (const auto &j, jobs) {
+        j->batchStarted(job);
+    }
+    _propagator->_activeJobList.append(batch._activeJob);
+    job->start();
+
+    // Whatever is left is sent right away
+    if (!_pending.isEmpty()) {
+        sendBatch();
+    }
+}
+
+void BulkUploadQueue::slotBatchFinished()
+{
+    BulkUploadJob *job = qobject_cast<BulkUploadJob *>(sender());
+    ASSERT(job);
+
+    const Batch batch = _inTransit.take(job);
+    // Even if that job is gone by now
+    _propagator->_activeJobList.removeOne(batch._activeJob);
+
+    // The reply is shared, read its body once for all the jobs
+    QString errorString;
+    if (job->reply()->error() != QNetworkReply::NoError) {
+        QByteArray replyContent;
+        errorString = job->errorStringParsingBody(&replyContent);
+        qCDebug(lcBulkUpload) << replyContent;
+    }
+
+    QVector<QPointer<PropagateUploadFileBulk>> succeeded;
+    foreach (const auto &j, batch._jobs) {
+        if (j && j->batchFinished(job, errorString)) {
+            succeeded.append(j);
+        }
+    }
+
+    // One journal commit for the whole batch
+    if (!succeeded.isEmpty()) {
+        _propagator->_journal->commit("bulk upload");
+    }
+    foreach (const auto &j, succeeded) {
+        if (j) {
+            j->finishBatch();
+        }
+    }
+
+    _propagator->scheduleNextJob();
+}
+
+void PropagateUploadFileBulk::doStartUpload()
+{
+    const QString fileName = propagator()->getFilePath(_item->_file);
+    QFile file(fileName);
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, 0)) {
+        qCWarning(lcPropagateUpload) << "Could not open file for bulk upload: " << openError;
+
+        // If the file is currently locked, we want to retry the sync
+        // when it becomes available again.
+        if (FileSystem::isFileLocked(fileName)) {
+            emit propagator()->seenLockedFile(fileName);
+        }
+        // Soft error because this is likely caused by the user modifying his files while syncing
+        abortWithError(SyncFileItem::SoftError, openError);
+        return;
+    }
+
+    BulkUploadJob::Part part;
+    part._path = propagator()->_remoteFolder + _item->_file;
+    part._data = file.readAll();
+    if (file.error() != QFile::NoError) {
+        abortWithError(SyncFileItem::SoftError, file.errorString());
+        return;
+    }
+    if (quint64(part._data.size()) != _item->_size) {
+        propagator()->_anotherSyncNeeded = true;
+        abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+
+    part._headers = headers();
+    // The server can't ask us to poll for individual files of a batch
+    part._headers.remove("OC-Async");
+    if (!_transmissionChecksumHeader.isEmpty()) {
+        part._headers[checkSumHeaderC] = _transmissionChecksumHeader;
+    }
+
+    propagator()->reportProgress(*_item, 0);
+    propagator()->bulkUploadQueue()->append(this, part);
+
+    // We don't occupy a slot in the active job list while waiting for the
+    // batch, so more jobs can be started and join it.
+    propagator()->scheduleNextJob();
+}
+
+void PropagateUploadFileBulk::abort()
+{
+    // Jobs that are part of a batch in transit get their result from it
+    propagator()->bulkUploadQueue()->remove(this);
+    PropagateUploadFileCommon::abort();
+}
+
+void PropagateUploadFileBulk::batchStarted(BulkUploadJob *job)
+{
+    _jobs.append(job);
+    connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
+}
+
+bool PropagateUploadFileBulk::batchFinished(BulkUploadJob *job, const QString &errorString)
+{
+    slotJobDestroyed(job); // remove it from the _jobs list
+
+    if (_finished) {
+        return false;
+    }
+
+    if (job->reply()->error() != QNetworkReply::NoError) {
+        _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        commonErrorHandling(job->reply()->error(), errorString);
+        return false;
+    }
+    if (!job->hasValidResults()) {
+        abortWithError(SyncFileItem::NormalError, tr("Invalid JSON reply from the bulk upload"));
+        return false;
+    }
+
+    auto it = job->results().constFind(propagator()->_remoteFolder + _item->_file);
+    if (it == job->results().constEnd()) {
+        abortWithError(SyncFileItem::NormalError, tr("The server did not report a result for this file"));
+        return false;
+    }
+    const BulkUploadJob::Result &result = *it;
+
+    _item->_httpErrorCode = result._httpErrorCode;
+    if (result._error) {
+        if (_item->_httpErrorCode == 412) {
+            // Precondition Failed: Either an etag or a checksum mismatch.
+            propagator()->_journal->avoidReadFromDbOnNextSync(_item->_file);
+            propagator()->_anotherSyncNeeded = true;
+        }
+        abortWithError(SyncFileItem::NormalError, result._message);
+        return false;
+    }
+
+    if (result._etag.isEmpty()) {
+        abortWithError(SyncFileItem::NormalError, tr("The server did not acknowledge the upload. (No e-tag was present)"));
+        return false;
+    }
+
+    if (!result._checksumHeader.isEmpty() && !_transmissionChecksumHeader.isEmpty()) {
+        QByteArray ourType, ourChecksum, serverType, serverChecksum;
+        parseChecksumHeader(_transmissionChecksumHeader, &ourType, &ourChecksum);
+        parseChecksumHeader(result._checksumHeader, &serverType, &serverChecksum);
+        if (ourType == serverType && ourChecksum != serverChecksum) {
+            abortWithError(SyncFileItem::NormalError, tr("The server reported a different checksum for the uploaded file"));
+            return false;
+        }
+    }
+
+    // The file is on the server now. If it changed locally in the meantime,
+    // the next sync will upload it again.
+    const QString fullFilePath(propagator()->getFilePath(_item->_file));
+    if (!FileSystem::fileExists(fullFilePath)
+        || !FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        propagator()->_anotherSyncNeeded = true;
+    }
+
+    if (!result._fileId.isEmpty()) {
+        if (!_item->_fileId.isEmpty() && _item->_fileId != result._fileId) {
+            qCWarning(lcPropagateUpload) << "File ID changed!" << _item->_fileId << result._fileId;
+        }
+        _item->_fileId = result._fileId;
+    }
+    _item->_etag = result._etag;
+    _item->_responseTimeStamp = job->responseTimestamp();
+
+    propagator()->reportProgress(*_item, _item->_size);
+    return updateJournal();
+}
+
+void PropagateUploadFileBulk::finishBatch()
+{
+    done(SyncFileItem::Success);
+}
+}
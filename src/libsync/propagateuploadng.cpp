@@ -30,6 +30,8 @@
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QCryptographicHash>
+#include <qtconcurrentrun.h>
 #include <cmath>
 #include <cstring>
 
@@ -51,13 +53,16 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
   State machine:
 
      *----> doStartUpload()
+            Delta sync? compute the block checksums first
+              |
+            startUploadOrResume()
             Check the db: is there an entry?
               /               \
              no                yes
             /                   \
            /                  PROPFIND
        startNewUpload() <-+        +----------------------------\
-          |               |        |                             \
+       findChangedBlocks()|        |                             \
          MKCOL            + slotPropfindFinishedWithError()     slotPropfindFinished()
           |                                                       Is there stale files to remove?
       slotMkColFinished()                                         |                      |
@@ -82,6 +87,65 @@ void PropagateUploadFileNG::doStartUpload()
 {
     propagator()->_activeJobList.append(this);
 
+    if (propagator()->account()->capabilities().deltaSync()
+        && _item->_size >= propagator()->syncOptions()._deltaSyncMinFileSize) {
+        // Keep the block size of the previous upload, otherwise nothing can be reused
+        const auto previous = propagator()->_journal->getBlockChecksums(_item->_file);
+        _blockSize = previous._valid && previous._etag == _item->_etag
+            ? previous._blockSize
+            : propagator()->syncOptions()._initialChunkSize;
+
+        connect(&_blockChecksumsWatcher, &QFutureWatcherBase::finished,
+            this, &PropagateUploadFileNG::slotBlockChecksumsComputed);
+        _blockChecksumsWatcher.setFuture(QtConcurrent::run(&PropagateUploadFileNG::computeBlockChecksums,
+            propagator()->getFilePath(_item->_file), _blockSize));
+        return;
+    }
+
+    startUploadOrResume();
+}
+
+QByteArray PropagateUploadFileNG::computeBlockChecksums(const QString &filePath, quint64 blockSize)
+{
+    QFile file(filePath);
+    if (blockSize == 0 || !file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    QByteArray result;
+    const qint64 bufSize = qMin(blockSize, quint64(500 * 1024));
+    while (!file.atEnd()) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        quint64 blockRead = 0;
+        while (blockRead < blockSize && !file.atEnd()) {
+            const QByteArray buf = file.read(qMin(qint64(blockSize - blockRead), bufSize));
+            if (buf.isEmpty()) {
+                return QByteArray(); // read error
+            }
+            hash.addData(buf);
+            blockRead += buf.size();
+        }
+        result.append(hash.result());
+    }
+    return result;
+}
+
+void PropagateUploadFileNG::slotBlockChecksumsComputed()
+{
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    _blockChecksums = _blockChecksumsWatcher.result();
+    if (_blockChecksums.isEmpty()) {
+        // Upload the file normally, reading it will fail again and report the error
+        qCWarning(lcPropagateUpload) << "Could not compute the block checksums of" << _item->_file;
+        _blockSize = 0;
+    }
+    startUploadOrResume();
+}
+
+void PropagateUploadFileNG::startUploadOrResume()
+{
     const SyncJournalDb::UploadInfo progressInfo = propagator()->_journal->getUploadInfo(_item->_file);
     if (progressInfo._valid && Utility::qDateTimeToTime_t(progressInfo._modtime) == _item->_modtime) {
         _transferId = progressInfo._transferid;
@@ -217,12 +281,45 @@ void PropagateUploadFileNG::slotDeleteJobFinished()
 }
 
 
+bool PropagateUploadFileNG::findChangedBlocks()
+{
+    _changedBlocks.clear();
+
+    // Without the If-Match header the server version may not be the one
+    // the stored checksums were computed for.
+    if (_blockChecksums.isEmpty() || !headers().contains("If-Match"))
+        return false;
+
+    const auto previous = propagator()->_journal->getBlockChecksums(_item->_file);
+    if (!previous._valid || previous._etag != _item->_etag || previous._blockSize != _blockSize)
+        return false;
+
+    const int checksumSize = 20; // SHA1
+    const int blockCount = _blockChecksums.size() / checksumSize;
+    const int previousBlockCount = previous._checksums.size() / checksumSize;
+    for (int i = 0; i < blockCount; ++i) {
+        if (i >= previousBlockCount
+            || std::memcmp(_blockChecksums.constData() + i * checksumSize,
+                   previous._checksums.constData() + i * checksumSize, checksumSize)
+                != 0) {
+            _changedBlocks.append(i);
+        }
+    }
+
+    qCInfo(lcPropagateUpload) << "Delta sync of" << _item->_file << ":" << _changedBlocks.size()
+                              << "of" << blockCount << "blocks changed";
+
+    // Nothing to gain, rather use the normal upload with dynamic chunk sizes
+    return _changedBlocks.size() < blockCount;
+}
+
 void PropagateUploadFileNG::startNewUpload()
 {
     ASSERT(propagator()->_activeJobList.count(this) == 1);
     _transferId = qrand() ^ _item->_modtime ^ (_item->_size << 16) ^ qHash(_item->_file);
     _sent = 0;
     _currentChunk = 0;
+    _deltaSync = findChangedBlocks();
 
     propagator()->reportProgress(*_item, 0);
 
@@ -267,8 +364,20 @@ void PropagateUploadFileNG::startNextChunk()
     quint64 fileSize = _item->_size;
     ENFORCE(fileSize >= _sent, "Sent data exceeds file size");
 
-    // prevent situation that chunk size is bigger then required one to send
-    _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    quint64 offset = _sent;
+    int chunkName = _currentChunk;
+    if (!_deltaSync) {
+        // prevent situation that chunk size is bigger then required one to send
+        _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    } else if (_currentChunk < _changedBlocks.size()) {
+        chunkName = _changedBlocks.at(_currentChunk);
+        offset = quint64(chunkName) * _blockSize;
+        _currentChunkSize = qMin(_blockSize, fileSize - offset);
+    } else {
+        // The remaining blocks did not change
+        _sent = fileSize;
+        _currentChunkSize = 0;
+    }
 
     if (_currentChunkSize == 0) {
         Q_ASSERT(_jobs.isEmpty()); // There should be no running job anymore
@@ -288,6 +397,10 @@ void PropagateUploadFileNG::startNextChunk()
             headers[checkSumHeaderC] = _transmissionChecksumHeader;
         }
         headers["OC-Total-Length"] = QByteArray::number(fileSize);
+        if (_deltaSync) {
+            // Missing chunks are taken from this version of the destination
+            headers["OC-Delta-Base"] = '"' + _item->_etag + '"';
+        }
 
         auto job = new MoveJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), "/.file"),
             destination, headers, this);
@@ -302,7 +415,7 @@ void PropagateUploadFileNG::startNextChunk()
     auto device = new UploadDevice(&propagator()->_bandwidthManager);
     const QString fileName = propagator()->getFilePath(_item->_file);
 
-    if (!device->prepareAndOpen(fileName, _sent, _currentChunkSize)) {
+    if (!device->prepareAndOpen(fileName, offset, _currentChunkSize)) {
         qCWarning(lcPropagateUpload) << "Could not prepare upload device: " << device->errorString();
 
         // If the file is currently locked, we want to retry the sync
@@ -316,10 +429,10 @@ void PropagateUploadFileNG::startNextChunk()
     }
 
     QMap<QByteArray, QByteArray> headers;
-    headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
+    headers["OC-Chunk-Offset"] = QByteArray::number(offset);
 
-    _sent += _currentChunkSize;
-    QUrl url = chunkUrl(_currentChunk);
+    _sent = offset + _currentChunkSize;
+    QUrl url = chunkUrl(chunkName);
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
     PUTFileJob *job = new PUTFileJob(propagator()->account(), url, device, headers, _currentChunk, this);
@@ -327,8 +440,6 @@ void PropagateUploadFileNG::startNextChunk()
     connect(job, &PUTFileJob::finishedSignal, this, &PropagateUploadFileNG::slotPutFinished);
     connect(job, &PUTFileJob::uploadProgress,
         this, &PropagateUploadFileNG::slotUploadProgress);
-    connect(job, SIGNAL(uploadProgress(qint64, qint64)),
-        device, SLOT(slotJobUploadProgress(qint64, qint64)));
     connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
     job->start();
     propagator()->_activeJobList.append(this);
@@ -390,7 +501,7 @@ void PropagateUploadFileNG::slotPutFinished()
                                   << propagator()->_chunkSize << "bytes";
     }
 
-    bool finished = _sent == _item->_size;
+    bool finished = _deltaSync ? _currentChunk >= _changedBlocks.size() : _sent == _item->_size;
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->getFilePath(_item->_file));
@@ -437,6 +548,10 @@ void PropagateUploadFileNG::slotMoveJobFinished()
     _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
     if (err != QNetworkReply::NoError) {
+        if (_deltaSync && _item->_httpErrorCode >= 400 && _item->_httpErrorCode < 500) {
+            // The server could not use the previous version, next time upload everything
+            propagator()->_journal->setBlockChecksums(_item->_file, SyncJournalDb::BlockChecksums());
+        }
         commonErrorHandling(job);
         return;
     }
@@ -467,6 +582,18 @@ void PropagateUploadFileNG::slotMoveJobFinished()
     }
     _item->_responseTimeStamp = job->responseTimestamp();
 
+    // Remember the block checksums of what was uploaded, for the next delta sync.
+    // If the file changed meanwhile they may not match what the server has.
+    SyncJournalDb::BlockChecksums blocks;
+    if (_blockSize > 0
+        && FileSystem::verifyFileUnchanged(propagator()->getFilePath(_item->_file), _item->_size, _item->_modtime)) {
+        blocks._valid = true;
+        blocks._etag = _item->_etag;
+        blocks._blockSize = _blockSize;
+        blocks._checksums = _blockChecksums;
+    }
+    propagator()->_journal->setBlockChecksums(_item->_file, blocks);
+
 #ifdef WITH_TESTING
     // performance logging
     quint64 duration = _stopWatch.stop();
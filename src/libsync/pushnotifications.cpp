@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "pushnotifications.h"
+#include "account.h"
+#include "networkjobs.h"
+#include "common/utility.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QNetworkReply>
+#include <QUrlQuery>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcPushNotifications, "sync.pushnotifications", QtInfoMsg)
+
+// Reconnection attempts back off exponentially between these bounds
+static const int minRetryIntervalMsec = 5 * 1000;
+static const int maxRetryIntervalMsec = 5 * 60 * 1000;
+
+PushNotifications::PushNotifications(AccountPtr account, const QString &path, QObject *parent)
+    : QObject(parent)
+    , _account(account)
+    , _path(path)
+    , _failures(0)
+    , _connected(false)
+    , _missedChanges(false)
+{
+    _retryTimer.setSingleShot(true);
+    connect(&_retryTimer, &QTimer::timeout, this, &PushNotifications::slotPoll);
+}
+
+PushNotifications::~PushNotifications()
+{
+    stop();
+}
+
+void PushNotifications::start()
+{
+    qCInfo(lcPushNotifications) << "Listening for changes of" << _account->displayName() << "at" << _path;
+    _failures = 0;
+    slotPoll();
+}
+
+void PushNotifications::stop()
+{
+    _retryTimer.stop();
+    if (_job) {
+        disconnect(_job.data(), 0, this, 0);
+        // The job deletes itself once the reply finished
+        if (_job->reply()) {
+            _job->reply()->abort();
+        }
+        _job = 0;
+    }
+    setConnected(false);
+}
+
+void PushNotifications::slotPoll()
+{
+    if (_job) {
+        return;
+    }
+
+    QUrl url = Utility::concatUrlPath(_account->url(), _path);
+    QUrlQuery query;
+    query.addQueryItem(QLatin1String("cursor"), _cursor);
+    query.addQueryItem(QLatin1String("timeout"), QString::number(longPollTimeoutSec));
+    url.setQuery(query);
+
+    QNetworkRequest req;
+    req.setRawHeader("OCS-APIREQUEST", "true");
+
+    _job = new SimpleNetworkJob(_account, this);
+    // Give the server some slack on top of the time it may hold the request
+    _job->setTimeout((longPollTimeoutSec + 30) * 1000);
+    connect(_job.data(), &SimpleNetworkJob::finishedSignal, this, &PushNotifications::slotPollFinished);
+    _job->startRequest("GET", url, req);
+}
+
+void PushNotifications::slotPollFinished(QNetworkReply *reply)
+{
+    _job = 0;
+
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (httpCode == 410) {
+        if (_cursor.isEmpty()) {
+            // Even starting over is refused, don't hammer the server
+            qCWarning(lcPushNotifications) << "Change notification request without cursor refused";
+            retryLater();
+            return;
+        }
+        qCInfo(lcPushNotifications) << "Change cursor expired, everything might have changed";
+        _cursor.clear();
+        _missedChanges = true;
+        slotPoll();
+        return;
+    }
+
+    if (reply->error() != QNetworkReply::NoError || httpCode != 200) {
+        qCWarning(lcPushNotifications) << "Change notification request failed:" << httpCode << reply->errorString();
+        retryLater();
+        return;
+    }
+
+    QJsonParseError error;
+    const QJsonObject json = QJsonDocument::fromJson(reply->readAll(), &error).object();
+    if (error.error != QJsonParseError::NoError || !json.contains(QLatin1String("cursor"))) {
+        qCWarning(lcPushNotifications) << "Invalid change notification:" << error.errorString();
+        retryLater();
+        return;
+    }
+
+    const bool hadCursor = !_cursor.isEmpty();
+    _cursor = json.value(QLatin1String("cursor")).toString();
+    _failures = 0;
+    setConnected(true);
+
+    QStringList changed;
+    if (hadCursor) {
+        foreach (const QJsonValue &path, json.value(QLatin1String("changed")).toArray()) {
+            changed.append(path.toString());
+        }
+    }
+    if (_missedChanges) {
+        // Polling covered the gap only partially
+        changed = QStringList(QLatin1String("/"));
+        _missedChanges = false;
+    }
+    if (!changed.isEmpty()) {
+        qCInfo(lcPushNotifications) << "Server reported changes in" << changed;
+        emit filesChanged(changed);
+    }
+
+    slotPoll();
+}
+
+void PushNotifications::retryLater()
+{
+    setConnected(false);
+    if (!_cursor.isEmpty()) {
+        _missedChanges = true;
+    }
+    const int interval = qMin(maxRetryIntervalMsec, minRetryIntervalMsec << qMin(_failures, 10));
+    ++_failures;
+    _retryTimer.start(interval);
+}
+
+void PushNotifications::setConnected(bool connected)
+{
+    if (_connected == connected) {
+        return;
+    }
+    _connected = connected;
+    emit connectedChanged(connected);
+}
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+#include "accountfwd.h"
+
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+#include <QTimer>
+
+class QNetworkReply;
+
+namespace OCC {
+
+class SimpleNetworkJob;
+
+/**
+ * @brief Long-poll channel over which the server announces remote changes
+ *
+ * Keeps one GET request to the endpoint advertised by the server (see
+ * Capabilities::pushNotificationsPath()) open at all times:
+ *
+ *   GET <path>?cursor=<cursor>&timeout=<seconds>
+ *
+ * The server answers once something changed after the cursor, or with an
+ * empty list when the timeout expired:
+ *
+ *   { "cursor": "<new cursor>", "changed": [ "/remote/path", ... ] }
+ *
+ * The paths are relative to the user's files, like Folder::remotePath().
+ * An empty cursor asks for the current one without reporting changes.
+ * A 410 reply means the cursor is too old: everything might have changed.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT PushNotifications : public QObject
+{
+    Q_OBJECT
+public:
+    PushNotifications(AccountPtr account, const QString &path, QObject *parent = 0);
+    ~PushNotifications();
+
+    void start();
+    void stop();
+
+    /// Whether the last request succeeded, i.e. changes are being delivered
+    bool isConnected() const { return _connected; }
+
+    /// How long the server may hold a request, in seconds
+    static const int longPollTimeoutSec = 5 * 60;
+
+signals:
+    /// The remote paths that changed, "/" if anything could have changed
+    void filesChanged(const QStringList &remotePaths);
+    void connectedChanged(bool connected);
+
+private slots:
+    void slotPoll();
+    void slotPollFinished(QNetworkReply *reply);
+
+private:
+    void setConnected(bool connected);
+    void retryLater();
+
+    AccountPtr _account;
+    QString _path;
+    QString _cursor;
+    QPointer<SimpleNetworkJob> _job;
+    QTimer _retryTimer;
+    int _failures;
+    bool _connected;
+    bool _missedChanges; // there was a gap in the notifications
+};
+}
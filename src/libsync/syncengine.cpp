@@ -19,6 +19,7 @@
 #include "common/syncjournaldb.h"
 #include "common/syncjournalfilerecord.h"
 #include "discoveryphase.h"
+#include "pathprefixset.h"
 #include "creds/abstractcredentials.h"
 #include "syncfilestatus.h"
 #include "csync_private.h"
@@ -56,7 +57,10 @@ namespace OCC {
 Q_LOGGING_CATEGORY(lcEngine, "sync.engine", QtInfoMsg)
 
 static const int s_touchedFilesMaxAgeMs = 15 * 1000;
-bool SyncEngine::s_anySyncRunning = false;
+
+// While propagating, the journal commits at most that often
+static const int s_journalGroupCommitIntervalMs = 1000;
+int SyncEngine::s_runningSyncCount = 0;
 
 qint64 SyncEngine::minimumFileAgeForUpload = 2000;
 
@@ -210,9 +214,12 @@ bool SyncEngine::checkErrorBlacklisting(SyncFileItem &item)
         return false;
     }
 
-    SyncJournalErrorBlacklistRecord entry = _journal->errorBlacklistEntry(item._file);
     item._hasBlacklistEntry = false;
+    if (_errorBlacklist.isEmpty()) {
+        return false;
+    }
 
+    SyncJournalErrorBlacklistRecord entry = _errorBlacklist.value(SyncJournalDb::errorBlacklistKey(item._file));
     if (!entry.isValid()) {
         return false;
     }
@@ -317,15 +324,21 @@ void SyncEngine::deleteStaleUploadInfos(const SyncFileItemVector &syncItems)
 
 void SyncEngine::deleteStaleErrorBlacklistEntries(const SyncFileItemVector &syncItems)
 {
-    // Find all blacklisted paths that we want to preserve.
-    QSet<QString> blacklist_file_paths;
+    // The entries of the items that were checked against the blacklist are
+    // preserved, all others are stale.
+    QHash<QString, SyncJournalErrorBlacklistRecord> stale;
+    stale.swap(_errorBlacklist);
     foreach (const SyncFileItemPtr &it, syncItems) {
         if (it->_hasBlacklistEntry)
-            blacklist_file_paths.insert(it->_file);
+            stale.remove(SyncJournalDb::errorBlacklistKey(it->_file));
     }
 
     // Delete from journal.
-    _journal->deleteStaleErrorBlacklistEntries(blacklist_file_paths);
+    QStringList stalePaths;
+    foreach (const SyncJournalErrorBlacklistRecord &entry, stale) {
+        stalePaths.append(entry._file);
+    }
+    _journal->deleteErrorBlacklistEntries(stalePaths);
 }
 
 int SyncEngine::treewalkLocal(csync_file_stat_t *file, csync_file_stat_t *other, void *data)
@@ -430,11 +443,11 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
         item->_serverHasIgnoredFiles = file->has_ignored_files;
     }
 
-    // record the seen files to be able to clean the journal later
-    _seenFiles.insert(item->_file);
+    // record the seen files to mark them in the journal, the others get cleaned up after the sync
+    _seenPHashes.append(SyncJournalDb::getPHash(item->_file));
     if (!renameTarget.isEmpty()) {
         // Yes, this records both the rename renameTarget and the original so we keep both in case of a rename
-        _seenFiles.insert(renameTarget);
+        _seenPHashes.append(SyncJournalDb::getPHash(renameTarget));
     }
 
     switch (file->error_status) {
@@ -738,12 +751,13 @@ void SyncEngine::startSync()
         }
     }
 
-    if (s_anySyncRunning || _syncRunning) {
+    if (_syncRunning) {
         ASSERT(false);
         return;
     }
 
-    s_anySyncRunning = true;
+    ++s_runningSyncCount;
+    qCInfo(lcEngine) << "Syncs running:" << s_runningSyncCount;
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
     _clearTouchedFilesTimer.stop();
@@ -936,9 +950,10 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _hasForwardInTimeFiles = false;
     _backInTimeFiles = 0;
     bool walkOk = true;
-    _seenFiles.clear();
     _temporarilyUnavailablePaths.clear();
     _renamedFolders.clear();
+    _journal->startSyncGeneration();
+    _errorBlacklist = _journal->errorBlacklistEntries();
 
     if (csync_walk_local_tree(_csync_ctx.data(), &treewalkLocal, 0) < 0) {
         qCWarning(lcEngine) << "Error in local treewalk.";
@@ -947,6 +962,9 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     if (walkOk && csync_walk_remote_tree(_csync_ctx.data(), &treewalkRemote, 0) < 0) {
         qCWarning(lcEngine) << "Error in remote treewalk.";
     }
+    _journal->markFileRecordsSeen(_seenPHashes);
+    _seenPHashes.clear();
+    _seenPHashes.squeeze();
 
     qCInfo(lcEngine) << "Permissions of the root folder: " << _csync_ctx->remote.root_perms.toString();
 
@@ -1040,6 +1058,8 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _propagator = QSharedPointer<OwncloudPropagator>(
         new OwncloudPropagator(_account, _localPath, _remotePath, _journal));
     _propagator->setSyncOptions(_syncOptions);
+    _propagator->setPriorityPaths(_priorityPaths);
+    _priorityPaths.clear();
     connect(_propagator.data(), &OwncloudPropagator::itemCompleted,
         this, &SyncEngine::slotItemCompleted);
     connect(_propagator.data(), &OwncloudPropagator::progress,
@@ -1058,6 +1078,10 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     deleteStaleErrorBlacklistEntries(syncItems);
     _journal->commit("post stale entry removal");
 
+    // Every finished item commits the journal; merge these commits, an
+    // interrupted sync just redoes the few items that were not committed.
+    _journal->setGroupCommitInterval(s_journalGroupCommitIntervalMs);
+
     // Emit the started signal only after the propagator has been set up.
     if (_needsUpdate)
         emit(started());
@@ -1115,7 +1139,7 @@ void SyncEngine::slotFinished(bool success)
     }
 
     // emit the treewalk results.
-    if (!_journal->postSyncCleanup(_seenFiles, _temporarilyUnavailablePaths)) {
+    if (!_journal->postSyncCleanup(_temporarilyUnavailablePaths)) {
         qCDebug(lcEngine) << "Cleaning of synced ";
     }
 
@@ -1137,21 +1161,22 @@ void SyncEngine::finalize(bool success)
     _thread.wait();
 
     _csync_ctx->reinitialize();
+    _journal->setGroupCommitInterval(0);
     _journal->close();
 
     qCInfo(lcEngine) << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished")) << "ms";
     _stopWatch.stop();
 
-    s_anySyncRunning = false;
+    --s_runningSyncCount;
     _syncRunning = false;
     emit finished(success);
 
     // Delete the propagator only after emitting the signal.
     _propagator.clear();
-    _seenFiles.clear();
     _temporarilyUnavailablePaths.clear();
     _renamedFolders.clear();
     _uniqueErrors.clear();
+    _errorBlacklist.clear();
 
     _clearTouchedFilesTimer.start();
 }
@@ -1184,8 +1209,8 @@ QString SyncEngine::adjustRenamedPath(const QString &original)
 void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
 {
     bool selectiveListOk;
-    auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &selectiveListOk);
-    std::sort(selectiveSyncBlackList.begin(), selectiveSyncBlackList.end());
+    const PathPrefixSet selectiveSyncBlackList(
+        _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &selectiveListOk));
     SyncFileItemPtr needle;
 
     for (SyncFileItemVector::iterator it = syncItems.begin(); it != syncItems.end(); ++it) {
@@ -1198,8 +1223,7 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
         const QString path = (*it)->destination() + QLatin1Char('/');
 
         // if reading the selective sync list from db failed, lets ignore all rather than nothing.
-        if (!selectiveListOk || std::binary_search(selectiveSyncBlackList.constBegin(), selectiveSyncBlackList.constEnd(),
-                                    path)) {
+        if (!selectiveListOk || selectiveSyncBlackList.contains(path)) {
             (*it)->_instruction = CSYNC_INSTRUCTION_IGNORE;
             (*it)->_status = SyncFileItem::FileIgnored;
             (*it)->_errorString = tr("Ignored because of the \"choose what to sync\" blacklist");
@@ -1528,27 +1552,33 @@ void SyncEngine::slotAddTouchedFile(const QString &fn)
             break;
         }
 
+        // Only forget the path if it wasn't touched again since
+        auto latest = _touchedFileTimes.find(first.value());
+        if (latest != _touchedFileTimes.end() && latest.value() == first.key().msecsSinceReference())
+            _touchedFileTimes.erase(latest);
         _touchedFiles.erase(first);
     }
 
     // This should be the largest QElapsedTimer yet, use constEnd() as hint.
     _touchedFiles.insert(_touchedFiles.constEnd(), now, file);
+    _touchedFileTimes.insert(file, now.msecsSinceReference());
 }
 
 void SyncEngine::slotClearTouchedFiles()
 {
     _touchedFiles.clear();
+    _touchedFileTimes.clear();
 }
 
 bool SyncEngine::wasFileTouched(const QString &fn) const
 {
-    // Start from the end (most recent) and look for our path. Check the time just in case.
-    auto begin = _touchedFiles.constBegin();
-    for (auto it = _touchedFiles.constEnd(); it != begin; --it) {
-        if ((it-1).value() == fn)
-            return (it-1).key().elapsed() <= s_touchedFilesMaxAgeMs;
-    }
-    return false;
+    auto latest = _touchedFileTimes.constFind(fn);
+    if (latest == _touchedFileTimes.constEnd())
+        return false;
+    // Check the time just in case.
+    QElapsedTimer now;
+    now.start();
+    return now.msecsSinceReference() - latest.value() <= s_touchedFilesMaxAgeMs;
 }
 
 AccountPtr SyncEngine::account() const
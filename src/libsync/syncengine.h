@@ -23,6 +23,7 @@
 #include <QString>
 #include <QSet>
 #include <QMap>
+#include <QHash>
 #include <QStringList>
 #include <QSharedPointer>
 
@@ -39,6 +40,7 @@
 #include "accountfwd.h"
 #include "discoveryphase.h"
 #include "common/checksums.h"
+#include "common/syncjournalfilerecord.h"
 
 class QProcess;
 
@@ -70,6 +72,8 @@ public:
 
     Q_INVOKABLE void startSync();
     void setNetworkLimits(int upload, int download);
+    int uploadLimit() const { return _uploadLimit; }
+    int downloadLimit() const { return _downloadLimit; }
 
     /* Abort the sync.  Called from the main thread */
     void abort();
@@ -89,6 +93,13 @@ public:
 
     bool wasFileTouched(const QString &fn) const;
 
+    /** Propagates this file before the others in the next sync
+     *
+     * For files the user is likely waiting for, like the ones they just
+     * changed. The path is relative to the sync root.
+     */
+    void addPriorityPath(const QString &relativePath) { _priorityPaths.insert(relativePath); }
+
     AccountPtr account() const;
     SyncJournalDb *journal() const { return _journal; }
     QString localPath() const { return _localPath; }
@@ -188,7 +199,7 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
+    static int s_runningSyncCount; // number of syncs running somewhere (for debugging)
 
     // Must only be acessed during update and reconcile
     QMap<QString, SyncFileItemPtr> _syncItemMap;
@@ -204,9 +215,9 @@ private:
     QPointer<DiscoveryMainThread> _discoveryMainThread;
     QSharedPointer<OwncloudPropagator> _propagator;
 
-    // After a sync, only the syncdb entries whose filenames appear in this
-    // set will be kept. See _temporarilyUnavailablePaths.
-    QSet<QString> _seenFiles;
+    // The path hashes of the files the treewalk saw, marked in the journal
+    // all at once after it. The entries of the others are removed after the sync.
+    QVector<qint64> _seenPHashes;
 
     // Some paths might be temporarily unavailable on the server, for
     // example due to 503 Storage not available. Deleting information
@@ -218,6 +229,11 @@ private:
     // while the remote says storage not available.
     QSet<QString> _temporarilyUnavailablePaths;
 
+    // The error blacklist entries as they were before the treewalk, so
+    // checkErrorBlacklisting() doesn't need to query the journal for every
+    // item. Keyed by SyncJournalDb::errorBlacklistKey().
+    QHash<QString, SyncJournalErrorBlacklistRecord> _errorBlacklist;
+
     QThread _thread;
 
     QScopedPointer<ProgressInfo> _progressInfo;
@@ -267,9 +283,15 @@ private:
     /** Stores the time since a job touched a file. */
     QMultiMap<QElapsedTimer, QString> _touchedFiles;
 
+    /** Index of _touchedFiles: path -> msecsSinceReference() of the latest touch */
+    QHash<QString, qint64> _touchedFileTimes;
+
     /** For clearing the _touchedFiles variable after sync finished */
     QTimer _clearTouchedFilesTimer;
 
+    /** Files to propagate first in the next sync, see addPriorityPath() */
+    QSet<QString> _priorityPaths;
+
     /** List of unique errors that occurred in a sync run. */
     QSet<QString> _uniqueErrors;
 };
@@ -21,6 +21,9 @@
 
 #include <QLoggingCategory>
 
+#include <algorithm>
+#include <functional>
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcStatusTracker, "sync.statustracker", QtInfoMsg)
@@ -54,30 +57,78 @@ bool SyncFileStatusTracker::PathComparator::operator()( const QString& lhs, cons
     return pathCompare(lhs, rhs) < 0;
 }
 
-SyncFileStatus::SyncFileStatusTag SyncFileStatusTracker::lookupProblem(const QString &pathToMatch, const SyncFileStatusTracker::ProblemsMap &problemMap)
+// Key of a path segment in StatusNode::_children, matching pathCompare
+static inline QString segmentKey(const QStringRef &segment)
 {
-    auto lower = problemMap.lower_bound(pathToMatch);
-    for (auto it = lower; it != problemMap.cend(); ++it) {
-        const QString &problemPath = it->first;
-        SyncFileStatus::SyncFileStatusTag severity = it->second;
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+    return segment.toString().toCaseFolded();
+#else
+    return segment.toString();
+#endif
+}
 
-        if (pathCompare(problemPath, pathToMatch) == 0) {
-            return severity;
-        } else if (severity == SyncFileStatus::StatusError
-            && pathStartsWith(problemPath, pathToMatch)
-            && (pathToMatch.isEmpty() || problemPath.at(pathToMatch.size()) == '/')) {
-            return SyncFileStatus::StatusWarning;
-        } else if (!pathStartsWith(problemPath, pathToMatch)) {
-            // Starting at lower_bound we get the first path that is not smaller,
-            // since: "a/" < "a/aa" < "a/aa/aaa" < "a/ab/aba"
-            // If problemMap keys are ["a/aa/aaa", "a/ab/aba"] and pathToMatch == "a/aa",
-            // lower_bound(pathToMatch) will point to "a/aa/aaa", and the moment that
-            // problemPath.startsWith(pathToMatch) == false, we know that we've looked
-            // at everything that interest us.
-            break;
+int SyncFileStatusTracker::findNode(const QString &relativePath, bool create)
+{
+    int node = 0;
+    int start = 0;
+    while (start < relativePath.size()) {
+        int end = relativePath.indexOf(QLatin1Char('/'), start);
+        if (end < 0)
+            end = relativePath.size();
+        if (end > start) {
+            const QString key = segmentKey(relativePath.midRef(start, end - start));
+            int child = _nodes[node]._children.value(key, -1);
+            if (child < 0) {
+                if (!create)
+                    return -1;
+                child = _nodes.size();
+                _nodes[node]._children.insert(key, child);
+                _nodes.append(StatusNode(relativePath.left(end), node));
+            }
+            node = child;
         }
+        start = end + 1;
+    }
+    return node;
+}
+
+void SyncFileStatusTracker::resetNodes()
+{
+    ASSERT(_pendingStatusNodes.isEmpty());
+    _nodes.clear();
+    _nodes.append(StatusNode());
+}
+
+void SyncFileStatusTracker::setProblem(const QString &path, SyncFileStatus::SyncFileStatusTag severity)
+{
+    auto it = _syncProblems.find(path);
+    if (it != _syncProblems.end()) {
+        if (it->second == severity)
+            return;
+        if (it->second == SyncFileStatus::StatusError) {
+            for (int node = findNode(path, true); node >= 0; node = _nodes[node]._parent)
+                --_nodes[node]._errorCount;
+        }
+        it->second = severity;
+    } else {
+        _syncProblems[path] = severity;
+    }
+    if (severity == SyncFileStatus::StatusError) {
+        for (int node = findNode(path, true); node >= 0; node = _nodes[node]._parent)
+            ++_nodes[node]._errorCount;
     }
-    return SyncFileStatus::StatusNone;
+}
+
+void SyncFileStatusTracker::clearProblem(const QString &path)
+{
+    auto it = _syncProblems.find(path);
+    if (it == _syncProblems.end())
+        return;
+    if (it->second == SyncFileStatus::StatusError) {
+        for (int node = findNode(path, true); node >= 0; node = _nodes[node]._parent)
+            --_nodes[node]._errorCount;
+    }
+    _syncProblems.erase(it);
 }
 
 /**
@@ -111,6 +162,7 @@ static inline bool showWarningInSocketApi(const SyncFileItem &item)
 SyncFileStatusTracker::SyncFileStatusTracker(SyncEngine *syncEngine)
     : _syncEngine(syncEngine)
 {
+    resetNodes();
     connect(syncEngine, &SyncEngine::aboutToPropagate,
         this, &SyncFileStatusTracker::slotAboutToPropagate);
     connect(syncEngine, &SyncEngine::itemCompleted,
@@ -126,32 +178,145 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
 
     if (relativePath.isEmpty()) {
         // This is the root sync folder, it doesn't have an entry in the database and won't be walked by csync, so resolve manually.
-        return resolveSyncAndErrorStatus(QString(), NotShared);
+        return resolveSyncAndErrorStatus(0, QString(), NotShared);
+    }
+
+    return resolveStatus(findNode(relativePath, false), relativePath, pathState(relativePath));
+}
+
+QVector<SyncFileStatus> SyncFileStatusTracker::fileStatuses(const QStringList &relativePaths)
+{
+    // Collect the paths that need the journal, so that it's queried only once
+    QStringList uncachedPaths;
+    foreach (const QString &relativePath, relativePaths) {
+        if (relativePath.isEmpty() || _pathStateCache.count(relativePath))
+            continue;
+        if (lookupExcluded(relativePath))
+            cachePathState(relativePath, PathExcluded);
+        else
+            uncachedPaths.append(relativePath);
+    }
+
+    if (!uncachedPaths.isEmpty()) {
+        const QVector<SyncJournalFileRecord> records = _syncEngine->journal()->getFileRecords(uncachedPaths);
+        for (int i = 0; i < uncachedPaths.size(); ++i) {
+            const SyncJournalFileRecord &rec = records.at(i);
+            PathState state = PathNotInJournal;
+            if (rec.isValid()) {
+                state = rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? PathInJournalShared : PathInJournal;
+            }
+            cachePathState(uncachedPaths.at(i), state);
+        }
+    }
+
+    QVector<SyncFileStatus> statuses;
+    statuses.reserve(relativePaths.size());
+    foreach (const QString &relativePath, relativePaths) {
+        statuses.append(fileStatus(relativePath));
+    }
+    return statuses;
+}
+
+SyncFileStatusTracker::PathState SyncFileStatusTracker::pathState(const QString &relativePath)
+{
+    auto cached = _pathStateCache.find(relativePath);
+    if (cached != _pathStateCache.end())
+        return cached->second;
+
+    PathState state = PathExcluded;
+    if (!lookupExcluded(relativePath)) {
+        // Look it up in the database to know if it's shared
+        SyncJournalFileRecord rec = _syncEngine->journal()->getFileRecord(relativePath);
+        if (!rec.isValid())
+            state = PathNotInJournal;
+        else if (rec._remotePerm.hasPermission(RemotePermissions::IsShared))
+            state = PathInJournalShared;
+        else
+            state = PathInJournal;
     }
+    cachePathState(relativePath, state);
+    return state;
+}
 
+bool SyncFileStatusTracker::lookupExcluded(const QString &relativePath)
+{
     // The SyncEngine won't notify us at all for CSYNC_FILE_SILENTLY_EXCLUDED
     // and CSYNC_FILE_EXCLUDE_AND_REMOVE excludes. Even though it's possible
     // that the status of CSYNC_FILE_EXCLUDE_LIST excludes will change if the user
     // update the exclude list at runtime and doing it statically here removes
     // our ability to notify changes through the fileStatusChanged signal,
     // it's an acceptable compromize to treat all exclude types the same.
-    if (_syncEngine->excludedFiles().isExcluded(_syncEngine->localPath() + relativePath,
-            _syncEngine->localPath(),
-            _syncEngine->ignoreHiddenFiles())) {
-        return SyncFileStatus(SyncFileStatus::StatusWarning);
+    return _syncEngine->excludedFiles().isExcluded(_syncEngine->localPath() + relativePath,
+        _syncEngine->localPath(),
+        _syncEngine->ignoreHiddenFiles());
+}
+
+void SyncFileStatusTracker::cachePathState(const QString &relativePath, PathState state)
+{
+    // Keep the memory bounded when a huge tree is being browsed, starting over
+    // is cheap compared to what a single miss costs anyway.
+    static const size_t maximumCachedPaths = 100000;
+    if (_pathStateCache.size() >= maximumCachedPaths)
+        _pathStateCache.clear();
+    _pathStateCache[relativePath] = state;
+}
+
+void SyncFileStatusTracker::invalidatePathState(const QString &relativePath, bool recursive)
+{
+    auto it = _pathStateCache.lower_bound(relativePath);
+    if (it != _pathStateCache.end() && pathCompare(it->first, relativePath) == 0)
+        it = _pathStateCache.erase(it);
+    if (!recursive)
+        return;
+    if (relativePath.isEmpty()) {
+        _pathStateCache.clear();
+        return;
+    }
+    // Since "a" < "a b" < "a/aa" < "a/ab", everything starting with the path is
+    // contiguous in the map, children included
+    while (it != _pathStateCache.end() && pathStartsWith(it->first, relativePath)) {
+        if (it->first.size() > relativePath.size() && it->first.at(relativePath.size()) == QLatin1Char('/'))
+            it = _pathStateCache.erase(it);
+        else
+            ++it;
     }
+}
+
+void SyncFileStatusTracker::invalidateItemPathStates(const SyncFileItem &item)
+{
+    // Whatever was below a removed or moved folder is gone as well
+    const bool recursive = item.isDirectory()
+        && (item._instruction == CSYNC_INSTRUCTION_REMOVE
+               || item._instruction == CSYNC_INSTRUCTION_RENAME
+               || item._instruction == CSYNC_INSTRUCTION_TYPE_CHANGE);
+    invalidatePathState(item._file, recursive);
+    if (item.destination() != item._file)
+        invalidatePathState(item.destination(), recursive);
+}
+
+SyncFileStatus SyncFileStatusTracker::resolveStatus(int node, const QString &relativePath, PathState state)
+{
+    if (state == PathExcluded)
+        return SyncFileStatus(SyncFileStatus::StatusWarning);
 
     if (_dirtyPaths.contains(relativePath))
         return SyncFileStatus::StatusSync;
 
-    // First look it up in the database to know if it's shared
-    SyncJournalFileRecord rec = _syncEngine->journal()->getFileRecord(relativePath);
-    if (rec.isValid()) {
-        return resolveSyncAndErrorStatus(relativePath, rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
+    if (state == PathNotInJournal) {
+        // Must be a new file not yet in the database, check if it's syncing or has an error.
+        return resolveSyncAndErrorStatus(node, relativePath, NotShared, PathUnknown);
     }
+    return resolveSyncAndErrorStatus(node, relativePath, state == PathInJournalShared ? Shared : NotShared);
+}
 
-    // Must be a new file not yet in the database, check if it's syncing or has an error.
-    return resolveSyncAndErrorStatus(relativePath, NotShared, PathUnknown);
+SyncFileStatus SyncFileStatusTracker::nodeStatus(int node, SharedFlag sharedFlag)
+{
+    const QString &relativePath = _nodes[node]._path;
+    if (sharedFlag != UnknownShared)
+        return resolveSyncAndErrorStatus(node, relativePath, sharedFlag);
+    if (relativePath.isEmpty())
+        return resolveSyncAndErrorStatus(node, relativePath, NotShared);
+    return resolveStatus(node, relativePath, pathState(relativePath));
 }
 
 void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
@@ -161,69 +326,59 @@ void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
     ASSERT(fileName.startsWith(folderPath));
     QString localPath = fileName.mid(folderPath.size());
     _dirtyPaths.insert(localPath);
+    // The file might have been created, removed or replaced by a folder
+    invalidatePathState(localPath, true);
 
     emit fileStatusChanged(fileName, SyncFileStatus::StatusSync);
 }
 
-void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
+void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(int node, SharedFlag sharedFlag)
 {
-    // Will return 0 (and increase to 1) if the path wasn't in the map yet
-    int count = _syncCount[relativePath]++;
+    // Will return 0 (and increase to 1) if the path wasn't syncing yet
+    int count = _nodes[node]._syncCount++;
     if (!count) {
-        SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
+        emit fileStatusChanged(getSystemDestination(_nodes[node]._path), nodeStatus(node, sharedFlag));
 
         // We passed from OK to SYNC, increment the parent to keep it marked as
         // SYNC while we propagate ourselves and our own children.
-        ASSERT(!relativePath.endsWith('/'));
-        int lastSlashIndex = relativePath.lastIndexOf('/');
-        if (lastSlashIndex != -1)
-            incSyncCountAndEmitStatusChanged(relativePath.left(lastSlashIndex), UnknownShared);
-        else if (!relativePath.isEmpty())
-            incSyncCountAndEmitStatusChanged(QString(), UnknownShared);
+        int parent = _nodes[node]._parent;
+        if (parent >= 0)
+            incSyncCountAndEmitStatusChanged(parent, UnknownShared);
     }
 }
 
-void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
+void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(int node, SharedFlag sharedFlag)
 {
-    int count = --_syncCount[relativePath];
+    int count = --_nodes[node]._syncCount;
     if (!count) {
-        // Remove from the map, same as 0
-        _syncCount.remove(relativePath);
-
-        SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
+        emit fileStatusChanged(getSystemDestination(_nodes[node]._path), nodeStatus(node, sharedFlag));
 
         // We passed from SYNC to OK, decrement our parent.
-        ASSERT(!relativePath.endsWith('/'));
-        int lastSlashIndex = relativePath.lastIndexOf('/');
-        if (lastSlashIndex != -1)
-            decSyncCountAndEmitStatusChanged(relativePath.left(lastSlashIndex), UnknownShared);
-        else if (!relativePath.isEmpty())
-            decSyncCountAndEmitStatusChanged(QString(), UnknownShared);
+        int parent = _nodes[node]._parent;
+        if (parent >= 0)
+            decSyncCountAndEmitStatusChanged(parent, UnknownShared);
     }
 }
 
 void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
 {
-    ASSERT(_syncCount.isEmpty());
+    ASSERT(_nodes[0]._syncCount == 0);
 
+    // The error counts of the old problems go away with the nodes
     ProblemsMap oldProblems;
     std::swap(_syncProblems, oldProblems);
+    resetNodes();
 
     foreach (const SyncFileItemPtr &item, items) {
         qCDebug(lcStatusTracker) << "Investigating" << item->destination() << item->_status << item->_instruction;
         _dirtyPaths.remove(item->destination());
+        invalidateItemPathStates(*item);
 
         if (showErrorInSocketApi(*item)) {
-            _syncProblems[item->_file] = SyncFileStatus::StatusError;
+            setProblem(item->_file, SyncFileStatus::StatusError);
             invalidateParentPaths(item->destination());
         } else if (showWarningInSocketApi(*item)) {
-            _syncProblems[item->_file] = SyncFileStatus::StatusWarning;
+            setProblem(item->_file, SyncFileStatus::StatusWarning);
         }
 
         SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
@@ -232,9 +387,10 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
             && item->_instruction != CSYNC_INSTRUCTION_IGNORE
             && item->_instruction != CSYNC_INSTRUCTION_ERROR) {
             // Mark this path as syncing for instructions that will result in propagation.
-            incSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
+            incSyncCountAndEmitStatusChanged(findNode(item->destination(), true), sharedFlag);
         } else {
-            emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+            emit fileStatusChanged(getSystemDestination(item->destination()),
+                resolveSyncAndErrorStatus(findNode(item->destination(), false), item->destination(), sharedFlag));
         }
     }
 
@@ -257,19 +413,24 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
             invalidateParentPaths(path);
         emit fileStatusChanged(getSystemDestination(path), fileStatus(path));
     }
+
+    emitPendingStatuses();
 }
 
 void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
 {
     qCDebug(lcStatusTracker) << "Item completed" << item->destination() << item->_status << item->_instruction;
 
+    // The journal was just updated for this item
+    invalidateItemPathStates(*item);
+
     if (showErrorInSocketApi(*item)) {
-        _syncProblems[item->_file] = SyncFileStatus::StatusError;
+        setProblem(item->_file, SyncFileStatus::StatusError);
         invalidateParentPaths(item->destination());
     } else if (showWarningInSocketApi(*item)) {
-        _syncProblems[item->_file] = SyncFileStatus::StatusWarning;
+        setProblem(item->_file, SyncFileStatus::StatusWarning);
     } else {
-        _syncProblems.erase(item->_file);
+        clearProblem(item->_file);
     }
 
     SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
@@ -278,39 +439,54 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
         && item->_instruction != CSYNC_INSTRUCTION_IGNORE
         && item->_instruction != CSYNC_INSTRUCTION_ERROR) {
         // decSyncCount calls *must* be symetric with incSyncCount calls in slotAboutToPropagate
-        decSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
+        decSyncCountAndEmitStatusChanged(findNode(item->destination(), true), sharedFlag);
     } else {
-        emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+        emit fileStatusChanged(getSystemDestination(item->destination()),
+            resolveSyncAndErrorStatus(findNode(item->destination(), false), item->destination(), sharedFlag));
     }
+
+    emitPendingStatuses();
 }
 
 void SyncFileStatusTracker::slotSyncFinished()
 {
     // Clear the sync counts to reduce the impact of unsymetrical inc/dec calls (e.g. when directory job abort)
-    QHash<QString, int> oldSyncCount;
-    std::swap(_syncCount, oldSyncCount);
-    for (auto it = oldSyncCount.begin(); it != oldSyncCount.end(); ++it)
-        emit fileStatusChanged(getSystemDestination(it.key()), fileStatus(it.key()));
+    QVector<int> oldSyncingNodes;
+    for (int node = _nodes.size() - 1; node >= 0; --node) {
+        if (_nodes[node]._syncCount) {
+            _nodes[node]._syncCount = 0;
+            oldSyncingNodes.append(node);
+        }
+    }
+    // Children come after their parents in _nodes, so this notifies them first
+    foreach (int node, oldSyncingNodes)
+        emit fileStatusChanged(getSystemDestination(_nodes[node]._path), nodeStatus(node, UnknownShared));
 }
 
 void SyncFileStatusTracker::slotSyncEngineRunningChanged()
 {
-    emit fileStatusChanged(getSystemDestination(QString()), resolveSyncAndErrorStatus(QString(), NotShared));
+    // The exclude list is reloaded when a sync starts, and a finished sync
+    // might have changed the journal in ways that weren't reported per item.
+    _pathStateCache.clear();
+
+    emit fileStatusChanged(getSystemDestination(QString()), resolveSyncAndErrorStatus(0, QString(), NotShared));
 }
 
-SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedFlag, PathKnownFlag isPathKnown)
+SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(int node, const QString &relativePath, SharedFlag sharedFlag, PathKnownFlag isPathKnown)
 {
     // If it's a new file and that we're not syncing it yet,
     // don't show any icon and wait for the filesystem watcher to trigger a sync.
     SyncFileStatus status(isPathKnown ? SyncFileStatus::StatusUpToDate : SyncFileStatus::StatusNone);
-    if (_syncCount.value(relativePath)) {
+    if (node >= 0 && _nodes[node]._syncCount) {
         status.set(SyncFileStatus::StatusSync);
     } else {
         // After a sync finished, we need to show the users issues from that last sync like the activity list does.
         // Also used for parent directories showing a warning for an error child.
-        SyncFileStatus::SyncFileStatusTag problemStatus = lookupProblem(relativePath, _syncProblems);
-        if (problemStatus != SyncFileStatus::StatusNone)
-            status.set(problemStatus);
+        auto problem = _syncProblems.find(relativePath);
+        if (problem != _syncProblems.end())
+            status.set(problem->second);
+        else if (node >= 0 && _nodes[node]._errorCount > 0)
+            status.set(SyncFileStatus::StatusWarning);
     }
 
     ASSERT(sharedFlag != UnknownShared,
@@ -323,10 +499,24 @@ SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &r
 
 void SyncFileStatusTracker::invalidateParentPaths(const QString &path)
 {
-    QStringList splitPath = path.split('/', QString::SkipEmptyParts);
-    for (int i = 0; i < splitPath.size(); ++i) {
-        QString parentPath = QStringList(splitPath.mid(0, i)).join(QLatin1String("/"));
-        emit fileStatusChanged(getSystemDestination(parentPath), fileStatus(parentPath));
+    // Parents are notified by emitPendingStatuses(), once for all the items of a batch
+    for (int node = _nodes[findNode(path, true)]._parent; node >= 0; node = _nodes[node]._parent) {
+        if (_nodes[node]._statusPending)
+            break; // so are its parents
+        _nodes[node]._statusPending = true;
+        _pendingStatusNodes.append(node);
+    }
+}
+
+void SyncFileStatusTracker::emitPendingStatuses()
+{
+    QVector<int> pendingNodes;
+    std::swap(_pendingStatusNodes, pendingNodes);
+    // Children come after their parents in _nodes, notify them first
+    std::sort(pendingNodes.begin(), pendingNodes.end(), std::greater<int>());
+    foreach (int node, pendingNodes) {
+        _nodes[node]._statusPending = false;
+        emit fileStatusChanged(getSystemDestination(_nodes[node]._path), nodeStatus(node, UnknownShared));
     }
 }
 
@@ -21,6 +21,7 @@
 #include "syncfilestatus.h"
 #include <map>
 #include <QSet>
+#include <QVector>
 
 namespace OCC {
 
@@ -38,6 +39,13 @@ public:
     explicit SyncFileStatusTracker(SyncEngine *syncEngine);
     SyncFileStatus fileStatus(const QString &relativePath);
 
+    /** Statuses of several paths at once, in the same order as \a relativePaths
+     *
+     * Equivalent to calling fileStatus() for each path, but the journal is
+     * only queried once for all the paths that aren't cached yet.
+     */
+    QVector<SyncFileStatus> fileStatuses(const QStringList &relativePaths);
+
 public slots:
     void slotPathTouched(const QString &fileName);
 
@@ -51,32 +59,90 @@ private slots:
     void slotSyncEngineRunningChanged();
 
 private:
-    struct PathComparator {
-        bool operator()( const QString& lhs, const QString& rhs ) const;
-    };
-    typedef std::map<QString, SyncFileStatus::SyncFileStatusTag, PathComparator> ProblemsMap;
-    SyncFileStatus::SyncFileStatusTag lookupProblem(const QString &pathToMatch, const ProblemsMap &problemMap);
-
     enum SharedFlag { UnknownShared,
         NotShared,
         Shared };
     enum PathKnownFlag { PathUnknown = 0,
         PathKnown };
-    SyncFileStatus resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedState, PathKnownFlag isPathKnown = PathKnown);
+
+    struct PathComparator {
+        bool operator()( const QString& lhs, const QString& rhs ) const;
+    };
+    typedef std::map<QString, SyncFileStatus::SyncFileStatusTag, PathComparator> ProblemsMap;
+    void setProblem(const QString &path, SyncFileStatus::SyncFileStatusTag severity);
+    void clearProblem(const QString &path);
+
+    /**
+     * The sync state of a path that the current sync run touched.
+     *
+     * The nodes form a tree of path segments, so that the parent folders of
+     * a path can be reached without building and hashing their paths.
+     */
+    struct StatusNode
+    {
+        StatusNode(const QString &path = QString(), int parent = -1)
+            : _path(path)
+            , _parent(parent)
+            , _syncCount(0)
+            , _errorCount(0)
+            , _statusPending(false)
+        {
+        }
+        QString _path;
+        int _parent; // index in _nodes, -1 for the root
+        QHash<QString, int> _children; // segment -> index in _nodes
+        // Counts the number direct children currently being synced (has unfinished propagation jobs).
+        // We'll show a file/directory as SYNC as long as its sync count is > 0.
+        // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
+        int _syncCount;
+        // Number of errors in _syncProblems for this path or below it, a folder
+        // shows a warning as long as one of its children has an error.
+        int _errorCount;
+        bool _statusPending; // whether it's in _pendingStatusNodes
+    };
+    /** Returns the index of the node for the path in _nodes, or -1 if there is none and create is false */
+    int findNode(const QString &relativePath, bool create);
+    void resetNodes();
+    SyncFileStatus nodeStatus(int node, SharedFlag sharedFlag);
+
+    SyncFileStatus resolveSyncAndErrorStatus(int node, const QString &relativePath, SharedFlag sharedState, PathKnownFlag isPathKnown = PathKnown);
+
+    // What the exclude list and the journal say about a path, the part of
+    // the status that is expensive to compute and rarely changes.
+    enum PathState { PathExcluded,
+        PathNotInJournal,
+        PathInJournal,
+        PathInJournalShared };
+    typedef std::map<QString, PathState, PathComparator> PathStateCache;
+    PathState pathState(const QString &relativePath);
+    bool lookupExcluded(const QString &relativePath);
+    void cachePathState(const QString &relativePath, PathState state);
+    void invalidatePathState(const QString &relativePath, bool recursive = false);
+    void invalidateItemPathStates(const SyncFileItem &item);
+    SyncFileStatus resolveStatus(int node, const QString &relativePath, PathState state);
 
     void invalidateParentPaths(const QString &path);
+    void emitPendingStatuses();
     QString getSystemDestination(const QString &relativePath);
-    void incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
-    void decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
+    void incSyncCountAndEmitStatusChanged(int node, SharedFlag sharedState);
+    void decSyncCountAndEmitStatusChanged(int node, SharedFlag sharedState);
 
     SyncEngine *_syncEngine;
 
     ProblemsMap _syncProblems;
     QSet<QString> _dirtyPaths;
-    // Counts the number direct children currently being synced (has unfinished propagation jobs).
-    // We'll show a file/directory as SYNC as long as its sync count is > 0.
-    // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
-    QHash<QString, int> _syncCount;
+    // Rebuilt for every sync run, _nodes[0] is the sync root and parents
+    // always come before their children.
+    QVector<StatusNode> _nodes;
+    // Parent folders whose status needs to be pushed once the current batch
+    // of items is processed, so that each gets a single notification.
+    QVector<int> _pendingStatusNodes;
+    // Avoids hitting the exclude list and the journal for every status request
+    // of the file manager. Entries are dropped whenever the sync engine or the
+    // folder watcher tell us something about the path, and everything is
+    // forgotten when a sync starts (the exclude list might have been reloaded)
+    // or finishes.
+    PathStateCache _pathStateCache;
 };
 }
 
@@ -0,0 +1,123 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QLocalSocket>
+#include <QTemporaryDir>
+
+#include "folderman.h"
+#include "account.h"
+#include "accountstate.h"
+#include "configfile.h"
+#include "theme.h"
+#include "creds/httpcredentials.h"
+
+using namespace OCC;
+
+// Sustained throughput of RETRIEVE_FILE_STATUS queries, the way a shell
+// extension sends them while the user scrolls through a large directory.
+
+static const int numFiles = 1000;
+static const int numQueries = 50000;
+
+class HttpCredentialsBench : public HttpCredentials
+{
+public:
+    HttpCredentialsBench()
+        : HttpCredentials("user", "secret")
+    {
+    }
+    void askFromUser() Q_DECL_OVERRIDE {}
+};
+
+// Sends the queries and waits until all of them got their answer, returns the
+// elapsed msecs and sets *answers to the number of STATUS lines received.
+static qint64 runQueries(QLocalSocket &socket, const QByteArray &queries, qint64 *answers)
+{
+    *answers = 0;
+    QByteArray incompleteLine;
+    QEventLoop loop;
+    QObject::connect(&socket, &QLocalSocket::readyRead, &loop, [&]() {
+        QByteArray data = incompleteLine + socket.readAll();
+        int start = 0;
+        for (int end = data.indexOf('\n'); end != -1; end = data.indexOf('\n', start)) {
+            const QByteArray line = QByteArray::fromRawData(data.constData() + start, end - start);
+            if (line.startsWith("STATUS:"))
+                ++*answers;
+            else if (line.startsWith("VERSION:"))
+                loop.quit(); // The answers come in order, this was the last one
+            start = end + 1;
+        }
+        incompleteLine = data.mid(start);
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    socket.write(queries + "VERSION:\n");
+    loop.exec();
+    return qMax(qint64(1), timer.elapsed());
+}
+
+int main(int argc, char *argv[])
+{
+    QTemporaryDir runtimeDir;
+    qputenv("XDG_RUNTIME_DIR", QFile::encodeName(runtimeDir.path()));
+    QCoreApplication app(argc, argv);
+    // Don't measure the logging of every message
+    QLoggingCategory::setFilterRules(QStringLiteral("gui.socketapi.info=false"));
+
+    QTemporaryDir dir;
+    ConfigFile::setConfDir(dir.path());
+    QDir(dir.path()).mkpath("ownCloud");
+    const QString folderPath = QDir(dir.path() + "/ownCloud").canonicalPath();
+    for (int i = 0; i < numFiles; ++i) {
+        QFile f(folderPath + "/file" + QString::number(i));
+        f.open(QFile::WriteOnly);
+    }
+
+    FolderMan folderMan;
+    AccountPtr account = Account::create();
+    account->setCredentials(new HttpCredentialsBench);
+    account->setUrl(QUrl("http://example.de"));
+    AccountStatePtr accountState(new AccountState(account));
+    FolderDefinition definition;
+    definition.localPath = folderPath;
+    definition.targetPath = "/";
+    definition.alias = "bench";
+    if (!folderMan.addFolder(accountState.data(), definition)) {
+        qWarning() << "Could not add the folder";
+        return -1;
+    }
+
+    QLocalSocket socket;
+    socket.connectToServer(runtimeDir.path() + "/" + Theme::instance()->appName() + "/socket");
+    if (!socket.waitForConnected(5000)) {
+        qWarning() << "Could not connect to the socket API" << socket.errorString();
+        return -1;
+    }
+
+    QByteArray queries;
+    for (int i = 0; i < numQueries; ++i)
+        queries += "RETRIEVE_FILE_STATUS:" + folderPath.toUtf8() + "/file" + QByteArray::number(i % numFiles) + "\n";
+    qint64 answers = 0;
+    // Once to fill the caches, then measured
+    runQueries(socket, queries, &answers);
+    qint64 elapsed = runQueries(socket, queries, &answers);
+    qDebug() << "RETRIEVE_FILE_STATUS:" << answers << "queries in" << elapsed << "ms,"
+             << answers * 1000 / elapsed << "queries/s";
+    if (answers != numQueries)
+        return -1;
+
+    QByteArray listingQueries;
+    for (int i = 0; i < numQueries / numFiles; ++i)
+        listingQueries += "RETRIEVE_FILE_STATUSES:" + folderPath.toUtf8() + "\n";
+    elapsed = runQueries(socket, listingQueries, &answers);
+    qDebug() << "RETRIEVE_FILE_STATUSES:" << answers << "statuses in" << elapsed << "ms,"
+             << answers * 1000 / elapsed << "statuses/s";
+
+    return answers >= numQueries ? 0 : -1;
+}
@@ -14,6 +14,8 @@
 #include "common/syncjournaldb.h"
 
 #include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkReply>
 #include <QMap>
 #include <QtTest>
@@ -27,6 +29,7 @@
 static const QUrl sRootUrl("owncloud://somehost/owncloud/remote.php/webdav/");
 static const QUrl sRootUrl2("owncloud://somehost/owncloud/remote.php/dav/files/admin/");
 static const QUrl sUploadUrl("owncloud://somehost/owncloud/remote.php/dav/uploads/admin/");
+static const QUrl sBulkUploadUrl("owncloud://somehost/owncloud/remote.php/dav/bulk");
 
 inline QString getFilePathFromUrl(const QUrl &url) {
     QString path = url.path();
@@ -436,7 +439,7 @@ public:
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
     }
 
-    Q_INVOKABLE void respond() {
+    Q_INVOKABLE virtual void respond() {
         emit uploadProgress(fileInfo->size, fileInfo->size);
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
@@ -450,6 +453,104 @@ public:
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+// The server side of OCC::BulkUploadJob: a multipart/related POST with one part per file
+class FakeBulkUploadReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    QByteArray payload;
+    int fileCount = 0;
+
+    FakeBulkUploadReply(FileInfo &remoteRootFileInfo, const QHash<QString, int> &errorPaths,
+        QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &body, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        const QByteArray contentType = request.rawHeader("Content-Type");
+        const QByteArray delimiter = "--" + contentType.mid(contentType.indexOf("boundary=") + 9);
+
+        QJsonObject results;
+        int pos = body.indexOf(delimiter);
+        while (pos >= 0 && body.mid(pos + delimiter.size(), 2) == "\r\n") {
+            pos += delimiter.size() + 2;
+
+            QHash<QByteArray, QByteArray> headers;
+            forever {
+                int eol = body.indexOf("\r\n", pos);
+                Q_ASSERT(eol >= 0);
+                QByteArray line = body.mid(pos, eol - pos);
+                pos = eol + 2;
+                if (line.isEmpty())
+                    break;
+                int colon = line.indexOf(':');
+                headers[line.left(colon).toLower()] = line.mid(colon + 1).trimmed();
+            }
+            const int length = headers["content-length"].toInt();
+            const QByteArray data = body.mid(pos, length);
+            pos = body.indexOf(delimiter, pos + length);
+
+            const QString remotePath = QUrl::fromPercentEncoding(headers["x-file-path"]);
+            const QString fileName = remotePath.mid(1); // strip the leading '/'
+            ++fileCount;
+
+            QJsonObject result;
+            if (errorPaths.contains(fileName)) {
+                result["error"] = true;
+                result["status"] = errorPaths[fileName];
+                result["message"] = QStringLiteral("Simulated error");
+                results[remotePath] = result;
+                continue;
+            }
+
+            // Assume that the file is filled with the same character
+            const char contentChar = data.isEmpty() ? 'W' : data.at(0);
+            FileInfo *fileInfo = remoteRootFileInfo.find(fileName, /*invalidateEtags=*/true);
+            if (fileInfo) {
+                fileInfo->size = data.size();
+                fileInfo->contentChar = contentChar;
+            } else {
+                fileInfo = remoteRootFileInfo.create(fileName, data.size(), contentChar);
+            }
+            fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(headers["x-oc-mtime"].toLongLong());
+
+            result["error"] = false;
+            result["status"] = 201;
+            result["etag"] = fileInfo->etag;
+            result["fileid"] = QString::fromUtf8(fileInfo->fileId);
+            result["checksum"] = QString::fromUtf8(headers["oc-checksum"]);
+            results[remotePath] = result;
+        }
+        payload = QJsonDocument(results).toJson();
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+
+    Q_INVOKABLE void respond() {
+        emit uploadProgress(payload.size(), payload.size());
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+        emit metaDataChanged();
+        if (bytesAvailable())
+            emit readyRead();
+        setFinished(true);
+        emit finished();
+    }
+
+    void abort() override { }
+    qint64 bytesAvailable() const override {
+        return payload.size() + QIODevice::bytesAvailable();
+    }
+
+    qint64 readData(char *data, qint64 maxlen) override {
+        qint64 len = std::min(qint64{payload.size()}, maxlen);
+        std::copy(payload.cbegin(), payload.cbegin() + len, data);
+        payload.remove(0, static_cast<int>(len));
+        return len;
+    }
+};
+
 class FakeMkcolReply : public QNetworkReply
 {
     Q_OBJECT
@@ -540,6 +641,57 @@ public:
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+class FakeCopyReply : public QNetworkReply
+{
+    Q_OBJECT
+    FileInfo *fileInfo = nullptr;
+public:
+    FakeCopyReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        QString fileName = getFilePathFromUrl(request.url());
+        Q_ASSERT(!fileName.isEmpty());
+        QString dest = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
+        Q_ASSERT(!dest.isEmpty());
+
+        int status = 201;
+        const FileInfo *source = remoteRootFileInfo.find(fileName);
+        if (!source || source->isDir) {
+            status = 404;
+        } else if (request.hasRawHeader("If-Match")
+            && request.rawHeader("If-Match") != '"' + source->etag.toLatin1() + '"') {
+            status = 412;
+        } else if (request.rawHeader("Overwrite") == "F" && remoteRootFileInfo.find(dest)) {
+            status = 412;
+        } else {
+            const qint64 size = source->size;
+            const char contentChar = source->contentChar;
+            fileInfo = remoteRootFileInfo.create(dest, size, contentChar);
+        }
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection, Q_ARG(int, status));
+    }
+
+    Q_INVOKABLE void respond(int status) {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
+        if (fileInfo) {
+            setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
+            setRawHeader("ETag", fileInfo->etag.toLatin1());
+            setRawHeader("OC-FileId", fileInfo->fileId);
+        } else {
+            setError(status == 404 ? ContentNotFoundError : InternalServerError, "Copy failed");
+        }
+        emit metaDataChanged();
+        emit finished();
+    }
+
+    void abort() override { }
+    qint64 readData(char *, qint64) override { return 0; }
+};
+
 class FakeGetReply : public QNetworkReply
 {
     Q_OBJECT
@@ -562,7 +714,7 @@ public:
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
     }
 
-    Q_INVOKABLE void respond() {
+    Q_INVOKABLE virtual void respond() {
         if (aborted) {
             setError(OperationCanceledError, "Operation Canceled");
             emit metaDataChanged();
@@ -579,6 +731,8 @@ public:
         emit metaDataChanged();
         if (bytesAvailable())
             emit readyRead();
+        // The data may not have been read yet, e.g. when the bandwidth is limited
+        setFinished(true);
         emit finished();
     }
 
@@ -624,25 +778,49 @@ public:
         int size = 0;
         char payload = '\0';
 
-        do {
-            QString chunkName = QString::number(count).rightJustified(8, '0');
-            if (!sourceFolder->children.contains(chunkName))
-                break;
-            auto &x = sourceFolder->children[chunkName];
-            Q_ASSERT(!x.isDir);
-            Q_ASSERT(x.size > 0); // There should not be empty chunks
-            size += x.size;
-            Q_ASSERT(!payload || payload == x.contentChar);
-            payload = x.contentChar;
-            ++count;
-        } while(true);
-
-        Q_ASSERT(count > 1); // There should be at least two chunks, otherwise why would we use chunking?
-        QCOMPARE(sourceFolder->children.count(), count); // There should not be holes or extra files
-
         QString fileName = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
         Q_ASSERT(!fileName.isEmpty());
 
+        const QByteArray deltaBase = request.rawHeader("OC-Delta-Base");
+        if (!deltaBase.isEmpty()) {
+            // Delta upload: the chunks are named after their block and may have holes,
+            // which are filled from the base version of the destination
+            auto base = remoteRootFileInfo.find(fileName);
+            if (!base || deltaBase != '"' + base->etag.toLatin1() + '"') {
+                QMetaObject::invokeMethod(this, "respondPreconditionFailed", Qt::QueuedConnection);
+                return;
+            }
+            int uploaded = 0;
+            for (const auto &x : sourceFolder->children) {
+                Q_ASSERT(!x.isDir);
+                Q_ASSERT(x.size > 0);
+                uploaded += x.size;
+                Q_ASSERT(!payload || payload == x.contentChar);
+                payload = x.contentChar;
+            }
+            size = request.rawHeader("OC-Total-Length").toInt();
+            Q_ASSERT(uploaded < size); // Otherwise why would the client send a delta?
+            // Assume that the base is filled with the same character as the chunks
+            Q_ASSERT(!payload || payload == base->contentChar);
+            payload = base->contentChar;
+        } else {
+            do {
+                QString chunkName = QString::number(count).rightJustified(8, '0');
+                if (!sourceFolder->children.contains(chunkName))
+                    break;
+                auto &x = sourceFolder->children[chunkName];
+                Q_ASSERT(!x.isDir);
+                Q_ASSERT(x.size > 0); // There should not be empty chunks
+                size += x.size;
+                Q_ASSERT(!payload || payload == x.contentChar);
+                payload = x.contentChar;
+                ++count;
+            } while(true);
+
+            Q_ASSERT(count > 1); // There should be at least two chunks, otherwise why would we use chunking?
+            QCOMPARE(sourceFolder->children.count(), count); // There should not be holes or extra files
+        }
+
         if ((fileInfo = remoteRootFileInfo.find(fileName))) {
             QVERIFY(request.hasRawHeader("If")); // The client should put this header
             if (request.rawHeader("If") != QByteArray("<" + request.rawHeader("Destination") +
@@ -713,6 +891,28 @@ public:
     int _httpErrorCode;
 };
 
+// A delayed reply: respond() of the original reply is only called after delayMs
+template <class OriginalReply>
+class DelayedReply : public OriginalReply
+{
+public:
+    template <typename... Args>
+    explicit DelayedReply(quint64 delayMs, Args &&... args)
+        : OriginalReply(std::forward<Args>(args)...)
+        , _delayMs(delayMs)
+    {
+    }
+    quint64 _delayMs;
+
+    void respond() override
+    {
+        QTimer::singleShot(_delayMs, static_cast<OriginalReply *>(this), [this] {
+            // Explicit call to bases's respond();
+            this->OriginalReply::respond();
+        });
+    }
+};
+
 class FakeQNAM : public QNetworkAccessManager
 {
 public:
@@ -725,6 +925,8 @@ private:
     QHash<QString, int> _errorPaths;
     // monitor requests and optionally provide custom replies
     Override _override;
+    // simulated server latency of GET and PUT requests
+    quint64 _responseDelayMs = 0;
 
 public:
     FakeQNAM(FileInfo initialRoot) : _remoteRootFileInfo{std::move(initialRoot)} { }
@@ -734,10 +936,19 @@ public:
     QHash<QString, int> &errorPaths() { return _errorPaths; }
 
     void setOverride(const Override &override) { _override = override; }
+    void setResponseDelay(quint64 delayMs) { _responseDelayMs = delayMs; }
 
 protected:
     QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
                                          QIODevice *outgoingData = 0) {
+        if (request.url().path() == sBulkUploadUrl.path()) {
+            if (_override) {
+                if (auto reply = _override(op, request))
+                    return reply;
+            }
+            return new FakeBulkUploadReply{_remoteRootFileInfo, _errorPaths, op, request, outgoingData->readAll(), this};
+        }
+
         const QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isNull());
         if (_errorPaths.contains(fileName))
@@ -755,8 +966,12 @@ protected:
         if (verb == "PROPFIND")
             // Ignore outgoingData always returning somethign good enough, works for now.
             return new FakePropfindReply{info, op, request, this};
+        else if ((verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation) && _responseDelayMs)
+            return new DelayedReply<FakeGetReply>{_responseDelayMs, info, op, request, this};
         else if (verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation)
             return new FakeGetReply{info, op, request, this};
+        else if ((verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation) && _responseDelayMs)
+            return new DelayedReply<FakePutReply>{_responseDelayMs, info, op, request, outgoingData->readAll(), this};
         else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation)
             return new FakePutReply{info, op, request, outgoingData->readAll(), this};
         else if (verb == QLatin1String("MKCOL"))
@@ -767,6 +982,8 @@ protected:
             return new FakeMoveReply{info, op, request, this};
         else if (verb == QLatin1String("MOVE") && isUpload)
             return new FakeChunkMoveReply{info, _remoteRootFileInfo, op, request, this};
+        else if (verb == QLatin1String("COPY"))
+            return new FakeCopyReply{info, op, request, this};
         else {
             qDebug() << verb << outgoingData;
             Q_UNREACHABLE();
@@ -851,6 +1068,7 @@ public:
     };
     ErrorList serverErrorPaths() { return {_fakeQnam}; }
     void setServerOverride(const FakeQNAM::Override &override) { _fakeQnam->setOverride(override); }
+    void setServerResponseDelay(quint64 delayMs) { _fakeQnam->setResponseDelay(delayMs); }
 
     QString localPath() const {
         // SyncEngine wants a trailing slash
@@ -0,0 +1,70 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QNetworkAccessManager>
+#include <QNetworkCookieJar>
+#include <QNetworkReply>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+
+using namespace OCC;
+
+class TestAccount : public QObject
+{
+    Q_OBJECT
+
+    // The QNAMs used for the next requests of the account
+    static QSet<QNetworkAccessManager *> usedManagers(const AccountPtr &account, int requests)
+    {
+        QSet<QNetworkAccessManager *> managers;
+        for (int i = 0; i < requests; ++i) {
+            // Nothing listens there, the request is never sent anyway
+            auto reply = account->sendRawRequest("GET", QUrl("http://127.0.0.1:1/"));
+            managers.insert(reply->manager());
+            reply->abort();
+            reply->deleteLater();
+        }
+        return managers;
+    }
+
+private slots:
+    void testNetworkAccessManagerPool()
+    {
+        auto account = Account::create();
+        account->setCredentials(new DummyCredentials);
+        QCOMPARE(account->maxHttpConnections(), 6);
+        QCOMPARE(usedManagers(account, 6).size(), 1);
+
+        // Three QNAMs for up to 13 connections, used in turn
+        account->setMaxHttpConnections(13);
+        auto managers = usedManagers(account, 6);
+        QCOMPARE(managers.size(), 3);
+        QVERIFY(managers.contains(account->networkAccessManager()));
+        foreach (auto manager, managers) {
+            QCOMPARE(manager->cookieJar(), account->networkAccessManager()->cookieJar());
+        }
+
+        // The pool survives a reset, with the new QNAM
+        account->resetNetworkAccessManager();
+        managers = usedManagers(account, 6);
+        QCOMPARE(managers.size(), 3);
+        QVERIFY(managers.contains(account->networkAccessManager()));
+
+        // HTTP/2 needs only one connection
+        account->setHttp2Supported(true);
+        QCOMPARE(usedManagers(account, 6).size(), 1);
+        account->setHttp2Supported(false);
+
+        account->setMaxHttpConnections(6);
+        QCOMPARE(usedManagers(account, 6).size(), 1);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestAccount)
+#include "testaccount.moc"
@@ -0,0 +1,55 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+class TestBandwidthManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDownloadLimit()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        for (int i = 0; i < 20; ++i) {
+            fakeFolder.remoteModifier().insert(QString("file%1").arg(i), 200 * 1000);
+        }
+        // 4MB to download at 2MB/s. The files are not small, so the "likely
+        // finished quickly" heuristic does not add to the parallelism.
+        fakeFolder.syncEngine().setNetworkLimits(0, 2000 * 1000);
+
+        int requests = 0;
+        int requestsAtFirstCompletion = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++requests;
+            return nullptr;
+        });
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &) {
+            if (!requestsAtFirstCompletion)
+                requestsAtFirstCompletion = requests;
+        });
+
+        QElapsedTimer timer;
+        timer.start();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(requests, 20);
+
+        // The limit applies to the sum of all downloads...
+        QVERIFY(timer.elapsed() >= 1500);
+        // ...which still run in parallel
+        QVERIFY(requestsAtFirstCompletion > 1);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBandwidthManager)
+#include "testbandwidthmanager.moc"
@@ -0,0 +1,118 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+struct RequestCounter
+{
+    int posts = 0;
+    int puts = 0;
+
+    FakeQNAM::Override override()
+    {
+        return [this](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.url().path() == sBulkUploadUrl.path())
+                ++posts;
+            else if (op == QNetworkAccessManager::PutOperation)
+                ++puts;
+            return nullptr;
+        };
+    }
+};
+
+class TestBulkUpload : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBulkUpload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "bulkupload", "1.0" } } } });
+
+        for (int i = 0; i < 30; ++i) {
+            fakeFolder.localModifier().insert(QString("A/small%1").arg(i), 1000 + i);
+        }
+        fakeFolder.localModifier().appendByte("B/b1");
+        // Not small: uploaded with its own PUT
+        fakeFolder.localModifier().insert("C/big", 200 * 1000);
+
+        RequestCounter counter;
+        fakeFolder.setServerOverride(counter.override());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(counter.posts >= 1);
+        QVERIFY(counter.posts < 10);
+        QCOMPARE(counter.puts, 1);
+
+        // The journal knows the new etags: nothing to do on the next sync
+        counter = RequestCounter();
+        fakeFolder.setServerOverride(counter.override());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(counter.posts, 0);
+        QCOMPARE(counter.puts, 0);
+        auto record = fakeFolder.syncJournal().getFileRecord("A/small0");
+        QVERIFY(record.isValid());
+        QCOMPARE(QString::fromUtf8(record._etag), fakeFolder.currentRemoteState().find("A/small0")->etag);
+    }
+
+    void testBulkUploadErrors()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "bulkupload", "1.0" } } } });
+
+        for (int i = 0; i < 10; ++i) {
+            fakeFolder.localModifier().insert(QString("A/small%1").arg(i), 1000);
+        }
+        fakeFolder.serverErrorPaths().append("A/small3", 403);
+
+        QVERIFY(!fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/small3"));
+        for (int i = 0; i < 10; ++i) {
+            if (i != 3)
+                QVERIFY(fakeFolder.currentRemoteState().find(QString("A/small%1").arg(i)));
+        }
+
+        // A failed batch fails all of its files
+        fakeFolder.serverErrorPaths().clear();
+        fakeFolder.localModifier().appendByte("A/small0");
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.url().path() == sBulkUploadUrl.path())
+                return new FakeErrorReply{ op, request, this, 500 };
+            return nullptr;
+        });
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/small0")->size, 1000);
+
+        fakeFolder.setServerOverride(nullptr);
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testWithoutCapability()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        for (int i = 0; i < 10; ++i) {
+            fakeFolder.localModifier().insert(QString("A/small%1").arg(i), 1000);
+        }
+
+        RequestCounter counter;
+        fakeFolder.setServerOverride(counter.override());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.posts, 0);
+        QCOMPARE(counter.puts, 10);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBulkUpload)
+#include "testbulkupload.moc"
@@ -41,6 +41,29 @@ static void partialUpload(FakeFolder &fakeFolder, const QString &name, int size)
 }
 
 
+/* Options and capabilities for delta sync tests: blocks of 1 MB, which are
+ * also the chunks of a normal upload */
+static void setupDeltaSync(FakeFolder &fakeFolder)
+{
+    fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"}, {"deltasync", "1.0"} } } });
+    SyncOptions options;
+    options._initialChunkSize = 1000 * 1000;
+    options._targetChunkUploadDuration = 0;
+    options._deltaSyncMinFileSize = 0;
+    fakeFolder.syncEngine().setSyncOptions(options);
+}
+
+/* The upload folder that is not in \a previous */
+static FileInfo *newUploadFolder(FakeFolder &fakeFolder, const QStringList &previous)
+{
+    for (auto &folder : fakeFolder.uploadState().children) {
+        if (!previous.contains(folder.name))
+            return &folder;
+    }
+    return nullptr;
+}
+
+
 class TestChunkingNG : public QObject
 {
     Q_OBJECT
@@ -237,6 +260,98 @@ private slots:
         QVERIFY(fakeFolder.uploadState().children.first().name != chunkingId);
     }
 
+    void testDeltaUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        setupDeltaSync(fakeFolder);
+        const int size = 10 * 1000 * 1000; // 10 MB
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.uploadState().children.count(), 1);
+        QCOMPARE(fakeFolder.uploadState().children.first().children.count(), 10);
+
+        auto blocks = fakeFolder.syncJournal().getBlockChecksums("A/a0");
+        QVERIFY(blocks._valid);
+        QCOMPARE(blocks._blockSize, quint64(1000 * 1000));
+        QCOMPARE(blocks._checksums.size(), 10 * 20);
+        QCOMPARE(blocks._etag, fakeFolder.syncJournal().getFileRecord(QStringLiteral("A/a0"))._etag);
+
+        // Only the last block changes
+        QStringList previous = fakeFolder.uploadState().children.keys();
+        fakeFolder.localModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size + 1);
+        auto upload = newUploadFolder(fakeFolder, previous);
+        QVERIFY(upload);
+        QCOMPARE(QStringList(upload->children.keys()), QStringList() << "00000010");
+        QCOMPARE(upload->children.first().size, qint64(1));
+        QCOMPARE(fakeFolder.syncJournal().getBlockChecksums("A/a0")._checksums.size(), 11 * 20);
+
+        // All blocks change: a normal upload
+        previous = fakeFolder.uploadState().children.keys();
+        fakeFolder.localModifier().setContents("A/a0", 'B');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        upload = newUploadFolder(fakeFolder, previous);
+        QVERIFY(upload);
+        QCOMPARE(upload->children.count(), 11);
+    }
+
+    // The checksums are only used for the version of the file they were computed for
+    void testDeltaUploadAfterRemoteChange() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        setupDeltaSync(fakeFolder);
+        const int size = 10 * 1000 * 1000; // 10 MB
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+
+        fakeFolder.remoteModifier().setContents("A/a0", 'C');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QStringList previous = fakeFolder.uploadState().children.keys();
+        fakeFolder.localModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        auto upload = newUploadFolder(fakeFolder, previous);
+        QVERIFY(upload);
+        QCOMPARE(upload->children.count(), 11);
+
+        auto blocks = fakeFolder.syncJournal().getBlockChecksums("A/a0");
+        QVERIFY(blocks._valid);
+        QCOMPARE(blocks._etag, fakeFolder.syncJournal().getFileRecord(QStringLiteral("A/a0"))._etag);
+    }
+
+    // A server that refuses to assemble the delta: the next sync uploads everything
+    void testDeltaUploadRejected() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        setupDeltaSync(fakeFolder);
+        const int size = 10 * 1000 * 1000; // 10 MB
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+
+        int deltaMoves = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.hasRawHeader("OC-Delta-Base")) {
+                ++deltaMoves;
+                return new FakeErrorReply{ op, request, this, 400 };
+            }
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().appendByte("A/a0");
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(deltaMoves, 1);
+        QVERIFY(!fakeFolder.syncJournal().getBlockChecksums("A/a0")._valid);
+
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(deltaMoves, 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(fakeFolder.syncJournal().getBlockChecksums("A/a0")._valid);
+    }
+
 };
 
 QTEST_GUILESS_MAIN(TestChunkingNG)
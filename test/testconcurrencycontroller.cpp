@@ -0,0 +1,264 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include "concurrencycontroller.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+/* Feed one round of jobs into the controller: as many jobs as the controller
+ * allows, all finishing together after durationMsec. */
+static void runRound(ConcurrencyController &controller, qint64 &now, qint64 durationMsec,
+    qint64 bytes = 0, int httpErrorCode = 0, int hardMaximum = 6)
+{
+    int window = controller.maximumActiveTransferJob(hardMaximum);
+    now += durationMsec;
+    for (int i = 0; i < window; ++i) {
+        ConcurrencyController::Sample sample;
+        sample._bytes = bytes;
+        sample._durationMsec = durationMsec;
+        sample._finishedAtMsec = now;
+        sample._httpErrorCode = httpErrorCode;
+        controller.jobFinished(sample);
+    }
+}
+
+class TestConcurrencyController : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testFixed()
+    {
+        FixedConcurrencyController controller;
+        QCOMPARE(controller.maximumActiveTransferJob(6), 3);
+        QCOMPARE(controller.maximumActiveTransferJob(20), 3);
+        QCOMPARE(controller.maximumActiveTransferJob(1), 1);
+    }
+
+    void testAdditiveIncrease()
+    {
+        // A latency bound server: each request takes 100ms no matter how
+        // many run in parallel, so throughput grows with the window.
+        AdaptiveConcurrencyController controller(3);
+        qint64 now = 0;
+        for (int i = 0; i < 50; ++i) {
+            runRound(controller, now, 100, 1000);
+        }
+        QCOMPARE(controller.maximumActiveTransferJob(6), 6);
+        QCOMPARE(controller.window(), 6);
+
+        // Never exceeds the hard maximum
+        QCOMPARE(controller.maximumActiveTransferJob(4), 4);
+    }
+
+    void testNoGainNoGrowth()
+    {
+        // A bandwidth bound server: 1MB/s total, so more parallel jobs only
+        // make each of them slower.
+        AdaptiveConcurrencyController controller(3);
+        qint64 now = 0;
+        int maxWindow = 0;
+        for (int i = 0; i < 200; ++i) {
+            int window = controller.maximumActiveTransferJob(20);
+            maxWindow = qMax(maxWindow, window);
+            runRound(controller, now, window * 100, 100 * 1000, 0, 20);
+        }
+        // Only ever probes one step above the start
+        QVERIFY(maxWindow <= 4);
+        QVERIFY(controller.window() <= 4);
+    }
+
+    void testMultiplicativeDecrease()
+    {
+        AdaptiveConcurrencyController controller(3);
+        qint64 now = 0;
+        for (int i = 0; i < 50; ++i) {
+            runRound(controller, now, 100, 1000);
+        }
+        QCOMPARE(controller.window(), 6);
+
+        auto fail = [&](int code) {
+            ConcurrencyController::Sample sample;
+            sample._finishedAtMsec = now;
+            sample._httpErrorCode = code;
+            controller.jobFinished(sample);
+        };
+
+        fail(503);
+        QCOMPARE(controller.window(), 3);
+
+        // The other jobs started with the old window may still fail
+        for (int i = 0; i < 6; ++i) {
+            fail(429);
+        }
+        QCOMPARE(controller.window(), 3);
+
+        // But further errors reduce it again, down to 1
+        fail(429);
+        QCOMPARE(controller.window(), 1);
+        for (int i = 0; i < 10; ++i) {
+            fail(503);
+        }
+        QCOMPARE(controller.window(), 1);
+
+        // Other errors don't count as overload
+        controller.maximumActiveTransferJob(6);
+        for (int i = 0; i < 50; ++i) {
+            runRound(controller, now, 100, 0, 404);
+        }
+        QVERIFY(controller.window() > 1);
+    }
+
+    void testLatencyInflation()
+    {
+        // Small requests that get slower with every additional parallel one:
+        // a server that is queueing them.
+        AdaptiveConcurrencyController controller(3);
+        qint64 now = 0;
+        int maxWindow = 0;
+        for (int i = 0; i < 100; ++i) {
+            int window = controller.maximumActiveTransferJob(20);
+            maxWindow = qMax(maxWindow, window);
+            qint64 latency = window <= 4 ? 100 : 100 * window;
+            now += latency;
+            for (int j = 0; j < window; ++j) {
+                ConcurrencyController::Sample sample;
+                sample._durationMsec = latency;
+                sample._finishedAtMsec = now;
+                sample._likelyFinishedQuickly = true;
+                controller.jobFinished(sample);
+            }
+        }
+        QVERIFY(maxWindow <= 5);
+        QVERIFY(controller.window() <= 5);
+    }
+
+    void testSyncStarted()
+    {
+        // The first sync ends with the window at that sync's hard maximum
+        AdaptiveConcurrencyController controller(3);
+        qint64 now = 0;
+        for (int i = 0; i < 50; ++i) {
+            runRound(controller, now, 100, 1000, 0, 4);
+        }
+        QCOMPARE(controller.window(), 4);
+
+        // The timestamps of the next sync start again at 0
+        controller.syncStarted();
+        QCOMPARE(controller.window(), 4);
+        now = 0;
+        for (int i = 0; i < 50; ++i) {
+            runRound(controller, now, 100, 1000, 0, 6);
+        }
+        // Not stuck behind a bogus rate measured across the two syncs
+        QCOMPARE(controller.window(), 6);
+    }
+
+    void testSyncWithLatency()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        SyncOptions options;
+        options._concurrencyController.reset(new AdaptiveConcurrencyController);
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        // Files that are not small, so the "likely finished quickly"
+        // heuristic does not add to the parallelism
+        for (int i = 0; i < 60; ++i) {
+            fakeFolder.remoteModifier().insert(QString("file%1").arg(i), 200 * 1000);
+        }
+
+        int inFlight = 0;
+        int maxInFlight = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            auto reply = new DelayedReply<FakeGetReply>(50, fakeFolder.remoteModifier(), op, request, this);
+            ++inFlight;
+            maxInFlight = qMax(maxInFlight, inFlight);
+            connect(reply, &QNetworkReply::finished, [&] { --inFlight; });
+            return reply;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // The fixed controller would have stayed at 3, the hard maximum for HTTP/1 is 6
+        QVERIFY(maxInFlight > 3);
+        QVERIFY(maxInFlight <= 6);
+    }
+
+    void testSyncWithLatencyTwice()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        QSharedPointer<AdaptiveConcurrencyController> controller(new AdaptiveConcurrencyController);
+        SyncOptions options;
+        options._concurrencyController = controller;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        int inFlight = 0;
+        int maxInFlight = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            auto reply = new DelayedReply<FakeGetReply>(50, fakeFolder.remoteModifier(), op, request, this);
+            ++inFlight;
+            maxInFlight = qMax(maxInFlight, inFlight);
+            connect(reply, &QNetworkReply::finished, [&] { --inFlight; });
+            return reply;
+        });
+
+        for (int i = 0; i < 60; ++i) {
+            fakeFolder.remoteModifier().insert(QString("first%1").arg(i), 200 * 1000);
+        }
+        QVERIFY(fakeFolder.syncOnce());
+
+        // The second sync's propagator measures time from its own start
+        for (int i = 0; i < 60; ++i) {
+            fakeFolder.remoteModifier().insert(QString("second%1").arg(i), 200 * 1000);
+        }
+        maxInFlight = 0;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // What was learned carries over and the server stays latency bound
+        QVERIFY(controller->window() > 3);
+        QVERIFY(controller->window() <= 6);
+        QVERIFY(maxInFlight > 3);
+    }
+
+    void testSyncWithLatencyFixed()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        for (int i = 0; i < 20; ++i) {
+            fakeFolder.remoteModifier().insert(QString("file%1").arg(i), 200 * 1000);
+        }
+
+        int requests = 0;
+        int inFlight = 0;
+        int maxInFlight = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            ++requests;
+            auto reply = new DelayedReply<FakeGetReply>(50, fakeFolder.remoteModifier(), op, request, this);
+            ++inFlight;
+            maxInFlight = qMax(maxInFlight, inFlight);
+            connect(reply, &QNetworkReply::finished, [&] { --inFlight; });
+            return reply;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(requests, 20);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // Without a controller in the options the propagator keeps the static default
+        QCOMPARE(maxInFlight, 3);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestConcurrencyController)
+#include "testconcurrencycontroller.moc"
@@ -0,0 +1,116 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+/* Copy a local file, the way a file manager would: new inode, same content */
+static void copyLocalFile(FakeFolder &fakeFolder, const QString &from, const QString &to)
+{
+    const QString dest = fakeFolder.localPath() + to;
+    QVERIFY(QFile::copy(fakeFolder.localPath() + from, dest));
+    // Make sure the file is not considered as still changing
+    FileSystem::setModTime(dest, Utility::qDateTimeToTime_t(QDateTime::currentDateTime().addSecs(-30)));
+}
+
+struct RequestCounter
+{
+    int copies = 0;
+    int puts = 0;
+    int failCopiesWith = 0;
+
+    FakeQNAM::Override override()
+    {
+        return [this](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "COPY") {
+                ++copies;
+                if (failCopiesWith)
+                    return new FakeErrorReply{ op, request, nullptr, failCopiesWith };
+            } else if (op == QNetworkAccessManager::PutOperation) {
+                ++puts;
+            }
+            return nullptr;
+        };
+    }
+};
+
+class TestCopyDetection : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCopyInsteadOfUpload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.localModifier().insert("A/big", 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+
+        RequestCounter counter;
+        fakeFolder.setServerOverride(counter.override());
+
+        copyLocalFile(fakeFolder, "A/big", "B/big");
+        copyLocalFile(fakeFolder, "A/big", "C/big");
+        // Small files are uploaded anyway
+        copyLocalFile(fakeFolder, "A/a1", "B/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.copies, 2);
+        QCOMPARE(counter.puts, 1);
+
+        auto record = fakeFolder.syncJournal().getFileRecord(QStringLiteral("B/big"));
+        QVERIFY(record.isValid());
+        QCOMPARE(record._etag, fakeFolder.currentRemoteState().find("B/big")->etag.toLatin1());
+        QCOMPARE(record._checksumHeader, fakeFolder.syncJournal().getFileRecord(QStringLiteral("A/big"))._checksumHeader);
+
+        // The copies are in sync: nothing more to do
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(counter.copies, 2);
+        QCOMPARE(counter.puts, 1);
+    }
+
+    void testUploadWhenCopyFails()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.localModifier().insert("A/big", 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+
+        RequestCounter counter;
+        counter.failCopiesWith = 500;
+        fakeFolder.setServerOverride(counter.override());
+
+        copyLocalFile(fakeFolder, "A/big", "B/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.copies, 1);
+        QCOMPARE(counter.puts, 1);
+    }
+
+    void testSourceChangedOnServer()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.localModifier().insert("A/big", 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // The server has a different version of the source than the journal knows about:
+        // the copy must not be used.
+        fakeFolder.remoteModifier().setContents("A/big", 'X');
+        copyLocalFile(fakeFolder, "A/big", "B/big");
+
+        RequestCounter counter;
+        fakeFolder.setServerOverride(counter.override());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(counter.puts, 1);
+        QCOMPARE(fakeFolder.currentRemoteState().find("B/big")->contentChar, 'W');
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestCopyDetection)
+#include "testcopydetection.moc"
@@ -0,0 +1,205 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+
+#include "ownclouddolphinstatuscache.h"
+
+static const int directorySize = 10000;
+static const QByteArray syncFolder = "/home/user/ownCloud";
+static const QByteArray bigDirectory = syncFolder + "/photos";
+
+static QByteArray entryPath(int i)
+{
+    return bigDirectory + "/IMG_" + QByteArray::number(i) + ".jpg";
+}
+
+// What the client writes on the socket for RETRIEVE_FILE_STATUSES of bigDirectory,
+// followed by a sync of a few of its files.
+static QList<QByteArray> transcript()
+{
+    QByteArray data = "REGISTER_PATH:" + syncFolder + "\n";
+    for (int i = 0; i < directorySize; ++i)
+        data += "STATUS:" + QByteArray(i % 100 == 0 ? "OK+SWM" : "OK") + ":" + entryPath(i) + "\n";
+    data += "STATUSES_END:" + bigDirectory + "\n";
+    for (int i = 0; i < 10; ++i)
+        data += "STATUS:SYNC:" + entryPath(i) + "\n";
+    data += "STATUS:SYNC:" + bigDirectory + "\n";
+    for (int i = 0; i < 10; ++i)
+        data += "STATUS:OK:" + entryPath(i) + "\n";
+    data += "STATUS:OK:" + bigDirectory + "\n";
+    data += "UPDATE_VIEW:" + syncFolder + "\n";
+
+    QList<QByteArray> lines = data.split('\n');
+    lines.removeLast();
+    return lines;
+}
+
+class TestDolphinStatusCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDirectoryRequestedOnce()
+    {
+        OwncloudDolphinStatusCache cache;
+        OwncloudDolphinStatusCache::Request request;
+        QVERIFY(cache.lookup(entryPath(1), &request).isNull());
+        QCOMPARE(request, OwncloudDolphinStatusCache::RequestDirectory);
+        // The answer is on its way
+        QVERIFY(cache.lookup(entryPath(2), &request).isNull());
+        QCOMPARE(request, OwncloudDolphinStatusCache::NoRequest);
+
+        // Asked again after the client updated the view of the folder
+        QVERIFY(cache.processLine("UPDATE_VIEW:" + syncFolder).isEmpty());
+        cache.lookup(entryPath(2), &request);
+        QCOMPARE(request, OwncloudDolphinStatusCache::RequestDirectory);
+        cache.lookup(entryPath(3), &request);
+        QCOMPARE(request, OwncloudDolphinStatusCache::NoRequest);
+    }
+
+    void testFileMissingFromDirectoryAnswer()
+    {
+        OwncloudDolphinStatusCache cache;
+        OwncloudDolphinStatusCache::Request request;
+        cache.lookup(entryPath(1), &request);
+        QCOMPARE(request, OwncloudDolphinStatusCache::RequestDirectory);
+        cache.processLine("STATUS:OK:" + entryPath(1));
+        cache.processLine("STATUS:OK:" + entryPath(2));
+        // More of the answer may still come
+        QVERIFY(cache.lookup(entryPath(3), &request).isNull());
+        QCOMPARE(request, OwncloudDolphinStatusCache::NoRequest);
+        QVERIFY(cache.processLine("STATUSES_END:" + bigDirectory).isEmpty());
+
+        QCOMPARE(cache.lookup(entryPath(2), &request), QByteArray("OK"));
+        QCOMPARE(request, OwncloudDolphinStatusCache::NoRequest);
+
+        // Created after the answer and never pushed, e.g. because it is excluded
+        QVERIFY(cache.lookup(entryPath(3), &request).isNull());
+        QCOMPARE(request, OwncloudDolphinStatusCache::RequestFile);
+        // Only asked once
+        QVERIFY(cache.lookup(entryPath(3), &request).isNull());
+        QCOMPARE(request, OwncloudDolphinStatusCache::NoRequest);
+        QCOMPARE(cache.processLine("STATUS:IGNORE:" + entryPath(3)), entryPath(3));
+        QCOMPARE(cache.lookup(entryPath(3), &request), QByteArray("IGNORE"));
+        QCOMPARE(request, OwncloudDolphinStatusCache::NoRequest);
+    }
+
+    void testPushBeforeDirectoryAnswer()
+    {
+        OwncloudDolphinStatusCache cache;
+        OwncloudDolphinStatusCache::Request request;
+        cache.lookup(entryPath(1), &request);
+        QCOMPARE(request, OwncloudDolphinStatusCache::RequestDirectory);
+        // Queued by the client before it got the request
+        QCOMPARE(cache.processLine("STATUS:SYNC:" + entryPath(1)), entryPath(1));
+
+        // The rest of the directory is still on its way, don't ask file by file
+        for (int i = 2; i < 100; ++i) {
+            QVERIFY(cache.lookup(entryPath(i), &request).isNull());
+            QCOMPARE(request, OwncloudDolphinStatusCache::NoRequest);
+        }
+
+        // An empty answer ends the same way
+        cache.lookup(syncFolder + "/empty/file", &request);
+        QCOMPARE(request, OwncloudDolphinStatusCache::RequestDirectory);
+        cache.processLine("STATUSES_END:" + syncFolder + "/empty");
+        cache.lookup(syncFolder + "/empty/file", &request);
+        QCOMPARE(request, OwncloudDolphinStatusCache::RequestFile);
+    }
+
+    void testPushedStatus()
+    {
+        OwncloudDolphinStatusCache cache;
+        QCOMPARE(cache.processLine("STATUS:SYNC:" + entryPath(1)), entryPath(1));
+        QCOMPARE(cache.status(entryPath(1)), QByteArray("SYNC"));
+        // Unchanged status, nothing to redraw
+        QVERIFY(cache.processLine("STATUS:SYNC:" + entryPath(1)).isEmpty());
+        QCOMPARE(cache.processLine("STATUS:OK:" + entryPath(1)), entryPath(1));
+        QCOMPARE(cache.status(entryPath(1)), QByteArray("OK"));
+
+        // Colons are allowed in the path
+        QCOMPARE(cache.processLine("STATUS:WARN:" + bigDirectory + "/a:b"), bigDirectory + "/a:b");
+        QCOMPARE(cache.status(bigDirectory + "/a:b"), QByteArray("WARN"));
+
+        QVERIFY(cache.processLine("STATUS:OK:").isEmpty());
+        QVERIFY(cache.processLine("SHARE:OK:" + entryPath(2)).isEmpty());
+        QVERIFY(cache.status(entryPath(2)).isNull());
+    }
+
+    void testUnregisterPath()
+    {
+        OwncloudDolphinStatusCache cache;
+        cache.processLine("STATUS:OK:" + syncFolder);
+        cache.processLine("STATUS:OK:" + entryPath(1));
+        cache.processLine("STATUS:OK:/home/user/other/file");
+        cache.processLine("UNREGISTER_PATH:" + syncFolder);
+        QVERIFY(cache.status(syncFolder).isNull());
+        QVERIFY(cache.status(entryPath(1)).isNull());
+        QCOMPARE(cache.status("/home/user/other/file"), QByteArray("OK"));
+    }
+
+    void testDirectoryEviction()
+    {
+        OwncloudDolphinStatusCache cache;
+        OwncloudDolphinStatusCache::Request request;
+        cache.lookup(entryPath(1), &request);
+        cache.processLine("STATUS:OK:" + entryPath(1));
+        for (int i = 0; i < 1000; ++i) {
+            cache.lookup("/tmp/dir" + QByteArray::number(i) + "/file", &request);
+            // The directory currently shown stays
+            QCOMPARE(cache.lookup(entryPath(1), &request), QByteArray("OK"));
+        }
+        QVERIFY(cache.directoryCount() <= 64);
+
+        // Pushes for directories in the background don't push it out either
+        for (int i = 0; i < 1000; ++i) {
+            cache.processLine("STATUS:SYNC:/tmp/other" + QByteArray::number(i) + "/file");
+        }
+        QVERIFY(cache.directoryCount() <= 64);
+        QCOMPARE(cache.status(entryPath(1)), QByteArray("OK"));
+    }
+
+    // Overlay resolution for a large directory, replaying what the client sent
+    void benchReplayTranscript()
+    {
+        const QList<QByteArray> lines = transcript();
+        QVector<QByteArray> files;
+        for (int i = 0; i < directorySize; ++i)
+            files.append(entryPath(i));
+
+        int changes = 0;
+        int requests = 0;
+        QBENCHMARK {
+            OwncloudDolphinStatusCache cache;
+            changes = 0;
+            requests = 0;
+            OwncloudDolphinStatusCache::Request request;
+            // Dolphin asks for every item as it shows up, the first one triggers the request
+            for (const QByteArray &file : files) {
+                cache.lookup(file, &request);
+                requests += request != OwncloudDolphinStatusCache::NoRequest;
+            }
+            for (const QByteArray &line : lines) {
+                if (!cache.processLine(line).isEmpty())
+                    ++changes;
+            }
+            // Dolphin redraws the items
+            for (const QByteArray &file : files) {
+                cache.lookup(file, &request);
+                requests += request != OwncloudDolphinStatusCache::NoRequest;
+            }
+        }
+        // One socket request for the whole directory instead of one per item,
+        // and another one after the UPDATE_VIEW at the end of the sync
+        QCOMPARE(requests, 2);
+        QCOMPARE(changes, directorySize + 10 + 1 + 10 + 1);
+    }
+};
+
+QTEST_APPLESS_MAIN(TestDolphinStatusCache)
+#include "testdolphinstatuscache.moc"
@@ -191,6 +191,91 @@ private slots:
         QCOMPARE(folderman->findGoodPathForNewSyncFolder(dirPath + "/sub", url),
                  QString(dirPath + "/sub2"));
     }
+
+    void testScheduleQueue()
+    {
+        QTemporaryDir dir;
+        ConfigFile::setConfDir(dir.path()); // we don't want to pollute the user's config file
+        QVERIFY(dir.isValid());
+        QDir dir2(dir.path());
+        const QStringList names = QStringList() << "a1" << "a2" << "a3" << "b1" << "b2";
+        foreach (const QString &name, names) {
+            QVERIFY(dir2.mkpath(name));
+        }
+        QString dirPath = dir2.canonicalPath();
+        ConfigFile cfg;
+        cfg.setUseDownloadLimit(1);
+        cfg.setDownloadLimit(100);
+
+        AccountPtr accountA = Account::create();
+        accountA->setCredentials(new HttpCredentialsTest("testuser", "secret"));
+        accountA->setUrl(QUrl("http://a.example.de"));
+        AccountStatePtr accountStateA(new AccountState(accountA));
+        AccountPtr accountB = Account::create();
+        accountB->setCredentials(new HttpCredentialsTest("testuser", "secret"));
+        accountB->setUrl(QUrl("http://b.example.de"));
+        AccountStatePtr accountStateB(new AccountState(accountB));
+
+        QHash<QString, Folder *> folders;
+        foreach (const QString &name, names) {
+            AccountState *accountState = name.startsWith('a') ? accountStateA.data() : accountStateB.data();
+            folders[name] = _fm.addFolder(accountState, folderDefinition(dirPath + "/" + name));
+            QVERIFY(folders[name]);
+        }
+        Folder *a1 = folders["a1"], *a2 = folders["a2"], *a3 = folders["a3"], *b1 = folders["b1"], *b2 = folders["b2"];
+
+        _fm._maxConcurrentSyncs = 2;
+        _fm._scheduledFolders.clear();
+        _fm._prioritizedFolders.clear();
+        _fm._currentSyncFolders.clear();
+        _fm._scheduledFolders << a1 << a2 << b1 << a3 << b2;
+
+        // The second slot goes to the other account, not to the next in line
+        QCOMPARE(_fm.takeNextScheduledFolder(), a1);
+        _fm._currentSyncFolders << a1;
+        QCOMPARE(_fm.takeNextScheduledFolder(), b1);
+        _fm._currentSyncFolders << b1;
+        QCOMPARE(_fm._scheduledFolders, QQueue<Folder *>() << a2 << a3 << b2);
+
+        // Connections and bandwidth are shared by the running syncs
+        _fm.updateSyncBudgets();
+        QCOMPARE(accountA->runningSyncCount(), 1);
+        QCOMPARE(accountB->runningSyncCount(), 1);
+        QCOMPARE(a1->syncEngine().downloadLimit(), 50 * 1000);
+        QCOMPARE(b1->syncEngine().downloadLimit(), 50 * 1000);
+
+        // A folder that is syncing already stays queued
+        _fm._currentSyncFolders.removeAll(b1);
+        _fm._scheduledFolders.prepend(a1);
+        QCOMPARE(_fm.takeNextScheduledFolder(), b2);
+        _fm._currentSyncFolders << b2;
+        QCOMPARE(_fm._scheduledFolders, QQueue<Folder *>() << a1 << a2 << a3);
+
+        // Priority comes before fairness between the accounts
+        _fm._currentSyncFolders.removeAll(a1);
+        _fm._currentSyncFolders << a2;
+        _fm._scheduledFolders.clear();
+        _fm._scheduledFolders << a3 << b1;
+        _fm._prioritizedFolders.insert(a3);
+        QCOMPARE(_fm.takeNextScheduledFolder(), a3);
+        QVERIFY(!_fm._prioritizedFolders.contains(a3));
+        QCOMPARE(_fm.takeNextScheduledFolder(), b1);
+        QCOMPARE(_fm.takeNextScheduledFolder(), static_cast<Folder *>(0));
+
+        // Two syncs of one account split its connections
+        _fm._currentSyncFolders.clear();
+        _fm._currentSyncFolders << b1 << b2;
+        _fm.updateSyncBudgets();
+        QCOMPARE(accountA->runningSyncCount(), 1);
+        QCOMPARE(accountB->runningSyncCount(), 2);
+
+        // and get them back when they are done
+        _fm._currentSyncFolders.clear();
+        _fm.updateSyncBudgets();
+        QCOMPARE(accountB->runningSyncCount(), 1);
+
+        _fm._maxConcurrentSyncs = 1;
+    }
 };
 
 QTEST_APPLESS_MAIN(TestFolderMan)
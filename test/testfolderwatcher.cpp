@@ -9,6 +9,9 @@
 
 #include "folderwatcher.h"
 #include "common/utility.h"
+#ifdef Q_OS_LINUX
+#include "folderwatcher_fanotify.h"
+#endif
 
 void touch(const QString &file)
 {
@@ -181,6 +184,56 @@ private slots:
         QVERIFY(waitForPathChanged(old_file));
         QVERIFY(waitForPathChanged(new_file));
     }
+
+    void testFanotifyPathMapping() {
+#ifdef Q_OS_LINUX
+        FanotifyPathMapper mapper;
+        // The folders spell their paths differently from the kernel
+        mapper.addRoot("/home/user/ownCloud", "/home/user/link/ownCloud");
+        mapper.addRoot("/data/other", "/data/other");
+        QVERIFY(!mapper.hasPendingChanges());
+
+        QVERIFY(mapper.pathChanged("/home/user/ownCloud/a/file"));
+        QVERIFY(mapper.pathChanged("/home/user/ownCloud/a/file"));
+        QVERIFY(mapper.pathChanged("/home/user/ownCloud"));
+        QVERIFY(mapper.pathChanged("/data/other/x"));
+        // Not below a root, even if the prefix matches as string
+        QVERIFY(!mapper.pathChanged("/home/user/ownCloud2/file"));
+        QVERIFY(!mapper.pathChanged("/home/user"));
+        QVERIFY(!mapper.pathChanged("/tmp/file"));
+        QVERIFY(mapper.hasPendingChanges());
+
+        auto changes = mapper.takeChanges();
+        QCOMPARE(changes.size(), 2);
+        QStringList paths = changes.value("/home/user/ownCloud");
+        paths.sort();
+        QCOMPARE(paths, QStringList() << "/home/user/link/ownCloud" << "/home/user/link/ownCloud/a/file");
+        QCOMPARE(changes.value("/data/other"), QStringList() << "/data/other/x");
+        QVERIFY(!mapper.hasPendingChanges());
+        QVERIFY(mapper.takeChanges().isEmpty());
+
+        // Events that came in before a folder was removed are not reported to it
+        QVERIFY(mapper.pathChanged("/data/other/y"));
+        mapper.removeRoot("/data/other");
+        QVERIFY(mapper.takeChanges().isEmpty());
+        QVERIFY(!mapper.pathChanged("/data/other/z"));
+
+        // After lost events every folder gets its root reported
+        mapper.addRoot("/data/other", "/data/other");
+        mapper.pathChanged("/data/other/z");
+        mapper.setOverflowed();
+        QVERIFY(mapper.hasPendingChanges());
+        changes = mapper.takeChanges();
+        QCOMPARE(changes.size(), 2);
+        QCOMPARE(changes.value("/home/user/ownCloud"), QStringList() << "/home/user/link/ownCloud");
+        paths = changes.value("/data/other");
+        paths.sort();
+        QCOMPARE(paths, QStringList() << "/data/other" << "/data/other/z");
+        QVERIFY(mapper.takeChanges().isEmpty());
+#else
+        QSKIP("fanotify is Linux only");
+#endif
+    }
 };
 
 #ifdef Q_OS_MAC
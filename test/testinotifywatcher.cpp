@@ -62,6 +62,26 @@ private slots:
         QVERIFY2(ok, "findFoldersBelow failed.");
     }
 
+    // The periodic scan of folders that could not be watched
+    void testSnapshotChanges() {
+        const QStringList roots = QStringList() << _root + "/a2";
+        const Snapshot before = snapshotBelow(roots);
+        QVERIFY(before.contains(_root + "/a2/b3/c3"));
+        QVERIFY(!before.contains(_root + "/a1"));
+        QVERIFY(changedPaths(before, snapshotBelow(roots)).isEmpty());
+
+        QVERIFY(Utility::writeRandomFile(_root + "/a2/b3/c3/new.dat"));
+        QVERIFY(QDir(_root).mkdir("a2/b4"));
+
+        const Snapshot after = snapshotBelow(roots);
+        const QStringList changed = changedPaths(before, after);
+        QVERIFY(changed.contains(_root + "/a2/b3/c3/new.dat"));
+        QVERIFY(changed.contains(_root + "/a2/b4"));
+
+        QVERIFY(QDir(_root).rmdir("a2/b4"));
+        QVERIFY(changedPaths(after, snapshotBelow(roots)).contains(_root + "/a2/b4"));
+    }
+
     void cleanupTestCase() {
         if( _root.startsWith(QDir::tempPath() )) {
            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
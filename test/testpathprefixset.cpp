@@ -0,0 +1,74 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+
+#include "pathprefixset.h"
+
+using namespace OCC;
+
+class TestPathPrefixSet : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testEmpty()
+    {
+        PathPrefixSet set;
+        QVERIFY(set.isEmpty());
+        QVERIFY(!set.contains(QString("A")));
+        QVERIFY(!set.containsPrefixOf(QString("A/b")));
+        QVERIFY(!set.containsPrefixOf(QString("")));
+    }
+
+    void testPrefixes()
+    {
+        PathPrefixSet set(QStringList() << "A/" << "B/sub/" << "C/x");
+        QVERIFY(!set.isEmpty());
+
+        QVERIFY(set.contains(QString("A")));
+        QVERIFY(set.contains(QString("A/")));
+        QVERIFY(set.contains(QString("B/sub")));
+        QVERIFY(set.contains(QString("C/x/")));
+        QVERIFY(!set.contains(QString("B")));
+        QVERIFY(!set.contains(QString("A/a1")));
+
+        QVERIFY(set.containsPrefixOf(QString("A")));
+        QVERIFY(set.containsPrefixOf(QString("A/a1")));
+        QVERIFY(set.containsPrefixOf(QString("A/deeper/down/a1")));
+        QVERIFY(set.containsPrefixOf(QByteArray("B/sub/file")));
+        QVERIFY(!set.containsPrefixOf(QString("B")));
+        QVERIFY(!set.containsPrefixOf(QString("B/subway")));
+        QVERIFY(!set.containsPrefixOf(QString("B/other/file")));
+        QVERIFY(!set.containsPrefixOf(QString("AB")));
+        QVERIFY(!set.containsPrefixOf(QString("")));
+
+        set.insert(QString("B"));
+        QVERIFY(set.containsPrefixOf(QString("B/other/file")));
+    }
+
+    void testRoot()
+    {
+        // "/" is what the selective sync lists use for everything
+        PathPrefixSet set(QStringList() << "/");
+        QVERIFY(set.containsPrefixOf(QString("A")));
+        QVERIFY(set.containsPrefixOf(QString("A/b/c")));
+        QVERIFY(set.containsPrefixOf(QString("")));
+        QVERIFY(!set.contains(QString("A")));
+    }
+
+    void testUtf8()
+    {
+        PathPrefixSet set(QStringList() << QString::fromUtf8("Ä/ö/"));
+        QVERIFY(set.containsPrefixOf(QString::fromUtf8("Ä/ö/ü")));
+        QVERIFY(set.containsPrefixOf(QString::fromUtf8("Ä/ö/ü").toUtf8()));
+        QVERIFY(!set.containsPrefixOf(QString::fromUtf8("Ä/o/ü")));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestPathPrefixSet)
+#include "testpathprefixset.moc"
@@ -0,0 +1,209 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "account.h"
+#include "pushnotifications.h"
+#include "creds/dummycredentials.h"
+
+using namespace OCC;
+
+/**
+ * Stand-in for the server's long-poll change notification endpoint.
+ *
+ * The cursor is the number of changes so far. Requests with the current
+ * cursor are held until push() is called.
+ */
+class FakeNotificationServer : public QObject
+{
+    Q_OBJECT
+public:
+    FakeNotificationServer()
+    {
+        connect(&_server, &QTcpServer::newConnection, this, [this] {
+            while (auto socket = _server.nextPendingConnection()) {
+                connect(socket, &QTcpSocket::readyRead, this, [this, socket] { readRequest(socket); });
+                connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+            }
+        });
+        _server.listen(QHostAddress::LocalHost);
+    }
+
+    QUrl url() const { return QUrl(QString("http://127.0.0.1:%1/").arg(_server.serverPort())); }
+
+    void push(const QStringList &paths)
+    {
+        _changes.append(paths);
+        auto waiting = _waiting;
+        _waiting.clear();
+        for (auto it = waiting.constBegin(); it != waiting.constEnd(); ++it)
+            answer(it.key(), it.value());
+    }
+
+    // The next request gets a 410, as if the cursor was too old
+    void expireCursors() { _expired = true; }
+    // All requests get a 410, like from a broken proxy
+    void setAlwaysGone(bool gone) { _alwaysGone = gone; }
+
+    QStringList requestedPaths;
+
+private:
+    void readRequest(QTcpSocket *socket)
+    {
+        QByteArray &buffer = _buffers[socket];
+        buffer += socket->readAll();
+        int end = buffer.indexOf("\r\n\r\n");
+        if (end < 0)
+            return;
+        const QList<QByteArray> requestLine = buffer.left(buffer.indexOf("\r\n")).split(' ');
+        buffer.remove(0, end + 4);
+
+        const QUrl url(QString::fromUtf8(requestLine.value(1)));
+        requestedPaths.append(url.path());
+        const QString cursor = QUrlQuery(url).queryItemValue("cursor");
+
+        if (_expired || _alwaysGone) {
+            _expired = false;
+            reply(socket, "410 Gone", QByteArray());
+        } else if (cursor.isEmpty() || cursor.toInt() < _changes.size()) {
+            answer(socket, cursor.toInt());
+        } else {
+            _waiting.insert(socket, cursor.toInt());
+        }
+    }
+
+    void answer(QTcpSocket *socket, int cursor)
+    {
+        QJsonArray changed;
+        for (int i = cursor; i < _changes.size(); ++i) {
+            foreach (const QString &path, _changes[i])
+                changed.append(path);
+        }
+        QJsonObject json;
+        json["cursor"] = QString::number(_changes.size());
+        json["changed"] = changed;
+        reply(socket, "200 OK", QJsonDocument(json).toJson());
+    }
+
+    void reply(QTcpSocket *socket, const QByteArray &status, const QByteArray &body)
+    {
+        socket->write("HTTP/1.1 " + status + "\r\n"
+            "Content-Type: application/json\r\n"
+            "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body);
+    }
+
+    QTcpServer _server;
+    QHash<QTcpSocket *, QByteArray> _buffers;
+    QHash<QTcpSocket *, int> _waiting; // held requests -> their cursor
+    QList<QStringList> _changes;
+    bool _expired = false;
+    bool _alwaysGone = false;
+};
+
+class TestPushNotifications : public QObject
+{
+    Q_OBJECT
+
+    static AccountPtr createAccount(const QUrl &url)
+    {
+        auto account = Account::create();
+        account->setUrl(url);
+        account->setCredentials(new DummyCredentials);
+        return account;
+    }
+
+    static bool waitForRequests(FakeNotificationServer &server, int count)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (server.requestedPaths.size() < count && timer.elapsed() < 5000)
+            QTest::qWait(10);
+        return server.requestedPaths.size() >= count;
+    }
+
+private slots:
+    void testChangesAreDelivered()
+    {
+        FakeNotificationServer server;
+        PushNotifications push(createAccount(server.url()), "notify/longpoll");
+        QSignalSpy connectedSpy(&push, &PushNotifications::connectedChanged);
+        QSignalSpy changedSpy(&push, &PushNotifications::filesChanged);
+
+        server.push({ "/old" });
+        push.start();
+
+        // The first request only fetches the cursor, the old change is not reported
+        QVERIFY(connectedSpy.wait());
+        QVERIFY(push.isConnected());
+        QVERIFY(waitForRequests(server, 2));
+        QCOMPARE(server.requestedPaths.last(), QString("/notify/longpoll"));
+        QVERIFY(changedSpy.isEmpty());
+
+        server.push({ "/A/a1" });
+        QVERIFY(changedSpy.wait());
+        QCOMPARE(changedSpy.takeFirst()[0].toStringList(), QStringList("/A/a1"));
+
+        server.push({ "/B", "/C/c1" });
+        QVERIFY(changedSpy.wait());
+        QCOMPARE(changedSpy.takeFirst()[0].toStringList(), QStringList({ "/B", "/C/c1" }));
+
+        push.stop();
+        QVERIFY(!push.isConnected());
+    }
+
+    void testExpiredCursor()
+    {
+        FakeNotificationServer server;
+        PushNotifications push(createAccount(server.url()), "notify/longpoll");
+        QSignalSpy changedSpy(&push, &PushNotifications::filesChanged);
+        push.start();
+        QVERIFY(waitForRequests(server, 2));
+
+        // Everything might have changed since the cursor
+        server.expireCursors();
+        server.push({ "/A" });
+        QVERIFY(changedSpy.wait());
+        QCOMPARE(changedSpy.takeFirst()[0].toStringList(), QStringList("/A"));
+
+        // The next request is refused, the client starts over without a cursor
+        if (changedSpy.isEmpty())
+            QVERIFY(changedSpy.wait());
+        QCOMPARE(changedSpy.takeFirst()[0].toStringList(), QStringList("/"));
+        QVERIFY(push.isConnected());
+
+        // And gets the changes after the new cursor as usual
+        QVERIFY(waitForRequests(server, 5));
+        server.push({ "/B" });
+        QVERIFY(changedSpy.wait());
+        QCOMPARE(changedSpy.takeFirst()[0].toStringList(), QStringList("/B"));
+    }
+
+    void testAlwaysGone()
+    {
+        FakeNotificationServer server;
+        PushNotifications push(createAccount(server.url()), "notify/longpoll");
+        push.start();
+        QVERIFY(waitForRequests(server, 2));
+        QVERIFY(push.isConnected());
+
+        // The held request is answered, everything after that is refused
+        server.setAlwaysGone(true);
+        server.push({ "/A" });
+
+        // One immediate retry without a cursor, then the usual backoff
+        QVERIFY(waitForRequests(server, 4));
+        QTest::qWait(1000);
+        QCOMPARE(server.requestedPaths.size(), 4);
+        QVERIFY(!push.isConnected());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestPushNotifications)
+#include "testpushnotifications.moc"
@@ -0,0 +1,148 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QBuffer>
+
+#include "socketapi.h"
+#include "socketapi_p.h"
+#include "folderman.h"
+
+using namespace OCC;
+
+// Stands in for the socket of a connected shell extension
+class WriteCountingBuffer : public QBuffer
+{
+public:
+    WriteCountingBuffer()
+        : writes(0)
+    {
+        open(QIODevice::WriteOnly);
+    }
+
+    QList<QByteArray> takeLines()
+    {
+        QList<QByteArray> lines = data().split('\n');
+        lines.removeLast(); // after the last newline
+        buffer().clear();
+        seek(0);
+        writes = 0;
+        return lines;
+    }
+
+    int writes;
+
+protected:
+    qint64 writeData(const char *data, qint64 len) Q_DECL_OVERRIDE
+    {
+        ++writes;
+        return QBuffer::writeData(data, len);
+    }
+};
+
+class TestSocketApi : public QObject
+{
+    Q_OBJECT
+
+    FolderMan _fm;
+
+    SocketApi &api() { return *_fm.socketApi(); }
+
+    SocketListener *addListener(WriteCountingBuffer *buffer)
+    {
+        api()._listeners.append(SocketListener(buffer));
+        return &api()._listeners.last();
+    }
+
+private slots:
+    void cleanup()
+    {
+        // The buffers are gone already
+        api()._listeners.clear();
+        api().slotFlushStatusPushes();
+    }
+
+    void testNothingQueuedWithoutListeners()
+    {
+        api().broadcastStatusPushMessage("/sync/a", SyncFileStatus::StatusSync);
+        QVERIFY(api()._pendingStatusPushes.isEmpty());
+        QVERIFY(!api()._statusPushTimer.isActive());
+    }
+
+    void testCoalescing()
+    {
+        WriteCountingBuffer first, second;
+        addListener(&first)->registerMonitoredDirectory(qHash(QString("/sync")));
+        addListener(&second)->registerMonitoredDirectory(qHash(QString("/sync")));
+
+        api().broadcastStatusPushMessage("/sync/a", SyncFileStatus::StatusSync);
+        api().broadcastStatusPushMessage("/sync/b", SyncFileStatus::StatusSync);
+        api().broadcastStatusPushMessage("/sync/c", SyncFileStatus::StatusSync);
+        // Superseded: only the latest status, after the changes in between
+        api().broadcastStatusPushMessage("/sync/a", SyncFileStatus::StatusUpToDate);
+        // Unchanged: stays where it was
+        api().broadcastStatusPushMessage("/sync/b", SyncFileStatus::StatusSync);
+        QVERIFY(api()._statusPushTimer.isActive());
+        QCOMPARE(first.writes, 0);
+
+        api().slotFlushStatusPushes();
+        QVERIFY(!api()._statusPushTimer.isActive());
+        const QList<QByteArray> expected = QList<QByteArray>()
+            << "STATUS:SYNC:/sync/b"
+            << "STATUS:SYNC:/sync/c"
+            << "STATUS:OK:/sync/a";
+        QCOMPARE(first.writes, 1);
+        QCOMPARE(first.takeLines(), expected);
+        QCOMPARE(second.writes, 1);
+        QCOMPARE(second.takeLines(), expected);
+
+        // Nothing pending, nothing written
+        api().slotFlushStatusPushes();
+        QCOMPARE(first.writes, 0);
+    }
+
+    void testFlushBeforeBroadcast()
+    {
+        WriteCountingBuffer buffer;
+        addListener(&buffer)->registerMonitoredDirectory(qHash(QString("/sync")));
+
+        api().broadcastStatusPushMessage("/sync/a", SyncFileStatus::StatusUpToDate);
+        api().broadcastMessage("UPDATE_VIEW:/sync");
+        QVERIFY(!api()._statusPushTimer.isActive());
+        QCOMPARE(buffer.writes, 2);
+        QCOMPARE(buffer.takeLines(), QList<QByteArray>() << "STATUS:OK:/sync/a"
+                                                         << "UPDATE_VIEW:/sync");
+    }
+
+    void testSubscriptions()
+    {
+        WriteCountingBuffer monitoring, subscribing;
+        addListener(&monitoring)->registerMonitoredDirectory(qHash(QString("/sync")));
+        SocketListener *subscriber = addListener(&subscribing);
+        api().command_SUBSCRIBE_STATUS("/sync/sub/", subscriber);
+
+        api().broadcastStatusPushMessage("/sync/a", SyncFileStatus::StatusSync);
+        api().broadcastStatusPushMessage("/sync/sub/x", SyncFileStatus::StatusSync);
+        api().slotFlushStatusPushes();
+        QCOMPARE(monitoring.writes, 1);
+        QCOMPARE(monitoring.takeLines(), QList<QByteArray>() << "STATUS:SYNC:/sync/a");
+        QCOMPARE(subscribing.writes, 1);
+        QCOMPARE(subscribing.takeLines(), QList<QByteArray>() << "STATUS:SYNC:/sync/sub/x");
+
+        // A subscribing client doesn't get the directories it merely asked about
+        subscriber->registerMonitoredDirectory(qHash(QString("/sync")));
+        api().command_UNSUBSCRIBE_STATUS("/sync/sub", subscriber);
+        api().broadcastStatusPushMessage("/sync/a", SyncFileStatus::StatusUpToDate);
+        api().broadcastStatusPushMessage("/sync/sub/x", SyncFileStatus::StatusUpToDate);
+        api().slotFlushStatusPushes();
+        QCOMPARE(subscribing.writes, 0);
+        QCOMPARE(monitoring.takeLines(), QList<QByteArray>() << "STATUS:OK:/sync/a");
+    }
+};
+
+QTEST_GUILESS_MAIN(TestSocketApi)
+#include "testsocketapi.moc"
@@ -340,6 +340,36 @@ private slots:
         }
     }
 
+    void testErrorBlacklist()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        int nBlockedPUT = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation && request.url().path().endsWith("A/blocked")) {
+                nBlockedPUT++;
+                return new FakeErrorReply(op, request, this, 403);
+            }
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/blocked");
+        fakeFolder.syncOnce();
+        QCOMPARE(nBlockedPUT, 1);
+        QVERIFY(fakeFolder.syncJournal().errorBlacklistEntry("A/blocked").isValid());
+
+        // The blacklist entry suppresses the upload, and stays around
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.syncOnce();
+        QCOMPARE(nBlockedPUT, 1);
+        QVERIFY(fakeFolder.syncJournal().errorBlacklistEntry("A/blocked").isValid());
+
+        // Once the file is gone, the entry is stale
+        fakeFolder.localModifier().remove("A/blocked");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.syncJournal().errorBlacklistEntry("A/blocked").isValid());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testFakeConflict()
     {
         FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
@@ -405,6 +435,152 @@ private slots:
         QCOMPARE(nGET, 1);
     }
 
+    void testLargeDownload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions options;
+        options._syncDownloadsToDisk = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        // Larger than the download write buffer, and not a multiple of it
+        const qint64 size = 3 * 1024 * 1024 + 123;
+        fakeFolder.remoteModifier().insert("A/big", size, 'B');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(QFileInfo(fakeFolder.localPath() + "A/big").size(), size);
+
+        fakeFolder.remoteModifier().setContents("A/big", 'C');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testDirectoryCreationWhileUploading()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.setServerResponseDelay(50);
+
+        // Enough uploads to take all transfer slots, followed by a new tree
+        const int uploads = 10;
+        for (int i = 0; i < uploads; ++i)
+            fakeFolder.localModifier().insert(QString("A/upload%1").arg(i), 100);
+        fakeFolder.localModifier().mkdir("new");
+        fakeFolder.localModifier().mkdir("new/sub");
+        fakeFolder.localModifier().insert("new/sub/file", 100);
+
+        int putsStarted = 0;
+        int putsStartedBeforeMkcol = -1;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                ++putsStarted;
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MKCOL" && putsStartedBeforeMkcol < 0)
+                putsStartedBeforeMkcol = putsStarted;
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // The MKCOL did not wait for all uploads of A to be started
+        QVERIFY(putsStartedBeforeMkcol >= 0);
+        QVERIFY(putsStartedBeforeMkcol < uploads);
+    }
+
+    void testTaskPriority()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions options;
+        options._parallelNetworkJobs = false; // one job at a time, in scheduling order
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        // In path order the large upload would come first
+        fakeFolder.localModifier().insert("A/a0", 1024 * 1024);
+        fakeFolder.localModifier().remove("A/a1");
+        fakeFolder.localModifier().insert("A/a3", 100);
+        fakeFolder.localModifier().insert("A/a4", 100);
+        fakeFolder.syncEngine().addPriorityPath("A/a4");
+
+        QStringList order;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation || op == QNetworkAccessManager::DeleteOperation)
+                order.append(getFilePathFromUrl(request.url()));
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // User requested, then metadata only, then small and large transfers
+        QCOMPARE(order, QStringList() << "A/a4" << "A/a1" << "A/a3" << "A/a0");
+
+        // The priority paths only apply to one sync
+        fakeFolder.localModifier().insert("A/a5", 1024 * 1024);
+        fakeFolder.localModifier().insert("A/a6", 100);
+        order.clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(order, QStringList() << "A/a6" << "A/a5");
+    }
+
+    void testConflictChecksum()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        int nGET = 0, nPUT = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            if (op == QNetworkAccessManager::PutOperation)
+                ++nPUT;
+            return nullptr;
+        });
+        FileInfo &remoteInfo = dynamic_cast<FileInfo &>(fakeFolder.remoteModifier());
+        auto hasConflictFile = [&]() {
+            auto &children = fakeFolder.currentLocalState().find("A")->children;
+            return std::any_of(children.cbegin(), children.cend(), [](const FileInfo &fi) {
+                return fi.name.startsWith("a1_conflict");
+            });
+        };
+
+        auto mtime = QDateTime::currentDateTime().addDays(-4);
+        mtime.setMSecsSinceEpoch(mtime.toMSecsSinceEpoch() / 1000 * 1000);
+
+        // Same content, different mtime, matching checksum
+        //   -> no download, the local mtime becomes the remote one
+        fakeFolder.localModifier().setContents("A/a1", 'C');
+        fakeFolder.localModifier().setModTime("A/a1", mtime);
+        fakeFolder.remoteModifier().setContents("A/a1", 'C');
+        fakeFolder.remoteModifier().setModTime("A/a1", mtime.addDays(1));
+        remoteInfo.find("A/a1")->checksums = "SHA1:56900fb1d337cf7237ff766276b9c1e8ce507427";
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 0);
+        QVERIFY(!hasConflictFile());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 0);
+        QCOMPARE(nPUT, 0);
+
+        // Same content, but a wrong server checksum
+        //   -> downloaded, but not a conflict
+        fakeFolder.localModifier().setContents("A/a1", 'D');
+        fakeFolder.localModifier().setModTime("A/a1", mtime.addDays(2));
+        fakeFolder.remoteModifier().setContents("A/a1", 'D');
+        fakeFolder.remoteModifier().setModTime("A/a1", mtime.addDays(3));
+        remoteInfo.find("A/a1")->checksums = "SHA1:bad";
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 1);
+        QVERIFY(!hasConflictFile());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Different content of the same size
+        //   -> downloaded, a real conflict
+        fakeFolder.localModifier().setContents("A/a1", 'L');
+        fakeFolder.localModifier().setModTime("A/a1", mtime.addDays(4));
+        fakeFolder.remoteModifier().setContents("A/a1", 'C');
+        fakeFolder.remoteModifier().setModTime("A/a1", mtime.addDays(5));
+        remoteInfo.find("A/a1")->checksums = "SHA1:56900fb1d337cf7237ff766276b9c1e8ce507427";
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 2);
+        QVERIFY(hasConflictFile());
+        QCOMPARE(fakeFolder.currentLocalState().find("A/a1")->contentChar, 'C');
+    }
+
     /**
      * Checks whether SyncFileItems have the expected properties before start
      * of propagation.
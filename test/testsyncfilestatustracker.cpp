@@ -29,6 +29,16 @@ public:
         return SyncFileStatus();
     }
 
+    int pushCount(const QString &relativePath) const {
+        QFileInfo file(_syncEngine.localPath(), relativePath);
+        int count = 0;
+        for (int i = 0; i < size(); ++i) {
+            if (QFileInfo(at(i)[0].toString()) == file)
+                ++count;
+        }
+        return count;
+    }
+
     bool statusEmittedBefore(const QString &firstPath, const QString &secondPath) const {
         QFileInfo firstFile(_syncEngine.localPath(), firstPath);
         QFileInfo secondFile(_syncEngine.localPath(), secondPath);
@@ -427,6 +437,38 @@ private slots:
         QCOMPARE(statusSpy.statusOf("C/c1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
     }
 
+    void parentStatusPushedOncePerBatch() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.serverErrorPaths().append("A/a1");
+        fakeFolder.serverErrorPaths().append("A/a2");
+        fakeFolder.serverErrorPaths().append("A/a3");
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.localModifier().appendByte("A/a2");
+        fakeFolder.localModifier().insert("A/a3");
+        fakeFolder.syncOnce();
+        StatusPushSpy statusSpy(fakeFolder.syncEngine());
+
+        // The three files are blacklisted now and all reported before propagation
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(statusSpy.statusOf(""), SyncFileStatus(SyncFileStatus::StatusWarning));
+        QCOMPARE(statusSpy.statusOf("A"), SyncFileStatus(SyncFileStatus::StatusWarning));
+        QCOMPARE(statusSpy.statusOf("A/a1"), SyncFileStatus(SyncFileStatus::StatusError));
+        QCOMPARE(statusSpy.statusOf("A/a2"), SyncFileStatus(SyncFileStatus::StatusError));
+        QCOMPARE(statusSpy.statusOf("A/a3"), SyncFileStatus(SyncFileStatus::StatusError));
+        QVERIFY(statusSpy.statusEmittedBefore("A/a3", "A"));
+        QVERIFY(statusSpy.statusEmittedBefore("A", ""));
+        // At most once for the item of the folder itself, and once for all its children
+        QVERIFY(statusSpy.pushCount("A") <= 2);
+        QVERIFY(statusSpy.pushCount("") <= 2);
+
+        fakeFolder.execUntilFinished();
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(fakeFolder.syncEngine().syncFileStatusTracker().fileStatus("A/a4"), SyncFileStatus(SyncFileStatus::StatusNone));
+        QCOMPARE(fakeFolder.syncEngine().syncFileStatusTracker().fileStatus("B"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+    }
+
     void sharedStatus() {
         SyncFileStatus sharedUpToDateStatus(SyncFileStatus::StatusUpToDate);
         sharedUpToDateStatus.setShared(true);
@@ -461,6 +503,68 @@ private slots:
 
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
+
+    void batchedStatusMatchesSingleStatus() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().excludedFiles().addExcludeExpr("B/b2");
+        fakeFolder.serverErrorPaths().append("B/b1");
+        fakeFolder.localModifier().appendByte("B/b1");
+        fakeFolder.localModifier().insert("B/b3");
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        const QStringList paths = { "", "A", "A/a1", "A/a2", "B", "B/b1", "B/b2", "B/b3", "C/missing" };
+
+        auto verifyBatch = [&]() {
+            // Query in batch first, so that the single lookups are served by what it cached
+            const QVector<SyncFileStatus> statuses = tracker.fileStatuses(paths);
+            QCOMPARE(statuses.size(), paths.size());
+            for (int i = 0; i < paths.size(); ++i)
+                QCOMPARE(statuses.at(i), tracker.fileStatus(paths.at(i)));
+        };
+
+        verifyBatch();
+        QCOMPARE(tracker.fileStatus("B/b2"), SyncFileStatus(SyncFileStatus::StatusWarning));
+        QCOMPARE(tracker.fileStatus("B/b3"), SyncFileStatus(SyncFileStatus::StatusNone));
+
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        verifyBatch();
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(tracker.fileStatus("B/b3"), SyncFileStatus(SyncFileStatus::StatusSync));
+
+        fakeFolder.execUntilFinished();
+        verifyBatch();
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("B"), SyncFileStatus(SyncFileStatus::StatusWarning));
+        QCOMPARE(tracker.fileStatus("B/b1"), SyncFileStatus(SyncFileStatus::StatusError));
+        QCOMPARE(tracker.fileStatus("B/b3"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("C/missing"), SyncFileStatus(SyncFileStatus::StatusNone));
+    }
+
+    void cachedStatusFollowsChanges() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("A/a3"), SyncFileStatus(SyncFileStatus::StatusNone));
+
+        // A new file is reported by the folder watcher before it gets synced
+        fakeFolder.localModifier().insert("A/a3");
+        tracker.slotPathTouched(fakeFolder.localPath() + "A/a3");
+        QCOMPARE(tracker.fileStatus("A/a3"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(tracker.fileStatus("A/a3"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+
+        // Entries below a removed folder must not stay known
+        QCOMPARE(tracker.fileStatus("C/c1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        fakeFolder.remoteModifier().remove("C");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(tracker.fileStatus("C/c1"), SyncFileStatus(SyncFileStatus::StatusNone));
+
+        // Becoming excluded is picked up by the next sync
+        fakeFolder.syncEngine().excludedFiles().addExcludeExpr("A/a2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(tracker.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusWarning));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncFileStatusTracker)
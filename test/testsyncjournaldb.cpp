@@ -31,6 +31,24 @@ public:
         return Utility::qDateTimeFromTime_t(Utility::qDateTimeToTime_t(time));
     }
 
+    // Counts the records with that path, as seen by another connection
+    int committedRecordCount(const QByteArray &path)
+    {
+        sqlite3 *db = nullptr;
+        int count = -1;
+        if (sqlite3_open_v2(_db.databaseFilePath().toUtf8().constData(), &db, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK) {
+            sqlite3_stmt *stmt = nullptr;
+            if (sqlite3_prepare_v2(db, "SELECT count(*) FROM metadata WHERE path=?1;", -1, &stmt, nullptr) == SQLITE_OK) {
+                sqlite3_bind_text(stmt, 1, path.constData(), path.size(), SQLITE_TRANSIENT);
+                if (sqlite3_step(stmt) == SQLITE_ROW)
+                    count = sqlite3_column_int(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
+        sqlite3_close(db);
+        return count;
+    }
+
 private slots:
 
     void initTestCase()
@@ -85,6 +103,33 @@ private slots:
         QVERIFY(!record.isValid());
     }
 
+    void testFileRecords()
+    {
+        SyncJournalFileRecord record;
+        record._path = "batch/a";
+        record._inode = 1;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._type = 0;
+        record._etag = "e1";
+        record._fileId = "f1";
+        record._fileSize = 10;
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "batch/b";
+        record._fileSize = 20;
+        QVERIFY(_db.setFileRecord(record));
+
+        auto records = _db.getFileRecords(QStringList() << "batch/b" << "batch/missing" << "" << "batch/a");
+        QCOMPARE(records.size(), 4);
+        QCOMPARE(records[0]._path, QString("batch/b"));
+        QCOMPARE(records[0]._fileSize, qint64(20));
+        QVERIFY(!records[1].isValid());
+        QVERIFY(!records[2].isValid());
+        QCOMPARE(records[3]._path, QString("batch/a"));
+        QVERIFY(records[3] == _db.getFileRecord("batch/a"));
+
+        QVERIFY(_db.deleteFileRecord("batch", true));
+    }
+
     void testFileRecordChecksum()
     {
         // Try with and without a checksum
@@ -163,6 +208,105 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testGroupCommit()
+    {
+        _db.setGroupCommitInterval(60 * 1000);
+        _db.commit("before group commit");
+
+        SyncJournalFileRecord record;
+        record._path = "groupcommit";
+        record._inode = 1;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._type = 0;
+        record._etag = "etag";
+        record._fileId = "groupcommitid";
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("deferred");
+
+        // Visible through the journal, but not committed yet
+        QVERIFY(_db.getFileRecord("groupcommit").isValid());
+        QCOMPARE(committedRecordCount("groupcommit"), 0);
+
+        // Commits without startTrans are never deferred
+        _db.commit("not deferred", false);
+        QCOMPARE(committedRecordCount("groupcommit"), 1);
+
+        _db.commit("start transaction");
+        QVERIFY(_db.deleteFileRecord("groupcommit"));
+        _db.commit("deferred delete");
+        QCOMPARE(committedRecordCount("groupcommit"), 1);
+
+        // Disabling commits what is pending
+        _db.setGroupCommitInterval(0);
+        QCOMPARE(committedRecordCount("groupcommit"), 0);
+    }
+
+    void testPostSyncCleanup()
+    {
+        auto makeRecord = [&](const QString &path) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._inode = 1;
+            record._modtime = dropMsecs(QDateTime::currentDateTime());
+            record._type = 0;
+            record._etag = "etag";
+            record._fileId = path.toUtf8();
+            record._remotePerm = RemotePermissions("RW");
+            QVERIFY(_db.setFileRecord(record));
+        };
+        makeRecord("cleanup/seen");
+        makeRecord("cleanup/unseen");
+        makeRecord("cleanup/unavailable/unseen");
+
+        _db.startSyncGeneration();
+        // Not in the journal yet, that's fine
+        QVERIFY(_db.markFileRecordsSeen(QVector<qint64>()
+            << SyncJournalDb::getPHash("cleanup/seen") << SyncJournalDb::getPHash("cleanup/renametarget")));
+        makeRecord("cleanup/written");
+
+        QVERIFY(_db.postSyncCleanup(QSet<QString>() << "cleanup/unavailable"));
+        QVERIFY(_db.getFileRecord("cleanup/seen").isValid());
+        QVERIFY(_db.getFileRecord("cleanup/written").isValid());
+        QVERIFY(_db.getFileRecord("cleanup/unavailable/unseen").isValid());
+        QVERIFY(!_db.getFileRecord("cleanup/unseen").isValid());
+
+        // Everything that was not seen in the next generation goes away
+        _db.startSyncGeneration();
+        QVERIFY(_db.markFileRecordsSeen(QVector<qint64>() << SyncJournalDb::getPHash("cleanup/written")));
+        QVERIFY(_db.postSyncCleanup(QSet<QString>()));
+        QVERIFY(_db.getFileRecord("cleanup/written").isValid());
+        QVERIFY(!_db.getFileRecord("cleanup/seen").isValid());
+        QVERIFY(!_db.getFileRecord("cleanup/unavailable/unseen").isValid());
+    }
+
+    void testMarkManyFileRecordsSeen()
+    {
+        // More than fit into one UPDATE
+        const int count = 1234;
+        QVector<qint64> phashes;
+        for (int i = 0; i < count; ++i) {
+            SyncJournalFileRecord record;
+            record._path = QString("many/file%1").arg(i);
+            record._inode = 1;
+            record._modtime = dropMsecs(QDateTime::currentDateTime());
+            record._type = 0;
+            record._etag = "etag";
+            record._fileId = record._path.toUtf8();
+            record._remotePerm = RemotePermissions("RW");
+            QVERIFY(_db.setFileRecord(record));
+            if (i != 42)
+                phashes.append(SyncJournalDb::getPHash(record._path));
+        }
+
+        _db.startSyncGeneration();
+        QVERIFY(_db.markFileRecordsSeen(phashes));
+        QVERIFY(_db.postSyncCleanup(QSet<QString>()));
+        QVERIFY(_db.getFileRecord("many/file0").isValid());
+        QVERIFY(_db.getFileRecord("many/file1233").isValid());
+        QVERIFY(!_db.getFileRecord("many/file42").isValid());
+    }
+
     void testNumericId()
     {
         SyncJournalFileRecord record;